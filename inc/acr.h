@@ -2,6 +2,9 @@
 #define ACR_H
 
 #include "gpslib/gps_interface.h"
+#include "lap.h"
+#include "motion.h"
+#include "storage.h"
 #include <stdint.h>
 
 typedef enum cone_id {
@@ -20,28 +23,50 @@ typedef enum acr_error_t {
   ERROR_CONE_SESSION_START,
   ERROR_FULL_SESSION_SETUP,
   ERROR_FULL_SESSION_START,
+  ERROR_STORAGE_WRITE,
 
   ERORR_SIZE
 } acr_error_t;
 
 typedef struct cone_t {
+  // Least delayed arrival of the GPS epoch (clock_model), and its time of week
   uint64_t timestamp;
+  uint32_t itow;
   cone_id id;
   double lat;
   double lon;
   double alt;
 } cone_t;
 
+#define ACR_MAX_SOURCES 4
+// gpslib keeps one FILE per message in gps_files_t
+#define ACR_GPS_FILES (sizeof(gps_files_t) / sizeof(FILE *))
+
+// Output of one receiver
+typedef struct session_source_t {
+  char name[32];
+  gps_files_t files;
+  // Where the gpslib csv streams write, closed with the files
+  storage_t csv[ACR_GPS_FILES];
+  storage_t raw;
+} session_source_t;
+
 typedef struct full_session_t {
   int active;
-  gps_files_t files;
+  // Receivers logged, 0 means a single unnamed one
+  int source_count;
+  session_source_t sources[ACR_MAX_SOURCES];
+  lap_detector_t laps;
+  motion_t motion;
+  // Restarts of the session, each one logs to its own gps folder
+  int part;
   char session_name[1024];
   char session_path[1024];
 } full_session_t;
 
 typedef struct cone_session_t {
   int active;
-  FILE *file;
+  storage_t storage;
   char session_name[1024];
   char session_path[1024];
 } cone_session_t;
@@ -64,11 +89,27 @@ const char *cone_id_to_string(cone_id id);
 int cone_session_setup(cone_session_t *session, const char *basepath);
 int cone_session_start(cone_session_t *session);
 int cone_session_stop(cone_session_t *session);
+// Appends to an interrupted session
+int cone_session_resume(cone_session_t *session, const char *basepath,
+                        const char *name);
+// Calls callback for every cone already saved, returns the count
+int cone_session_read(cone_session_t *session,
+                      void (*callback)(cone_t *cone, void *user), void *user);
 
 int csv_session_setup(full_session_t *session, const char *basepath);
 int csv_session_start(full_session_t *session);
 int csv_session_stop(full_session_t *session);
+// Continues an interrupted session in the gps folder of the given part
+int csv_session_resume(full_session_t *session, const char *basepath,
+                       const char *name, int part);
+// Number of files of the session that failed to write (raw logs, gpslib
+// csv, stationary summaries, laps index)
+int csv_session_errors(const full_session_t *session);
+void csv_session_write_raw(full_session_t *session, int source,
+                           const unsigned char *start_sequence, int start_size,
+                           const char *line, int line_size);
 
 void cone_session_write(cone_session_t *session, cone_t *cone);
+void cone_print(FILE *file, const cone_t *cone);
 
 #endif // ACR_H
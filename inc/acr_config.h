@@ -0,0 +1,51 @@
+#ifndef ACR_CONFIG_H
+#define ACR_CONFIG_H
+
+#include <stdint.h>
+
+typedef enum cone_filter_t {
+  // Position of the last fix before the cone is saved
+  CONE_FILTER_LAST = 0,
+  // Complementary filter over the fixes while standing at the cone
+  CONE_FILTER_MEAN = 1,
+  CONE_FILTER_SIZE,
+} cone_filter_t;
+
+typedef struct pins_config_t {
+  int led_green;
+  int led_red;
+  int button_yellow;
+  int button_blue;
+  int button_orange;
+  int button_mode;
+  uint64_t debounce_us;
+  // Windows of single buttons, debounce_us when 0
+  uint64_t debounce_yellow_us;
+  uint64_t debounce_blue_us;
+  uint64_t debounce_orange_us;
+  uint64_t debounce_mode_us;
+} pins_config_t;
+
+typedef struct cones_config_t {
+  cone_filter_t filter;
+  // Weight of the previous position in the mean
+  double mean_weight;
+  // Time the mean runs, and minimum time between two cones
+  uint64_t repress_us;
+} cones_config_t;
+
+typedef struct acr_config_t {
+  pins_config_t pins;
+  cones_config_t cones;
+} acr_config_t;
+
+void acr_config_default(acr_config_t *config);
+// Handles the [pins] section and the filter keys of [cones]
+int acr_config_handler(void *user, const char *section, const char *key,
+                       const char *value);
+// Prints every invalid value, returns -1 if there is any
+int acr_config_validate(const acr_config_t *config);
+
+const char *cone_filter_to_string(cone_filter_t filter);
+
+#endif // ACR_CONFIG_H
@@ -0,0 +1,68 @@
+#ifndef CLOCK_MODEL_H
+#define CLOCK_MODEL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Epochs used for the fit, about 13 s at 20 Hz
+#define CLOCK_MODEL_WINDOW 256
+// Fewer epochs give no model, times are left as they arrived
+#define CLOCK_MODEL_MIN_SAMPLES 16
+// Host and receiver clocks never differ more than this (ppm)
+#define CLOCK_MODEL_MAX_SKEW_PPM 1000.0
+#define CLOCK_LATENCY_BIN_US 500
+#define CLOCK_LATENCY_BINS 64
+
+typedef struct clock_sample_t {
+  // GPS time of the epoch, iTOW unwrapped over week rollovers
+  int64_t gps_us;
+  uint64_t host_us;
+} clock_sample_t;
+
+typedef struct clock_latency_t {
+  // Last bin counts everything above
+  uint64_t bins[CLOCK_LATENCY_BINS];
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t max_us;
+} clock_latency_t;
+
+// Least delayed host arrival time of the GPS epochs: the lower envelope of the
+// arrival times over a sliding window, so the epoch itself plus the minimum
+// receiver and serial delay
+typedef struct clock_model_t {
+  clock_sample_t samples[CLOCK_MODEL_WINDOW];
+  int count;
+  int next;
+
+  int has_itow;
+  uint32_t last_itow;
+  int64_t week_us;
+
+  int valid;
+  // host = host_ref + offset + slope * (gps - gps_ref)
+  int64_t gps_ref;
+  uint64_t host_ref;
+  double slope;
+  double offset_us;
+
+  // From the modelled epoch time to the parse of the message
+  clock_latency_t latency;
+  uint64_t resets;
+} clock_model_t;
+
+void clock_model_init(clock_model_t *model);
+// Adds the arrival time of an epoch and refits the model
+void clock_model_update(clock_model_t *model, uint32_t itow_ms,
+                        uint64_t arrival_t);
+// Least delayed arrival time of the epoch, arrival_t while there is no model
+uint64_t clock_model_host_time(const clock_model_t *model, uint32_t itow_ms,
+                               uint64_t arrival_t);
+void clock_model_add_latency(clock_model_t *model, uint64_t latency_us);
+void clock_model_reset_latency(clock_model_t *model);
+// Histogram as latency_us,count rows
+int clock_model_write_latency(const clock_model_t *model, const char *path);
+void clock_model_report(const clock_model_t *model, const char *name,
+                        FILE *file);
+
+#endif // CLOCK_MODEL_H
@@ -0,0 +1,17 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Called for every "key = value" line, returns -1 to reject the entry
+typedef int (*config_handler_t)(void *user, const char *section,
+                                const char *key, const char *value);
+
+// Parses an ini-like file with [section] headers and # or ; comments.
+// Returns -1 if the file cannot be opened, else the number of rejected
+// entries.
+int config_parse(const char *path, config_handler_t handler, void *user);
+
+int config_int(const char *value, int *out);
+int config_double(const char *value, double *out);
+int config_bool(const char *value, int *out);
+
+#endif // CONFIG_H
@@ -1,21 +1,38 @@
 #ifndef DEFINES_H
 #define DEFINES_H
 
-#define P_LED_GN (5)
-#define P_LED_RD (6)
+// Pins, debounce and cone filter are set in acr.conf (acr_config.h)
+#define MAX_PINS 52
 
-#define P_BTN_YL (22)
-#define P_BTN_BL (23)
-#define P_BTN_OR (24)
+// Fixes older than this are left out of the combined cone position
+#define CONE_COMBINE_MAX_AGE_US (200000)
 
-#define P_BTN_MODE (27)
+#define ACR_CONFIG_FILE "acr.conf"
 
-#define MAX_PINS 52
+#define LAP_LINE_FILE "lap_line.csv"
+#define LAP_MIN_US (10000000)
+
+#define DISPATCH_FILE "dispatch.conf"
+
+// Messages of the receivers are reordered within this window
+#define RECEIVER_MERGE_US (20000)
+
+#define FAULT_BACKOFF_MIN_US (100000)
+#define FAULT_BACKOFF_MAX_US (5000000)
+
+#define RESUME_FILE ".acr_state"
+// Startup is over at the first fix at least this accurate
+#define FIX_MAX_HACC_M (10.0)
 
-#define DEBOUNCE_US (10000)
+#define UBX_CFG_FILE ".ubx_cfg"
+#define UBX_MEAS_RATE_MS (50)
+#define UBX_ACK_TIMEOUT_US (300000)
+#define UBX_ACK_RETRIES (3)
 
-#define CONE_ENABLE_MEAN (1)
-#define CONE_MEAN_COMPLEMENTARY (0.9)
-#define CONE_REPRESS_US (1000000)
+#define TRACK_CONE_SPACING_M (5.0)
+#define TRACK_MAX_GAP_M (6.0)
+// Cones of the same colour further away are not linked, up to 4 missing
+#define TRACK_LINK_MAX_M (25.0)
+#define TRACK_PARTNER_MAX_M (8.0)
 
 #endif // DEFINE_H
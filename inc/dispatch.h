@@ -0,0 +1,74 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "acr.h"
+#include "gpslib/gps_interface.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define DISPATCH_MAX_MESSAGES 64
+#define DISPATCH_MAX_SOURCES ACR_MAX_SOURCES
+// Byte rate of each type is measured over this window
+#define DISPATCH_RATE_WINDOW_US (1000000)
+// Logged bytes per second of a type for each receiver, above it the type is
+// decimated automatically
+#define DISPATCH_BYTE_BUDGET (16 * 1024)
+
+typedef enum dispatch_policy_t {
+  DISPATCH_IGNORE,
+  DISPATCH_LOG_RAW,
+  DISPATCH_PARSE_LOG,
+  DISPATCH_PARSE_ONLY,
+
+  DISPATCH_POLICY_SIZE
+} dispatch_policy_t;
+
+// Actions returned by dispatch_message
+#define DISPATCH_PARSE (1 << 0)
+#define DISPATCH_LOG (1 << 1)
+#define DISPATCH_RAW (1 << 2)
+
+typedef struct dispatch_entry_t {
+  dispatch_policy_t policy;
+  // Minimum time between two logged messages, 0 logs every message
+  uint32_t min_interval_us;
+
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t parsed;
+  uint64_t logged;
+  uint64_t decimated;
+  // Each receiver is decimated on its own
+  uint64_t last_logged_t[DISPATCH_MAX_SOURCES];
+
+  // Counters at the start of the rate window
+  uint64_t window_t;
+  uint64_t window_count;
+  uint64_t window_bytes;
+  // Interval that keeps the type within the byte budget, 0 while it is
+  uint32_t auto_interval_us;
+} dispatch_entry_t;
+
+typedef struct dispatch_table_t {
+  dispatch_entry_t entries[GPS_PROTOCOL_TYPE_SIZE][DISPATCH_MAX_MESSAGES];
+  // Bytes per second, 0 never decimates automatically
+  uint32_t byte_budget;
+} dispatch_table_t;
+
+const char *dispatch_policy_to_string(dispatch_policy_t policy);
+
+void dispatch_init(dispatch_table_t *table, dispatch_policy_t policy);
+int dispatch_set(dispatch_table_t *table, int protocol, int message,
+                 dispatch_policy_t policy, uint32_t min_interval_us);
+// Lines of "<protocol> <message> <policy> [min interval us]" and an optional
+// "budget <bytes per second>"
+int dispatch_load(dispatch_table_t *table, const char *path);
+
+// Updates the counters and returns the DISPATCH_* actions for the message
+int dispatch_message(dispatch_table_t *table,
+                     const gps_protocol_and_message *match, int source,
+                     int size, int logging, uint64_t t);
+
+void dispatch_report(const dispatch_table_t *table, FILE *file);
+
+#endif // DISPATCH_H
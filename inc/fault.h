@@ -0,0 +1,45 @@
+#ifndef FAULT_H
+#define FAULT_H
+
+#include "acr.h"
+#include <stdint.h>
+
+typedef struct fault_t {
+  int active;
+  // When it was raised and when recovery is tried next
+  uint64_t start_t;
+  uint64_t retry_t;
+  uint64_t backoff_us;
+  int attempts;
+  uint64_t count;
+} fault_t;
+
+typedef struct fault_manager_t {
+  fault_t faults[ERORR_SIZE];
+  // Raised from other threads, activated by fault_update
+  uint32_t pending;
+  int active_count;
+} fault_manager_t;
+
+void fault_init(fault_manager_t *manager);
+
+// Thread safe, never blocks
+void fault_raise(fault_manager_t *manager, acr_error_t error);
+
+// Activates the raised faults, returns the number of active faults
+int fault_update(fault_manager_t *manager, uint64_t t);
+
+int fault_active(const fault_manager_t *manager, acr_error_t error);
+
+// Returns 1 when a recovery attempt is due, the next one is scheduled with
+// a doubled backoff
+int fault_retry(fault_manager_t *manager, acr_error_t error, uint64_t t);
+
+// Marks the fault recovered and appends it to dir/faults.csv
+void fault_clear(fault_manager_t *manager, acr_error_t error, uint64_t t,
+                 const char *dir);
+
+// Lowest active fault, ERORR_SIZE if none
+acr_error_t fault_first(const fault_manager_t *manager);
+
+#endif // FAULT_H
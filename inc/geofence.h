@@ -0,0 +1,67 @@
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+#include <stdint.h>
+
+#define GEOFENCE_MAX_TRACKS 8
+#define GEOFENCE_MAX_POINTS 32
+
+typedef struct geofence_track_t {
+  char name[32];
+  // Vertices given one by one in the config
+  int has_points;
+  int count;
+  double lat[GEOFENCE_MAX_POINTS];
+  double lon[GEOFENCE_MAX_POINTS];
+
+  // Vertices in local metres from the first one, with their bounding box
+  double x[GEOFENCE_MAX_POINTS];
+  double y[GEOFENCE_MAX_POINTS];
+  double min_x, min_y, max_x, max_y;
+} geofence_track_t;
+
+typedef struct geofence_config_t {
+  int enabled;
+  // A fix counts as inside or outside only this far from the border
+  double margin_m;
+  // Time on the same side before the session is started or stopped
+  double enter_s;
+  double exit_s;
+  int track_count;
+  geofence_track_t tracks[GEOFENCE_MAX_TRACKS];
+} geofence_config_t;
+
+typedef enum geofence_event_t {
+  GEOFENCE_NONE = 0,
+  GEOFENCE_ENTER = 1,
+  GEOFENCE_EXIT = 2,
+} geofence_event_t;
+
+typedef struct geofence_t {
+  geofence_config_t config;
+  // Track of the last fix, checked first; -1 outside of all of them
+  int current;
+  int inside;
+  // First fix on the other side of the border, 0 if none
+  uint64_t crossing_t;
+  int crossing_track;
+} geofence_t;
+
+// The tracks of the viewer maps, overridden by [track.<name>] sections
+void geofence_config_default(geofence_config_t *config);
+// Handles [geofence] and [track.<name>] with bounds or a point per vertex
+int geofence_config_handler(void *user, const char *section, const char *key,
+                            const char *value);
+const geofence_track_t *geofence_find(const geofence_config_t *config,
+                                      const char *name);
+void geofence_bounds(const geofence_track_t *track, double *lat_min,
+                     double *lon_min, double *lat_max, double *lon_max);
+
+void geofence_init(geofence_t *geofence, const geofence_config_t *config);
+// Call for each fix, reports when the track was entered or left
+geofence_event_t geofence_update(geofence_t *geofence, double lat, double lon,
+                                 uint64_t t);
+// Name of the track the last event refers to
+const char *geofence_track_name(const geofence_t *geofence);
+
+#endif // GEOFENCE_H
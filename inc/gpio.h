@@ -1,6 +1,7 @@
 #ifndef GPIO_H
 #define GPIO_H
 
+#include "acr_config.h"
 #include <stdint.h>
 
 #ifndef ACR_NO_PIGPIO
@@ -22,10 +23,12 @@ int gpioRead(int);
 int gpioWrite(int, int);
 int gpioSetMode(int, int);
 int gpioSetPullUpDown(int, int);
+uint32_t gpioTick();
 void gpioSetAlertFuncEx(int pin, eventFuncEx_t func, void *user_data);
 
 #endif // ACR_NO_PIGPIO
 
-int gpioSkipForDebounce(int pin, int state);
+// Pins of the buttons, for the keys of the emulation
+void gpio_configure(const pins_config_t *pins);
 
 #endif // GPIO_H
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef GPIO_INPUT_H
+#define GPIO_INPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define GPIO_INPUT_MAX 8
+// Edges waiting for the main loop, for each pin (power of two)
+#define GPIO_INPUT_QUEUE_SIZE 64
+#define GPIO_INPUT_BOUNCE_BINS 40
+#define GPIO_INPUT_BOUNCE_BIN_US 500
+
+// Edge as reported by pigpio, tick in microseconds (wraps every ~72 min)
+typedef struct gpio_edge_t {
+  uint32_t tick;
+  int level;
+} gpio_edge_t;
+
+// Debounced transition
+typedef struct gpio_event_t {
+  int pin;
+  int level;
+  uint32_t tick;
+  // Host time of the edge
+  uint64_t t;
+} gpio_event_t;
+
+typedef struct gpio_input_stats_t {
+  uint64_t edges;
+  uint64_t presses;
+  uint64_t releases;
+  // Edges within the debounce window of the accepted one
+  uint64_t bounces;
+  // Time from the accepted edge to each bounce, the last bin counts the rest
+  uint64_t bounce_bins[GPIO_INPUT_BOUNCE_BINS];
+  uint32_t max_bounce_us;
+  uint32_t min_press_us;
+} gpio_input_stats_t;
+
+typedef struct gpio_pin_t {
+  int pin;
+  char name[16];
+  uint32_t debounce_us;
+
+  // Single producer (pigpio alert thread), single consumer (main loop)
+  gpio_edge_t queue[GPIO_INPUT_QUEUE_SIZE];
+  uint32_t head;
+  uint32_t tail;
+  // Edges lost with a full queue
+  uint64_t dropped;
+
+  // Debounced level, pulled up: 0 while pressed
+  int level;
+  int raw_level;
+  uint32_t raw_tick;
+  uint32_t accepted_tick;
+  uint32_t press_tick;
+  gpio_input_stats_t stats;
+
+  struct gpio_input_t *inputs;
+} gpio_pin_t;
+
+typedef struct gpio_input_t {
+  gpio_pin_t pins[GPIO_INPUT_MAX];
+  int count;
+  // Signalled at every edge, to wake the main loop
+  int event_fd;
+} gpio_input_t;
+
+typedef void (*gpio_event_handler_t)(const gpio_event_t *event, void *user);
+
+int gpio_input_init(gpio_input_t *inputs);
+// Sets the pin as a pulled up input and enables its alert
+int gpio_input_add(gpio_input_t *inputs, int pin, const char *name,
+                   uint64_t debounce_us);
+int gpio_input_fd(const gpio_input_t *inputs);
+// Debounces the queued edges and calls the handler for every transition,
+// in tick order for each pin. Never blocks.
+void gpio_input_service(gpio_input_t *inputs, gpio_event_handler_t handler,
+                        void *user);
+// Debounced level, -1 for a pin that was not added
+int gpio_input_level(const gpio_input_t *inputs, int pin);
+int gpio_input_write_stats(const gpio_input_t *inputs, const char *path);
+void gpio_input_report(const gpio_input_t *inputs, FILE *file);
+
+#endif // GPIO_INPUT_H
@@ -0,0 +1,63 @@
+#ifndef LAP_H
+#define LAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Start/finish line, given by its two end points
+typedef struct lap_line_t {
+  double lat0;
+  double lon0;
+  double lat1;
+  double lon1;
+} lap_line_t;
+
+typedef struct lap_t {
+  int number;
+  // Rows of the trajectory NAV-HPPOSLLH csv (0 based, header excluded)
+  uint64_t start_row;
+  uint64_t end_row;
+  // Interpolated crossing times (us)
+  uint64_t start_t;
+  uint64_t end_t;
+} lap_t;
+
+typedef struct lap_detector_t {
+  int enabled;
+  lap_line_t line;
+
+  int has_prev;
+  double prev_x;
+  double prev_y;
+  uint64_t prev_t;
+  // Number of fixes fed since the last reset
+  uint64_t row;
+
+  // +1/-1 once the first crossing fixed the driving direction
+  int direction;
+  int in_lap;
+  lap_t current;
+  lap_t last;
+  int lap_count;
+
+  FILE *index;
+  // Folder of the NAV-HPPOSLLH csv the rows refer to
+  char gps_dir[16];
+} lap_detector_t;
+
+int lap_line_load(lap_line_t *line, const char *path);
+int lap_line_save(const lap_line_t *line, const char *path);
+
+void lap_detector_init(lap_detector_t *laps, const lap_line_t *line);
+void lap_detector_reset(lap_detector_t *laps);
+
+// Appends to the index of the session if it exists
+int lap_index_open(lap_detector_t *laps, const char *session_path,
+                   const char *gps_dir);
+int lap_index_close(lap_detector_t *laps);
+
+// Feed a fix, returns 1 when a lap has been completed (see laps->last)
+int lap_detector_update(lap_detector_t *laps, double lat, double lon,
+                        uint64_t t);
+
+#endif // LAP_H
@@ -22,6 +22,9 @@ void led_set_state(led_t *led, int on_ms, int off_ms);
 
 void led_blink_once(led_t *led, int on_ms);
 
+// Blink code times, pause, repeat (error codes)
+void led_set_code(led_t *led, int code, int on_ms, int off_ms, int pause_ms);
+
 void led_on(led_t *led);
 void led_off(led_t *led);
 
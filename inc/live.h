@@ -0,0 +1,66 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include "acr.h"
+#include <stdint.h>
+
+#define LIVE_SHM_NAME "/acr_live"
+#define LIVE_MAGIC (0x4C524341) // "ACRL"
+#define LIVE_VERSION (2)
+// Must be a power of two
+#define LIVE_CONE_RING 4096
+
+typedef struct live_state_t {
+  uint64_t fix_count;
+  uint64_t timestamp;
+  double lat;
+  double lon;
+  double alt;
+  double h_acc;
+
+  int32_t trajectory_active;
+  int32_t cone_session_active;
+  char trajectory_name[64];
+  char cone_session_name[64];
+} live_state_t;
+
+// Layout of the shared memory segment
+typedef struct live_shm_t {
+  uint32_t magic;
+  uint32_t version;
+  // Incremented by every start of main, the counters below restart from 0
+  uint32_t generation;
+
+  // Seqlock over state, odd while the writer is updating it
+  uint32_t seq;
+  live_state_t state;
+
+  // Number of cones ever published, cone i is at cones[i % LIVE_CONE_RING]
+  uint64_t cone_head;
+  cone_t cones[LIVE_CONE_RING];
+} live_shm_t;
+
+typedef struct live_t {
+  int writer;
+  live_shm_t *shm;
+} live_t;
+
+// Writer side, used by main
+int live_create(live_t *live);
+void live_publish(live_t *live, const gps_parsed_data_t *gps_data,
+                  const full_session_t *session,
+                  const cone_session_t *cone_session);
+void live_publish_cone(live_t *live, const cone_t *cone);
+
+// Reader side, the segment is mapped read-only
+int live_attach(live_t *live);
+// Consistent snapshot of the state, returns -1 if nothing was published yet
+int live_read_state(const live_t *live, live_state_t *state);
+uint32_t live_generation(const live_t *live);
+uint64_t live_cone_count(const live_t *live);
+// Returns -1 if the cone has been overwritten by the writer
+int live_read_cone(const live_t *live, uint64_t index, cone_t *cone);
+
+void live_close(live_t *live);
+
+#endif // LIVE_H
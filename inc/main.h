@@ -2,13 +2,40 @@
 #define MAIN_H
 
 #include "acr.h"
+#include "geofence.h"
+#include "gpio_input.h"
+#include "track.h"
 #include <stdio.h>
 
-void error_state(acr_error_t error);
+int session_begin(user_data_t *data);
+void session_end(user_data_t *data);
+int cone_session_begin(user_data_t *data);
+void fault_service(user_data_t *data, uint64_t t);
+void receiver_fault(int source, acr_error_t error, void *user);
+// Sets the timestamp of a NAV-HPPOSLLH to its least delayed epoch arrival
+void fix_timestamp(int source, gps_parsed_data_t *fix, uint64_t arrival_t);
+// Position for the cones from the configured receiver, or combined from
+// all of them. Returns 0 if this fix does not change it.
+int cone_source_fix(int source, const gps_parsed_data_t *fix, double *lat,
+                    double *lon, double *alt);
+// Processing of a NAV-HPPOSLLH, returns the dispatch actions left. One
+// variant for each cone filter and logging mode, chosen at startup.
+typedef int (*fix_pipeline_t)(user_data_t *data, int source,
+                              gps_parsed_data_t *fix, int actions, uint64_t t,
+                              geofence_event_t *fence);
+// Saves the requested cone when its filter is done, called for every message
+typedef void (*cone_pipeline_t)(user_data_t *data);
+void track_warn_gaps(track_t *track, int i);
+void dispatch_report_session(full_session_t *session);
+void resume_sessions(user_data_t *data);
+void resume_update(user_data_t *data);
 
 void *led_runner();
 void sig_handler(int signum);
-void pin_setup(user_data_t *user_data);
-void pin_interrupt(int gpio, int level, uint32_t tick, void *user_data);
+// Ends the sessions and prints the reports, after the main loop stopped
+void shutdown_clean(user_data_t *data);
+void pin_setup();
+// Debounced button transition, from the main loop
+void button_event(const gpio_event_t *event, void *user_data);
 
 #endif // MAIN_H
@@ -0,0 +1,40 @@
+#ifndef MAP_FORMAT_H
+#define MAP_FORMAT_H
+
+#include <stdint.h>
+
+// Binary cone map written by acr_export_map: a header followed by count
+// cones, little endian
+#define MAP_MAGIC "ACRM"
+#define MAP_VERSION 1
+
+typedef enum map_side_t {
+  MAP_SIDE_UNKNOWN = 0,
+  // In the driving direction
+  MAP_SIDE_LEFT = 1,
+  MAP_SIDE_RIGHT = 2,
+} map_side_t;
+
+typedef struct __attribute__((packed)) map_header_t {
+  char magic[4];
+  uint16_t version;
+  uint16_t count;
+  // Origin of the local frame, x east, y north, z up in metres
+  double lat0;
+  double lon0;
+  double alt0;
+} map_header_t;
+
+typedef struct __attribute__((packed)) map_cone_t {
+  float x;
+  float y;
+  float z;
+  // cone_id
+  uint8_t id;
+  // map_side_t
+  uint8_t side;
+  // Registrations merged in this cone
+  uint16_t observations;
+} map_cone_t;
+
+#endif // MAP_FORMAT_H
@@ -0,0 +1,81 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include "storage.h"
+#include <stdint.h>
+
+typedef enum motion_mode_t {
+  // Every fix is logged
+  MOTION_LOSSLESS = 0,
+  // Fixes taken while stationary are collapsed in summary records
+  MOTION_ADAPTIVE = 1,
+  MOTION_MODE_SIZE,
+} motion_mode_t;
+
+typedef struct motion_config_t {
+  motion_mode_t mode;
+  double stationary_speed_ms;
+  // Stationary only while within this distance of where it stopped
+  double deadband_m;
+  double stationary_after_s;
+  double summary_period_s;
+} motion_config_t;
+
+// Running mean and spread (Welford) of the fixes of one summary, in local
+// east, north, up metres
+typedef struct motion_summary_t {
+  uint64_t count;
+  uint64_t start_t;
+  uint64_t end_t;
+  double mean[3];
+  double m2[3];
+  double h_acc_sum;
+} motion_summary_t;
+
+typedef struct motion_t {
+  motion_config_t config;
+
+  // Projection origin, first fix of the session
+  int has_origin;
+  double lat0;
+  double lon0;
+
+  int has_prev;
+  double prev_x;
+  double prev_y;
+  uint64_t prev_t;
+  // Low-pass filtered velocity, single fixes are too noisy
+  double vx;
+  double vy;
+
+  double anchor_x;
+  double anchor_y;
+  uint64_t still_since_t;
+  int stationary;
+  motion_summary_t summary;
+
+  uint64_t logged;
+  uint64_t summarised;
+  uint64_t summaries;
+
+  int file_open;
+  storage_t file;
+} motion_t;
+
+void motion_config_default(motion_config_t *config);
+// [logging] section of acr.conf
+int motion_config_handler(void *user, const char *section, const char *key,
+                          const char *value);
+
+// Keeps the configuration across sessions
+void motion_init(motion_t *motion, const motion_config_t *config);
+// Opens gps_path/stationary.csv when adaptive
+int motion_open(motion_t *motion, const char *gps_path);
+// Writes the pending summary and closes the file
+int motion_close(motion_t *motion);
+
+// Returns 1 if the fix must be logged, 0 if it went in a summary
+int motion_update(motion_t *motion, double lat, double lon, double height,
+                  double h_acc, uint64_t t);
+
+#endif // MOTION_H
@@ -0,0 +1,98 @@
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include "acr.h"
+#include "gpslib/gps_interface.h"
+#include "rt.h"
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#define RECEIVER_MAX ACR_MAX_SOURCES
+// Messages waiting to be merged, for each receiver
+#define RECEIVER_QUEUE_SIZE 256
+// Other descriptors waited on by the merge
+#define RECEIVER_MAX_WATCH 4
+// Cone position from all the receivers
+#define RECEIVER_COMBINE (-1)
+
+typedef struct receiver_config_t {
+  char name[32];
+  char port[256];
+} receiver_config_t;
+
+typedef struct receivers_config_t {
+  int count;
+  receiver_config_t receivers[RECEIVER_MAX];
+  // Receiver index or RECEIVER_COMBINE
+  int cone_source;
+  char cone_source_name[32];
+} receivers_config_t;
+
+typedef struct receiver_message_t {
+  int source;
+  // Taken by the reader thread when the message is complete
+  uint64_t t;
+  gps_protocol_type protocol;
+  int start_size;
+  int line_size;
+  unsigned char start_sequence[GPS_MAX_START_SEQUENCE_SIZE];
+  char line[GPS_MAX_LINE_SIZE];
+} receiver_message_t;
+
+// Called from the reader threads when a receiver fails
+typedef void (*receiver_fault_t)(int source, acr_error_t error, void *user);
+
+typedef struct receiver_t {
+  int index;
+  receiver_config_t config;
+  gps_serial_port port;
+  int open;
+  pthread_t thread;
+  struct receivers_t *receivers;
+
+  // Single producer (reader thread), single consumer (merge)
+  receiver_message_t *queue;
+  uint32_t head;
+  uint32_t tail;
+
+  uint64_t received;
+  uint64_t dropped;
+  uint64_t reopened;
+} receiver_t;
+
+typedef struct receivers_t {
+  int count;
+  receiver_t receivers[RECEIVER_MAX];
+  // Readers signal new messages on it
+  int event_fd;
+  int stop;
+  const rt_thread_config_t *rt;
+  receiver_fault_t on_fault;
+  void *user;
+} receivers_t;
+
+void receivers_config_default(receivers_config_t *config);
+// [receiver.<n>] port, name and [cones] source sections of acr.conf
+int receivers_config_handler(void *user, const char *section, const char *key,
+                             const char *value);
+// Resolves the cone source name, returns -1 if it is unknown
+int receivers_config_resolve(receivers_config_t *config);
+
+// Opens the ports and starts a reader thread for each receiver. Receivers
+// that cannot be opened are retried by their thread.
+int receivers_start(receivers_t *receivers, const receivers_config_t *config,
+                    const rt_thread_config_t *rt, receiver_fault_t on_fault,
+                    void *user);
+
+// Next message in timestamp order over all the receivers. A message is
+// held until every open receiver has a later one, or RECEIVER_MERGE_US
+// passed. Returns 0 on timeout, or as soon as one of the watch descriptors
+// (other work of the loop) is ready.
+int receivers_next(receivers_t *receivers, receiver_message_t *message,
+                   int timeout_ms, struct pollfd *watch, int watch_count);
+
+int receivers_all_open(const receivers_t *receivers);
+void receivers_report(const receivers_t *receivers, FILE *file);
+
+#endif // RECEIVER_H
@@ -0,0 +1,18 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+// Sessions running when the process stopped, so that a restart after a
+// crash continues them instead of opening new ones
+typedef struct resume_state_t {
+  // Empty when no session is running
+  char trajectory[256];
+  int trajectory_part;
+  char cones[256];
+} resume_state_t;
+
+// Returns -1 if there is nothing to resume. States written before the last
+// boot are ignored, a power cycle always starts new sessions.
+int resume_load(resume_state_t *state, const char *path);
+int resume_save(const resume_state_t *state, const char *path);
+
+#endif // RESUME_H
@@ -0,0 +1,61 @@
+#ifndef RT_H
+#define RT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define RT_JITTER_BUCKETS 16
+
+typedef struct rt_thread_config_t {
+  // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+  int policy;
+  int priority;
+  // CPU the thread is pinned to, -1 for any
+  int cpu;
+} rt_thread_config_t;
+
+typedef struct rt_config_t {
+  int enabled;
+  int lock_memory;
+  int prefault_stack_kb;
+  int prefault_heap_kb;
+
+  rt_thread_config_t main;
+  rt_thread_config_t led;
+  rt_thread_config_t pigpio;
+} rt_config_t;
+
+// Deviation of the periods of a loop from the expected one
+typedef struct rt_jitter_t {
+  const char *name;
+  uint64_t expected_us;
+  uint64_t last_t;
+  uint64_t count;
+  int64_t min_us;
+  int64_t max_us;
+  double mean_us;
+  double m2;
+  // Absolute deviation, bucket i counts [2^i, 2^(i+1)) us
+  uint64_t histogram[RT_JITTER_BUCKETS];
+} rt_jitter_t;
+
+void rt_config_default(rt_config_t *config);
+// Handles the [rt], [rt.main], [rt.led] and [rt.pigpio] sections
+int rt_config_handler(void *user, const char *section, const char *key,
+                      const char *value);
+
+// Applies the memory settings, to be called before the threads start
+int rt_setup_memory(const rt_config_t *config);
+// Applies the scheduling settings to the calling thread
+int rt_setup_thread(const rt_thread_config_t *thread, const char *name);
+// Applies the scheduling settings to every thread of the process except the
+// calling one (e.g. the threads started by pigpio)
+int rt_setup_other_threads(const rt_thread_config_t *thread,
+                           const char *name);
+
+void rt_jitter_init(rt_jitter_t *jitter, const char *name,
+                    uint64_t expected_us);
+void rt_jitter_sample(rt_jitter_t *jitter, uint64_t t);
+void rt_jitter_report(const rt_jitter_t *jitter, FILE *file);
+
+#endif // RT_H
@@ -0,0 +1,81 @@
+#ifndef RTCM_H
+#define RTCM_H
+
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Preamble, reserved bits and length, payload up to 1023 bytes, CRC24Q
+#define RTCM_MAX_FRAME (3 + 1023 + 3)
+#define RTCM_BUFFER_SIZE (4 * RTCM_MAX_FRAME)
+
+typedef enum rtcm_source_type_t {
+  // Regular file or FIFO
+  RTCM_SOURCE_FILE,
+  RTCM_SOURCE_TCP,
+  RTCM_SOURCE_UDP,
+} rtcm_source_type_t;
+
+typedef struct rtcm_config_t {
+  int enabled;
+  // Path, tcp://host:port or udp://host:port
+  char source[256];
+  // Receiver name, the first one when empty
+  char receiver[32];
+} rtcm_config_t;
+
+typedef struct rtcm_t {
+  rtcm_config_t config;
+  rtcm_source_type_t type;
+  char host[128];
+  int port;
+  char tty[256];
+
+  int in_fd;
+  int out_fd;
+  int connecting;
+  // A regular file is forwarded once
+  int finished;
+  uint64_t retry_t;
+  uint64_t backoff_us;
+
+  unsigned char in[RTCM_BUFFER_SIZE];
+  int in_size;
+  unsigned char out[2 * RTCM_BUFFER_SIZE];
+  int out_size;
+  // Last reference station frame (1005/1006), sent again on reconnect
+  unsigned char station[RTCM_MAX_FRAME];
+  int station_size;
+
+  uint64_t start_t;
+  uint64_t last_frame_t;
+  uint64_t max_age_us;
+  uint64_t report_t;
+  uint64_t window_frames;
+  uint64_t window_bytes;
+
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t crc_errors;
+  // Frames that did not fit in the output buffer, the port is not waited
+  uint64_t dropped;
+  uint64_t reconnects;
+} rtcm_t;
+
+void rtcm_config_default(rtcm_config_t *config);
+// Handles the [rtcm] section
+int rtcm_config_handler(void *user, const char *section, const char *key,
+                        const char *value);
+
+// Sources and port that cannot be opened are retried by rtcm_service
+int rtcm_open(rtcm_t *rtcm, const rtcm_config_t *config, const char *tty);
+// Descriptors to wait on, returns their number (at most 2)
+int rtcm_pollfds(const rtcm_t *rtcm, struct pollfd *pfds);
+// Reads what is available and forwards the complete frames, never blocks
+void rtcm_service(rtcm_t *rtcm, uint64_t t);
+// Time since the last frame, 0 if none was received
+uint64_t rtcm_age_us(const rtcm_t *rtcm, uint64_t t);
+void rtcm_report(const rtcm_t *rtcm, FILE *file);
+void rtcm_close(rtcm_t *rtcm);
+
+#endif // RTCM_H
@@ -0,0 +1,37 @@
+#ifndef SEGLOG_H
+#define SEGLOG_H
+
+#include <stddef.h>
+
+// Blocks are allocated on demand and never move or get freed while in use
+#define SEGLOG_MAX_BLOCKS 1024
+
+// Append-only log of fixed size items. A single writer appends without
+// locks; any number of readers take the published length and read the
+// items below it wait-free, while the writer keeps appending.
+typedef struct seglog_t {
+  size_t item_size;
+  size_t block_items;
+  void *blocks[SEGLOG_MAX_BLOCKS];
+  // Items visible to the readers, published after the item is written
+  size_t length;
+} seglog_t;
+
+int seglog_init(seglog_t *log, size_t item_size, size_t block_items);
+// No reader may be left
+void seglog_free(seglog_t *log);
+
+// Writer side. Returns -1 when the log is full or out of memory.
+int seglog_append(seglog_t *log, const void *item);
+
+// Reader side
+size_t seglog_length(const seglog_t *log);
+// Item i of a length returned by seglog_length
+void *seglog_get(const seglog_t *log, size_t i);
+// Contiguous items of block b within length, returns the first one
+void *seglog_block(const seglog_t *log, size_t b, size_t length,
+                   size_t *count);
+// Number of blocks holding length items
+size_t seglog_block_count(const seglog_t *log, size_t length);
+
+#endif // SEGLOG_H
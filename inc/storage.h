@@ -0,0 +1,87 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifndef ACR_NO_URING
+#include <liburing.h>
+#endif // ACR_NO_URING
+
+// Memory of each file is bounded to STORAGE_BLOCKS * STORAGE_BLOCK_SIZE, the
+// blocks are allocated when first needed
+#define STORAGE_BLOCK_SIZE (64 * 1024)
+#define STORAGE_BLOCKS 8
+#define STORAGE_ALIGNMENT 4096
+
+typedef enum storage_durability_t {
+  // Blocks are written only when full
+  STORAGE_BUFFERED,
+  // storage_flush writes the partial block
+  STORAGE_FLUSH,
+  // storage_flush also waits for the data to be on the card (fdatasync)
+  STORAGE_SYNC,
+} storage_durability_t;
+
+typedef struct storage_stats_t {
+  uint64_t bytes;
+  uint64_t writes;
+  // Times the producer had to wait for a free block, and for how long
+  uint64_t waits;
+  uint64_t wait_us;
+  uint64_t max_inflight;
+  uint64_t errors;
+} storage_stats_t;
+
+typedef struct storage_block_t {
+  unsigned char *data;
+  size_t size;
+  off_t offset;
+  int inflight;
+} storage_block_t;
+
+typedef struct storage_t {
+  int fd;
+  storage_durability_t durability;
+  storage_block_t blocks[STORAGE_BLOCKS];
+  // Block being filled and its offset in the file
+  int current;
+  off_t offset;
+  int inflight;
+  storage_stats_t stats;
+
+  // io_uring when it can be set up, the writer thread otherwise
+  int uring;
+#ifndef ACR_NO_URING
+  struct io_uring ring;
+#endif // ACR_NO_URING
+  // Writer thread, blocks are written in submission order
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int queue[STORAGE_BLOCKS];
+  int queue_head;
+  int queue_size;
+  int stop;
+} storage_t;
+
+const char *storage_durability_to_string(storage_durability_t durability);
+
+// Appends to the file if it exists
+int storage_open(storage_t *storage, const char *path,
+                 storage_durability_t durability);
+// Same on an open file, the storage owns fd even when it fails
+int storage_open_fd(storage_t *storage, int fd,
+                    storage_durability_t durability);
+int storage_write(storage_t *storage, const void *data, size_t size);
+int storage_printf(storage_t *storage, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+int storage_flush(storage_t *storage);
+// Flushes, waits for every pending write and closes the file
+int storage_close(storage_t *storage);
+
+void storage_report(const storage_t *storage, const char *name, FILE *file);
+
+#endif // STORAGE_H
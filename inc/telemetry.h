@@ -0,0 +1,131 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "acr.h"
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TELEMETRY_MAGIC (0xAC52)
+#define TELEMETRY_VERSION (2)
+#define TELEMETRY_MAX_SUBSCRIBERS 8
+// Subscribers have to renew the subscription within this time
+#define TELEMETRY_SUBSCRIBER_TIMEOUT_US (10000000)
+
+typedef enum telemetry_type_t {
+  TELEMETRY_POSITION = 1,
+  TELEMETRY_CONE = 2,
+  TELEMETRY_SUBSCRIBE = 3,
+} telemetry_type_t;
+
+// Datagrams are little endian and packed
+typedef struct __attribute__((packed)) telemetry_header_t {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t type;
+  // Per receiver, a gap means lost datagrams
+  uint32_t seq;
+  uint64_t timestamp;
+} telemetry_header_t;
+
+typedef struct __attribute__((packed)) telemetry_position_t {
+  telemetry_header_t header;
+  double lat;
+  double lon;
+  double alt;
+  float h_acc;
+  uint8_t trajectory_active;
+  uint8_t cone_session_active;
+  // Zero padded, empty when the session is not active
+  char trajectory_name[64];
+  char cone_session_name[64];
+} telemetry_position_t;
+
+typedef struct __attribute__((packed)) telemetry_cone_t {
+  telemetry_header_t header;
+  uint8_t id;
+  double lat;
+  double lon;
+  double alt;
+} telemetry_cone_t;
+
+typedef struct __attribute__((packed)) telemetry_subscribe_t {
+  telemetry_header_t header;
+  // Requested position rate, 0 for every fix
+  float rate_hz;
+} telemetry_subscribe_t;
+
+typedef struct telemetry_config_t {
+  int enabled;
+  // Port where subscriptions are received
+  int port;
+  // Optional fixed destination, unicast or multicast
+  char destination[64];
+  int destination_port;
+  double destination_rate_hz;
+  int multicast_ttl;
+} telemetry_config_t;
+
+typedef struct telemetry_subscriber_t {
+  int active;
+  // The fixed destination never expires
+  int permanent;
+  struct sockaddr_in addr;
+  uint32_t interval_us;
+  uint32_t seq;
+  uint64_t last_sent_t;
+  uint64_t last_seen_t;
+} telemetry_subscriber_t;
+
+typedef struct telemetry_t {
+  int fd;
+  telemetry_subscriber_t subscribers[TELEMETRY_MAX_SUBSCRIBERS];
+
+  uint64_t sent;
+  uint64_t decimated;
+  // The socket buffer was full, the datagram was dropped instead of waiting
+  uint64_t dropped;
+} telemetry_t;
+
+typedef struct telemetry_client_t {
+  int fd;
+  // Server to subscribe to, or the multicast group joined
+  struct sockaddr_in server;
+  int multicast;
+  float rate_hz;
+  uint64_t last_subscribe_t;
+
+  int has_seq;
+  uint32_t next_seq;
+  uint64_t received;
+  uint64_t lost;
+} telemetry_client_t;
+
+void telemetry_config_default(telemetry_config_t *config);
+// Handles the [telemetry] section
+int telemetry_config_handler(void *user, const char *section, const char *key,
+                             const char *value);
+
+// Server side, every call is non-blocking
+int telemetry_open(telemetry_t *telemetry, const telemetry_config_t *config);
+void telemetry_poll(telemetry_t *telemetry, uint64_t t);
+void telemetry_send_position(telemetry_t *telemetry,
+                             const gps_parsed_data_t *gps_data,
+                             const full_session_t *session,
+                             const cone_session_t *cone_session, uint64_t t);
+void telemetry_send_cone(telemetry_t *telemetry, const cone_t *cone);
+void telemetry_report(const telemetry_t *telemetry, FILE *file);
+void telemetry_close(telemetry_t *telemetry);
+
+// Client side
+// A multicast host is joined on port, any other is subscribed to
+int telemetry_client_open(telemetry_client_t *client, const char *host,
+                          int port, float rate_hz);
+// Waits up to timeout_ms for a datagram, renews the subscription when due.
+// Returns the size of the datagram, 0 on timeout, -1 on error.
+int telemetry_client_receive(telemetry_client_t *client, void *buffer,
+                             int size, int timeout_ms);
+void telemetry_client_close(telemetry_client_t *client);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,60 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include "acr.h"
+
+#ifndef TRACK_MAX_CONES
+#define TRACK_MAX_CONES 2048
+#endif // TRACK_MAX_CONES
+#define TRACK_GRID_BUCKETS 1024
+#define TRACK_CELL_M (5.0)
+// Reach of the partner and nearest cone searches
+#define TRACK_SEARCH_CELLS 2
+
+typedef struct track_cone_t {
+  cone_t cone;
+  // Local coordinates (m)
+  double x;
+  double y;
+
+  // Neighbours along the boundary of the same colour, -1 if none
+  int prev;
+  int next;
+  // Nearest cone on the opposite boundary, -1 if none
+  int partner;
+
+  int bucket_next;
+} track_cone_t;
+
+typedef struct track_t {
+  int has_origin;
+  double lat0;
+  double lon0;
+
+  // Incremented on every insertion, used by readers to rebuild their layers
+  uint32_t revision;
+  int count;
+  track_cone_t cones[TRACK_MAX_CONES];
+  int buckets[TRACK_GRID_BUCKETS];
+} track_t;
+
+void track_init(track_t *track);
+
+// Returns the index of the new cone or -1 if the track is full
+int track_insert(track_t *track, const cone_t *cone);
+
+// Nearest cone of the given colour to a point in local coordinates, -1 if
+// none within max_distance (at most TRACK_SEARCH_CELLS cells away)
+int track_find_nearest(const track_t *track, double x, double y, cone_id id,
+                       double max_distance);
+
+// Number of cones likely missing between cone i and the next one
+int track_edge_missing(const track_t *track, int i);
+// Position of the k-th missing cone between cone i and the next one
+void track_missing_position(const track_t *track, int i, int k, double *lat,
+                            double *lon);
+
+// Midpoint between cone i and its partner, returns -1 if it has none
+int track_center(const track_t *track, int i, double *lat, double *lon);
+
+#endif // TRACK_H
@@ -0,0 +1,48 @@
+#ifndef UBX_CFG_H
+#define UBX_CFG_H
+
+#include <stdint.h>
+#include <termios.h>
+
+#define UBX_CFG_MAX_MSGS 32
+
+typedef struct ubx_cfg_msg_t {
+  uint8_t msg_class;
+  uint8_t msg_id;
+  // Output rate relative to the navigation rate, 0 disables the message
+  uint8_t rate;
+} ubx_cfg_msg_t;
+
+typedef struct ubx_cfg_t {
+  uint16_t meas_rate_ms;
+  uint16_t nav_rate;
+  int msg_count;
+  ubx_cfg_msg_t msgs[UBX_CFG_MAX_MSGS];
+} ubx_cfg_t;
+
+void ubx_checksum(const unsigned char *data, int size, unsigned char *ck_a,
+                  unsigned char *ck_b);
+// Writes a complete frame (sync, header, payload, checksum) and returns its size
+int ubx_frame_build(unsigned char *out, uint8_t msg_class, uint8_t msg_id,
+                    const unsigned char *payload, uint16_t size);
+// NAV-HPPOSLLH with a fixed 14 mm accuracy, height also used as hMSL
+int ubx_hpposllh_build(unsigned char *out, uint32_t itow, double lat,
+                       double lon, double height);
+// NAV-PVT with only the time of week set
+int ubx_pvt_build(unsigned char *out, uint32_t itow);
+// Finds the first valid frame in data. Returns 0 if there is none, offset is
+// then the first byte worth keeping for the next read. Headers announcing a
+// frame larger than the buffer capacity are skipped as false syncs.
+int ubx_frame_find(const unsigned char *data, int size, int capacity,
+                   int *offset, int *length);
+
+// Only what ACR consumes: NAV-HPPOSLLH, NMEA disabled
+void ubx_cfg_default(ubx_cfg_t *cfg);
+uint32_t ubx_cfg_hash(const ubx_cfg_t *cfg, const char *port);
+
+// Sends the configuration and waits for every ACK. Skipped if the cache file
+// says the same configuration was already applied to this port.
+int ubx_cfg_apply(const ubx_cfg_t *cfg, const char *port, speed_t baud,
+                  const char *cache_path);
+
+#endif // UBX_CFG_H
@@ -5,4 +5,11 @@
 
 uint64_t get_t();
 
-#endif // UTILS_H
\ No newline at end of file
+// Equirectangular projection around (lat0, lon0), x east and y north in m
+void latlon_to_local(double lat0, double lon0, double lat, double lon,
+                     double *x, double *y);
+// Inverse of latlon_to_local
+void local_to_latlon(double lat0, double lon0, double x, double y,
+                     double *lat, double *lon);
+
+#endif // UTILS_H
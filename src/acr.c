@@ -1,9 +1,12 @@
+#define _GNU_SOURCE
 #include "acr.h"
 
 #include <dirent.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 const char *error_to_string(acr_error_t error) {
   switch (error) {
@@ -28,6 +31,9 @@ const char *error_to_string(acr_error_t error) {
     case ERROR_FULL_SESSION_START:
       return "ERROR_FULL_SESSION_START";
       break;
+    case ERROR_STORAGE_WRITE:
+      return "ERROR_STORAGE_WRITE";
+      break;
     default:
       return "ERROR_UNKNOWN";
       break;
@@ -35,11 +41,14 @@ const char *error_to_string(acr_error_t error) {
 }
 
 int dir_exist_or_create(char *path) {
-  if (opendir(path) == NULL) {
-    if (mkdir(path, 0777) == -1) {
-      fprintf(stderr, "Could not create directory %s\n", path);
-      return -1;
-    }
+  DIR *dir = opendir(path);
+  if (dir != NULL) {
+    closedir(dir);
+    return 0;
+  }
+  if (mkdir(path, 0777) == -1) {
+    fprintf(stderr, "Could not create directory %s\n", path);
+    return -1;
   }
   return 0;
 }
@@ -91,22 +100,71 @@ int cone_session_start(cone_session_t *session) {
 
   char cones_path[2048];
   snprintf(cones_path, 2048, "%s/cones.csv", session->session_path);
-  session->file = fopen(cones_path, "w");
-  if (session->file == NULL) {
-    perror("Could not open cones file");
+  // Few and precious, every cone is written as soon as it is taken
+  if (storage_open(&session->storage, cones_path, STORAGE_FLUSH) == -1) {
     return -1;
   }
 
-  fprintf(session->file, "timestamp,cone_id,cone_name,lat,lon,alt\n");
+  // A resumed session already has its header
+  if (session->storage.offset == 0) {
+    storage_printf(&session->storage,
+                   "timestamp,cone_id,cone_name,lat,lon,alt,itow\n");
+    storage_flush(&session->storage);
+  }
   session->active = 1;
 
   return 0;
 }
 
+int cone_session_resume(cone_session_t *session, const char *basepath,
+                        const char *name) {
+  snprintf(session->session_name, 1024, "%s", name);
+  snprintf(session->session_path, 1024, "%s/logs/acr/%s", basepath, name);
+  DIR *dir = opendir(session->session_path);
+  if (dir == NULL) {
+    fprintf(stderr, "Could not resume %s\n", session->session_path);
+    return -1;
+  }
+  closedir(dir);
+  return cone_session_start(session);
+}
+
+int cone_session_read(cone_session_t *session,
+                      void (*callback)(cone_t *cone, void *user),
+                      void *user) {
+  char cones_path[2048];
+  snprintf(cones_path, 2048, "%s/cones.csv", session->session_path);
+  FILE *file = fopen(cones_path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  int count = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    cone_t cone;
+    int id;
+    // itow is missing in the files of older versions
+    cone.itow = 0;
+    if (sscanf(line, "%" SCNu64 ",%d,%*[^,],%lf,%lf,%lf,%" SCNu32,
+               &cone.timestamp, &id, &cone.lat, &cone.lon, &cone.alt,
+               &cone.itow) < 5 ||
+        id < 0 || id >= CONE_ID_SIZE) {
+      continue;
+    }
+    cone.id = (cone_id)id;
+    callback(&cone, user);
+    count++;
+  }
+  fclose(file);
+  return count;
+}
+
 int cone_session_stop(cone_session_t *session) {
-  fclose(session->file);
+  int res = storage_close(&session->storage);
+  storage_report(&session->storage, "cones.csv", stdout);
   session->active = 0;
-  return 0;
+  return res;
 }
 
 int csv_session_setup(full_session_t *session, const char *basepath) {
@@ -118,41 +176,225 @@ int csv_session_setup(full_session_t *session, const char *basepath) {
   }
 
   int session_count = dir_next_number(session->session_path, "trajectory_");
+  session->part = 0;
 
   snprintf(session->session_name, 1024, "trajectory_%03d", session_count + 1);
   strcat(session->session_path, session->session_name);
 
   return 0;
 }
+_Static_assert(sizeof(gps_files_t) % sizeof(FILE *) == 0,
+               "gps_files_t is expected to hold only FILE pointers");
+
+static ssize_t gps_csv_write(void *cookie, const char *data, size_t size) {
+  // Failures are counted by the storage, see csv_session_errors
+  storage_write((storage_t *)cookie, data, size);
+  return size;
+}
+
+static int gps_csv_close(void *cookie) {
+  return storage_close((storage_t *)cookie);
+}
+
+// gpslib writes its csv with stdio, each stream is replaced by one writing
+// into a storage, so the rows go to the card in large blocks like raw.log.
+// Called before anything is written to the files.
+static int gps_files_storage(session_source_t *source) {
+  static const cookie_io_functions_t functions = {
+      .write = gps_csv_write,
+      .close = gps_csv_close,
+  };
+  FILE **files = (FILE **)&source->files;
+  for (size_t i = 0; i < ACR_GPS_FILES; i++) {
+    storage_t *storage = &source->csv[i];
+    memset(storage, 0, sizeof(storage_t));
+    storage->fd = -1;
+    if (files[i] == NULL) {
+      continue;
+    }
+    int fd = dup(fileno(files[i]));
+    if (fd == -1) {
+      perror("Could not open the csv storage");
+      return -1;
+    }
+    if (storage_open_fd(storage, fd, STORAGE_BUFFERED) == -1) {
+      return -1;
+    }
+    FILE *stream = fopencookie(storage, "w", functions);
+    if (stream == NULL) {
+      perror("Could not open the csv stream");
+      storage_close(storage);
+      return -1;
+    }
+    fclose(files[i]);
+    files[i] = stream;
+  }
+  return 0;
+}
+
+static void gps_files_close(session_source_t *source) {
+  // Also closes the storages through the streams
+  gps_close_files(&source->files);
+}
+
+// Closes the outputs of the first count sources
+static int csv_session_close_sources(full_session_t *session, int count,
+                                     int report) {
+  int res = 0;
+  for (int i = 0; i < count; i++) {
+    session_source_t *source = &session->sources[i];
+    gps_files_close(source);
+    if (storage_close(&source->raw) == -1) {
+      res = -1;
+    }
+    if (report) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s raw.log",
+               source->name[0] != '\0' ? source->name : "gps");
+      storage_report(&source->raw, name, stdout);
+    }
+  }
+  return res;
+}
+
+static int csv_session_source_count(const full_session_t *session) {
+  return session->source_count > 0 ? session->source_count : 1;
+}
+
 int csv_session_start(full_session_t *session) {
   if (dir_exist_or_create(session->session_path) == -1) {
     return -1;
   }
 
+  // gpslib truncates its files, each restart of a session gets its own part
+  char gps_dir[16];
+  if (session->part == 0) {
+    snprintf(gps_dir, sizeof(gps_dir), "gps");
+  } else {
+    snprintf(gps_dir, sizeof(gps_dir), "gps_%d", session->part);
+  }
   char gps_path[2048];
-  snprintf(gps_path, 2048, "%s/gps", session->session_path);
+  snprintf(gps_path, 2048, "%s/%s", session->session_path, gps_dir);
   if (dir_exist_or_create(gps_path) == -1) {
     return -1;
   }
 
-  gps_open_files(&session->files, gps_path);
-  gps_header_to_file(&session->files);
+  // With more receivers each one has a subfolder named after it
+  int count = csv_session_source_count(session);
+  char primary_path[2560];
+  for (int i = 0; i < count; i++) {
+    session_source_t *source = &session->sources[i];
+    char source_path[2560];
+    if (count == 1) {
+      snprintf(source_path, 2560, "%s", gps_path);
+    } else {
+      snprintf(source_path, 2560, "%s/%s", gps_path, source->name);
+      if (dir_exist_or_create(source_path) == -1) {
+        csv_session_close_sources(session, i, 0);
+        return -1;
+      }
+    }
+    if (i == 0) {
+      snprintf(primary_path, 2560, "%s", source_path);
+    }
+
+    gps_open_files(&source->files, source_path);
+    if (gps_files_storage(source) == -1) {
+      gps_files_close(source);
+      csv_session_close_sources(session, i, 0);
+      return -1;
+    }
+    gps_header_to_file(&source->files);
+
+    char raw_path[3072];
+    snprintf(raw_path, 3072, "%s/raw.log", source_path);
+    if (storage_open(&source->raw, raw_path, STORAGE_BUFFERED) == -1) {
+      gps_files_close(source);
+      csv_session_close_sources(session, i, 0);
+      return -1;
+    }
+  }
+
+  // Laps and adaptive logging follow the first receiver
+  if (lap_index_open(&session->laps, session->session_path, gps_dir) == -1) {
+    csv_session_close_sources(session, count, 0);
+    return -1;
+  }
+
+  if (motion_open(&session->motion, primary_path) == -1) {
+    csv_session_close_sources(session, count, 0);
+    lap_index_close(&session->laps);
+    return -1;
+  }
 
   session->active = 1;
 
   return 0;
 }
+
+int csv_session_resume(full_session_t *session, const char *basepath,
+                       const char *name, int part) {
+  snprintf(session->session_name, 1024, "%s", name);
+  snprintf(session->session_path, 1024, "%s/logs/acr/%s", basepath, name);
+  DIR *dir = opendir(session->session_path);
+  if (dir == NULL) {
+    fprintf(stderr, "Could not resume %s\n", session->session_path);
+    return -1;
+  }
+  closedir(dir);
+  session->part = part;
+  return csv_session_start(session);
+}
 int csv_session_stop(full_session_t *session) {
-  gps_close_files(&session->files);
+  int res =
+      csv_session_close_sources(session, csv_session_source_count(session), 1);
+  lap_index_close(&session->laps);
+  if (motion_close(&session->motion) == -1) {
+    res = -1;
+  }
   session->active = 0;
-  return 0;
+  return res;
+}
+
+int csv_session_errors(const full_session_t *session) {
+  int errors = 0;
+  for (int i = 0; i < csv_session_source_count(session); i++) {
+    const session_source_t *source = &session->sources[i];
+    errors += source->raw.stats.errors > 0;
+    // The gpslib csv, written by default while raw.log stays empty
+    for (size_t j = 0; j < ACR_GPS_FILES; j++) {
+      errors += source->csv[j].stats.errors > 0;
+    }
+  }
+  if (session->motion.file_open) {
+    errors += session->motion.file.stats.errors > 0;
+  }
+  if (session->laps.index != NULL) {
+    errors += ferror(session->laps.index) != 0;
+  }
+  return errors;
+}
+
+void csv_session_write_raw(full_session_t *session, int source,
+                           const unsigned char *start_sequence, int start_size,
+                           const char *line, int line_size) {
+  storage_t *raw = &session->sources[source].raw;
+  storage_write(raw, start_sequence, start_size);
+  storage_write(raw, line, line_size);
 }
 
 void cone_session_write(cone_session_t *session, cone_t *cone) {
-  fprintf(session->file, "%" PRIu64 ",%d,%s,%f,%f,%f\n", cone->timestamp,
+  storage_printf(&session->storage,
+                 "%" PRIu64 ",%d,%s,%f,%f,%f,%" PRIu32 "\n", cone->timestamp,
+                 cone->id, cone_id_to_string(cone->id), cone->lat, cone->lon,
+                 cone->alt, cone->itow);
+  storage_flush(&session->storage);
+}
+
+void cone_print(FILE *file, const cone_t *cone) {
+  fprintf(file, "%" PRIu64 ",%d,%s,%f,%f,%f,%" PRIu32 "\n", cone->timestamp,
           cone->id, cone_id_to_string(cone->id), cone->lat, cone->lon,
-          cone->alt);
-  fflush(session->file);
+          cone->alt, cone->itow);
 }
 
 const char *cone_id_to_string(cone_id id) {
@@ -0,0 +1,360 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "acr.h"
+#include "track.h"
+#include "utils.h"
+
+#define ALIGN_MAX_SESSIONS 16
+#define ALIGN_MAX_ITERATIONS 50
+// Stops when the transform moves the cones less than this
+#define ALIGN_CONVERGED_M (1e-4)
+// All the classes together
+#define ALIGN_ALL CONE_ID_SIZE
+
+typedef struct align_transform_t {
+  double theta;
+  double tx;
+  double ty;
+} align_transform_t;
+
+typedef struct align_fit_t {
+  align_transform_t transform;
+  int matched;
+  int iterations;
+  // Distance to the matched reference cones before and after the alignment
+  double rms_before;
+  double rms_after;
+} align_fit_t;
+
+typedef struct align_session_t {
+  char path[1024];
+  int count;
+  cone_t cones[TRACK_MAX_CONES];
+  // Local coordinates in the frame of the reference
+  double x[TRACK_MAX_CONES];
+  double y[TRACK_MAX_CONES];
+
+  // Results of the fit of all the classes
+  int match[TRACK_MAX_CONES];
+  double ax[TRACK_MAX_CONES];
+  double ay[TRACK_MAX_CONES];
+  align_fit_t fits[ALIGN_ALL + 1];
+  int reference_unmatched;
+
+  const track_t *reference;
+  double max_distance;
+  pthread_t thread;
+} align_session_t;
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] <reference> <session> [<session> ...]\n", name);
+  printf("  Sessions are cone_<n> folders or their cones.csv\n");
+  printf("  -d <m>     max distance of matching cones (default 1.0)\n");
+  printf("  -o <file>  write the per cone residuals as CSV\n");
+}
+
+static void session_add_cone(cone_t *cone, void *user) {
+  align_session_t *session = (align_session_t *)user;
+  if (session->count < TRACK_MAX_CONES) {
+    session->cones[session->count++] = *cone;
+  }
+}
+
+static int session_load(align_session_t *session, const char *path) {
+  cone_session_t cone_session;
+  memset(&cone_session, 0, sizeof(cone_session_t));
+  snprintf(session->path, sizeof(session->path), "%s", path);
+  snprintf(cone_session.session_path, sizeof(cone_session.session_path), "%s",
+           path);
+  struct stat st;
+  if (stat(path, &st) == 0 && !S_ISDIR(st.st_mode)) {
+    // Path of cones.csv, the session is its folder
+    char *slash = strrchr(cone_session.session_path, '/');
+    if (slash != NULL) {
+      *slash = '\0';
+    } else {
+      strcpy(cone_session.session_path, ".");
+    }
+  }
+  session->count = 0;
+  if (cone_session_read(&cone_session, session_add_cone, session) <= 0) {
+    fprintf(stderr, "No cones in %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+static void align_apply(const align_transform_t *t, double x, double y,
+                        double *ox, double *oy) {
+  double c = cos(t->theta);
+  double s = sin(t->theta);
+  *ox = c * x - s * y + t->tx;
+  *oy = s * x + c * y + t->ty;
+}
+
+// Matches the cones of the class with the transform, returns the matches
+static int align_match(align_session_t *session, int class_id,
+                       const align_transform_t *t, int *match) {
+  int matched = 0;
+  for (int i = 0; i < session->count; i++) {
+    match[i] = -1;
+    cone_id id = session->cones[i].id;
+    if (class_id != ALIGN_ALL && (int)id != class_id) {
+      continue;
+    }
+    double x, y;
+    align_apply(t, session->x[i], session->y[i], &x, &y);
+    match[i] = track_find_nearest(session->reference, x, y, id,
+                                  session->max_distance);
+    matched += match[i] != -1;
+  }
+  return matched;
+}
+
+// Least squares rotation and translation of the matched cones
+static void align_rigid(const align_session_t *session, const int *match,
+                        align_transform_t *t) {
+  const track_cone_t *ref = session->reference->cones;
+  double px = 0.0, py = 0.0, qx = 0.0, qy = 0.0;
+  int n = 0;
+  for (int i = 0; i < session->count; i++) {
+    if (match[i] == -1) {
+      continue;
+    }
+    px += session->x[i];
+    py += session->y[i];
+    qx += ref[match[i]].x;
+    qy += ref[match[i]].y;
+    n++;
+  }
+  px /= n;
+  py /= n;
+  qx /= n;
+  qy /= n;
+
+  double dot = 0.0, cross = 0.0;
+  for (int i = 0; i < session->count; i++) {
+    if (match[i] == -1) {
+      continue;
+    }
+    double ax = session->x[i] - px, ay = session->y[i] - py;
+    double bx = ref[match[i]].x - qx, by = ref[match[i]].y - qy;
+    dot += ax * bx + ay * by;
+    cross += ax * by - ay * bx;
+  }
+  t->theta = atan2(cross, dot);
+  t->tx = qx - (cos(t->theta) * px - sin(t->theta) * py);
+  t->ty = qy - (sin(t->theta) * px + cos(t->theta) * py);
+}
+
+static align_fit_t align_icp(align_session_t *session, int class_id,
+                             int *match) {
+  align_fit_t fit;
+  memset(&fit, 0, sizeof(align_fit_t));
+  for (int k = 0; k < ALIGN_MAX_ITERATIONS; k++) {
+    if (align_match(session, class_id, &fit.transform, match) < 2) {
+      break;
+    }
+    align_transform_t next;
+    align_rigid(session, match, &next);
+    fit.iterations = k + 1;
+
+    // Largest movement of a cone between the two transforms
+    double moved = 0.0;
+    for (int i = 0; i < session->count; i++) {
+      double x0, y0, x1, y1;
+      align_apply(&fit.transform, session->x[i], session->y[i], &x0, &y0);
+      align_apply(&next, session->x[i], session->y[i], &x1, &y1);
+      moved = fmax(moved, hypot(x1 - x0, y1 - y0));
+    }
+    fit.transform = next;
+    if (moved < ALIGN_CONVERGED_M) {
+      break;
+    }
+  }
+
+  fit.matched = align_match(session, class_id, &fit.transform, match);
+  const track_cone_t *ref = session->reference->cones;
+  for (int i = 0; i < session->count; i++) {
+    if (match[i] == -1) {
+      continue;
+    }
+    double x, y;
+    align_apply(&fit.transform, session->x[i], session->y[i], &x, &y);
+    fit.rms_before += pow(hypot(session->x[i] - ref[match[i]].x,
+                                session->y[i] - ref[match[i]].y),
+                          2);
+    fit.rms_after += pow(hypot(x - ref[match[i]].x, y - ref[match[i]].y), 2);
+  }
+  if (fit.matched > 0) {
+    fit.rms_before = sqrt(fit.rms_before / fit.matched);
+    fit.rms_after = sqrt(fit.rms_after / fit.matched);
+  }
+  return fit;
+}
+
+static void *align_runner(void *arg) {
+  align_session_t *session = (align_session_t *)arg;
+  const track_t *reference = session->reference;
+  for (int i = 0; i < session->count; i++) {
+    latlon_to_local(reference->lat0, reference->lon0, session->cones[i].lat,
+                    session->cones[i].lon, &session->x[i], &session->y[i]);
+  }
+
+  static __thread int match[TRACK_MAX_CONES];
+  for (int c = 0; c < ALIGN_ALL; c++) {
+    session->fits[c] = align_icp(session, c, match);
+  }
+  // The residuals are the ones of the fit of all the classes
+  session->fits[ALIGN_ALL] = align_icp(session, ALIGN_ALL, session->match);
+
+  static __thread char used[TRACK_MAX_CONES];
+  memset(used, 0, sizeof(used));
+  for (int i = 0; i < session->count; i++) {
+    align_apply(&session->fits[ALIGN_ALL].transform, session->x[i],
+                session->y[i], &session->ax[i], &session->ay[i]);
+    if (session->match[i] != -1) {
+      used[session->match[i]] = 1;
+    }
+  }
+  session->reference_unmatched = 0;
+  for (int j = 0; j < reference->count; j++) {
+    session->reference_unmatched += !used[j];
+  }
+  return NULL;
+}
+
+static void print_fit(const char *name, const align_fit_t *fit) {
+  if (fit->matched < 2) {
+    printf("  %-7s %4d matched\n", name, fit->matched);
+    return;
+  }
+  printf("  %-7s %4d matched, east %+.3f m, north %+.3f m, rotation %+.4f "
+         "deg, rms %.3f -> %.3f m (%d iterations)\n",
+         name, fit->matched, fit->transform.tx, fit->transform.ty,
+         fit->transform.theta * 180.0 / M_PI, fit->rms_before, fit->rms_after,
+         fit->iterations);
+}
+
+static void write_residuals(FILE *file, const align_session_t *session) {
+  const track_t *reference = session->reference;
+  for (int i = 0; i < session->count; i++) {
+    const cone_t *cone = &session->cones[i];
+    double lat, lon;
+    local_to_latlon(reference->lat0, reference->lon0, session->ax[i],
+                    session->ay[i], &lat, &lon);
+    int j = session->match[i];
+    if (j == -1) {
+      fprintf(file, "%s,%d,%d,%s,%.9f,%.9f,%.9f,%.9f,-1,nan,nan,nan,nan\n",
+              session->path, i, cone->id, cone_id_to_string(cone->id),
+              cone->lat, cone->lon, lat, lon);
+      continue;
+    }
+    const track_cone_t *ref = &reference->cones[j];
+    fprintf(file,
+            "%s,%d,%d,%s,%.9f,%.9f,%.9f,%.9f,%d,%.9f,%.9f,%.4f,%.4f\n",
+            session->path, i, cone->id, cone_id_to_string(cone->id),
+            cone->lat, cone->lon, lat, lon, j, ref->cone.lat, ref->cone.lon,
+            hypot(session->x[i] - ref->x, session->y[i] - ref->y),
+            hypot(session->ax[i] - ref->x, session->ay[i] - ref->y));
+  }
+}
+
+int main(int argc, char **argv) {
+  double max_distance = 1.0;
+  const char *output = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:o:h")) != -1) {
+    switch (opt) {
+    case 'd':
+      max_distance = atof(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  int count = argc - optind - 1;
+  if (count < 1 || count > ALIGN_MAX_SESSIONS || max_distance <= 0.0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (max_distance > TRACK_SEARCH_CELLS * TRACK_CELL_M) {
+    max_distance = TRACK_SEARCH_CELLS * TRACK_CELL_M;
+    printf("Max distance limited to %.1f m\n", max_distance);
+  }
+
+  // The reference cones are indexed once and shared by the threads
+  align_session_t *reference_session = calloc(1, sizeof(align_session_t));
+  static track_t reference;
+  if (reference_session == NULL ||
+      session_load(reference_session, argv[optind]) == -1) {
+    return EXIT_FAILURE;
+  }
+  track_init(&reference);
+  for (int i = 0; i < reference_session->count; i++) {
+    track_insert(&reference, &reference_session->cones[i]);
+  }
+
+  align_session_t *sessions[ALIGN_MAX_SESSIONS];
+  for (int s = 0; s < count; s++) {
+    sessions[s] = calloc(1, sizeof(align_session_t));
+    if (sessions[s] == NULL ||
+        session_load(sessions[s], argv[optind + 1 + s]) == -1) {
+      return EXIT_FAILURE;
+    }
+    sessions[s]->reference = &reference;
+    sessions[s]->max_distance = max_distance;
+    if (pthread_create(&sessions[s]->thread, NULL, align_runner,
+                       sessions[s]) != 0) {
+      perror("Could not start the alignment thread");
+      return EXIT_FAILURE;
+    }
+  }
+
+  FILE *file = NULL;
+  if (output != NULL) {
+    file = fopen(output, "w");
+    if (file == NULL) {
+      perror("Could not open output file");
+      return EXIT_FAILURE;
+    }
+    fprintf(file, "session,index,cone_id,cone_name,lat,lon,aligned_lat,"
+                  "aligned_lon,ref_index,ref_lat,ref_lon,drift_m,"
+                  "residual_m\n");
+  }
+
+  printf("Reference %s: %d cones\n", reference_session->path,
+         reference.count);
+  for (int s = 0; s < count; s++) {
+    align_session_t *session = sessions[s];
+    pthread_join(session->thread, NULL);
+    printf("%s: %d cones, %d unmatched, %d reference cones unmatched\n",
+           session->path, session->count,
+           session->count - session->fits[ALIGN_ALL].matched,
+           session->reference_unmatched);
+    for (int c = 0; c < ALIGN_ALL; c++) {
+      print_fit(cone_id_to_string(c), &session->fits[c]);
+    }
+    print_fit("all", &session->fits[ALIGN_ALL]);
+    if (file != NULL) {
+      write_residuals(file, session);
+    }
+    free(session);
+  }
+  if (file != NULL) {
+    fclose(file);
+  }
+  free(reference_session);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "acr.h"
+#include "defines.h"
+#include "dispatch.h"
+#include "ubx_cfg.h"
+#include "utils.h"
+
+#define BENCH_TMPFS_MAGIC (0x01021994)
+#define BENCH_MAX_SAMPLES (1024)
+// Position of the synthetic NAV-HPPOSLLH fixes
+#define BENCH_LAT (46.0674223)
+#define BENCH_LON (11.1500175)
+#define BENCH_HEIGHT (163.0)
+
+typedef struct bench_options_t {
+  const char *dir;
+  const char *output;
+  // Divides the number of iterations, for a quick check
+  int quick;
+} bench_options_t;
+
+typedef struct bench_mix_t {
+  const char *name;
+  int pvt_per_epoch;
+  dispatch_policy_t pvt_policy;
+} bench_mix_t;
+
+static const bench_mix_t bench_mixes[] = {
+    {"hpposllh", 0, DISPATCH_PARSE_LOG},
+    {"hpposllh_pvt_raw", 1, DISPATCH_LOG_RAW},
+    {"hpposllh_pvt_log", 1, DISPATCH_PARSE_LOG},
+    {"hpposllh_4pvt_log", 4, DISPATCH_PARSE_LOG},
+};
+
+static FILE *out;
+static int first_result = 1;
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] <dir>\n", name);
+  printf("  -o <file>  write the JSON to file instead of stdout\n");
+  printf("  -q         quick run, fewer iterations\n");
+}
+
+static void result_begin(const char *name) {
+  fprintf(out, "%s\n    {\"name\": \"%s\"", first_result ? "" : ",", name);
+  first_result = 0;
+}
+
+static void result_end() { fprintf(out, "}"); }
+
+static int remove_entry(const char *path, const struct stat *sb, int flag,
+                        struct FTW *ftw) {
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static void remove_tree(const char *path) {
+  nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Writes min, median, p99 and max of the samples (sorted in place)
+static void result_latency(uint64_t *samples, int count) {
+  qsort(samples, count, sizeof(uint64_t), compare_u64);
+  fprintf(out,
+          ", \"samples\": %d, \"min_us\": %" PRIu64 ", \"median_us\": %" PRIu64
+          ", \"p99_us\": %" PRIu64 ", \"max_us\": %" PRIu64,
+          count, samples[0], samples[count / 2], samples[count * 99 / 100],
+          samples[count - 1]);
+}
+
+static void bench_cone_write(const char *basepath, storage_durability_t
+                             durability, int count) {
+  cone_session_t session;
+  memset(&session, 0, sizeof(cone_session_t));
+  if (cone_session_setup(&session, basepath) == -1 ||
+      dir_exist_or_create(session.session_path) == -1) {
+    return;
+  }
+  // Same as cone_session_start, with the durability under test
+  char cones_path[2048];
+  snprintf(cones_path, 2048, "%s/cones.csv", session.session_path);
+  if (storage_open(&session.storage, cones_path, durability) == -1) {
+    return;
+  }
+  session.active = 1;
+
+  cone_t cone = {0, 0, CONE_ID_YELLOW, 46.0674223580, 11.1500175430, 210.0};
+  uint64_t start = get_t();
+  for (int i = 0; i < count; i++) {
+    cone.timestamp = get_t();
+    cone.id = i % CONE_ID_SIZE;
+    cone_session_write(&session, &cone);
+  }
+  cone_session_stop(&session);
+  uint64_t elapsed = get_t() - start;
+
+  result_begin("cone_session_write");
+  fprintf(out,
+          ", \"durability\": \"%s\", \"records\": %d, \"records_per_s\": %.1f"
+          ", \"waits\": %" PRIu64 ", \"wait_us\": %" PRIu64,
+          storage_durability_to_string(durability), count,
+          count / (elapsed * 1e-6), session.storage.stats.waits,
+          session.storage.stats.wait_us);
+  result_end();
+}
+
+static void bench_dir_next_number(const char *dir, int sessions, int calls) {
+  char path[2048];
+  snprintf(path, 2048, "%s/dirs_%d/", dir, sessions);
+  if (dir_exist_or_create(path) == -1) {
+    return;
+  }
+  for (int i = 1; i <= sessions; i++) {
+    char session_path[2560];
+    snprintf(session_path, 2560, "%scones_%03d", path, i);
+    mkdir(session_path, 0777);
+  }
+
+  uint64_t samples[BENCH_MAX_SAMPLES];
+  int number = 0;
+  for (int i = 0; i < calls; i++) {
+    uint64_t start = get_t();
+    number = dir_next_number(path, "cones_");
+    samples[i] = get_t() - start;
+  }
+
+  result_begin("dir_next_number");
+  fprintf(out, ", \"sessions\": %d, \"found\": %d", sessions, number);
+  result_latency(samples, calls);
+  result_end();
+  remove_tree(path);
+}
+
+static void bench_csv_session_start(const char *basepath, int count) {
+  uint64_t samples[BENCH_MAX_SAMPLES];
+  full_session_t session;
+  memset(&session, 0, sizeof(full_session_t));
+  lap_detector_init(&session.laps, NULL);
+  for (int i = 0; i < count; i++) {
+    if (csv_session_setup(&session, basepath) == -1) {
+      return;
+    }
+    uint64_t start = get_t();
+    if (csv_session_start(&session) == -1) {
+      return;
+    }
+    samples[i] = get_t() - start;
+    csv_session_stop(&session);
+  }
+
+  result_begin("csv_session_start");
+  result_latency(samples, count);
+  result_end();
+}
+
+// Feeds one message through the same steps as the main loop
+static void trajectory_message(dispatch_table_t *dispatch,
+                               full_session_t *session,
+                               gps_parsed_data_t *gps_data,
+                               const unsigned char *frame, int size) {
+  // The interface splits the sync chars from the rest of the message
+  const char *line = (const char *)frame + 2;
+  int line_size = size - 2;
+  gps_protocol_and_message match;
+  if (gps_match_message(&match, line, GPS_PROTOCOL_TYPE_UBX) == -1) {
+    return;
+  }
+  uint64_t t = get_t();
+  int actions = dispatch_message(dispatch, &match, 0, line_size, 1, t);
+  if (actions & DISPATCH_RAW) {
+    csv_session_write_raw(session, 0, frame, 2, line, line_size);
+  }
+  if (actions & DISPATCH_PARSE) {
+    gps_parse_buffer(gps_data, &match, line, t);
+  }
+  if (actions & DISPATCH_LOG) {
+    gps_to_file(&session->sources[0].files, gps_data, &match);
+  }
+}
+
+static void bench_trajectory(const char *basepath, const bench_mix_t *mix,
+                             int epochs) {
+  unsigned char frame[256];
+  gps_protocol_and_message match;
+  dispatch_table_t dispatch;
+  dispatch_init(&dispatch, DISPATCH_PARSE_LOG);
+  // Every message is logged, the mix sets the load
+  dispatch.byte_budget = 0;
+  int size = ubx_pvt_build(frame, 0);
+  if (gps_match_message(&match, (const char *)frame + 2,
+                        GPS_PROTOCOL_TYPE_UBX) != -1) {
+    dispatch_set(&dispatch, match.protocol, match.message, mix->pvt_policy, 0);
+  }
+
+  full_session_t session;
+  gps_parsed_data_t gps_data;
+  memset(&session, 0, sizeof(full_session_t));
+  memset(&gps_data, 0, sizeof(gps_parsed_data_t));
+  lap_detector_init(&session.laps, NULL);
+  if (csv_session_setup(&session, basepath) == -1 ||
+      csv_session_start(&session) == -1) {
+    return;
+  }
+
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+  uint64_t start = get_t();
+  for (int i = 0; i < epochs; i++) {
+    uint32_t itow = i * UBX_MEAS_RATE_MS;
+    size = ubx_hpposllh_build(frame, itow, BENCH_LAT, BENCH_LON,
+                              BENCH_HEIGHT);
+    trajectory_message(&dispatch, &session, &gps_data, frame, size);
+    messages++;
+    bytes += size;
+    for (int j = 0; j < mix->pvt_per_epoch; j++) {
+      size = ubx_pvt_build(frame, itow);
+      trajectory_message(&dispatch, &session, &gps_data, frame, size);
+      messages++;
+      bytes += size;
+    }
+  }
+  csv_session_stop(&session);
+  uint64_t elapsed = get_t() - start;
+
+  result_begin("trajectory");
+  fprintf(out,
+          ", \"mix\": \"%s\", \"messages\": %" PRIu64
+          ", \"messages_per_s\": %.1f, \"input_mb_per_s\": %.3f"
+          ", \"realtime_factor\": %.1f",
+          mix->name, messages, messages / (elapsed * 1e-6),
+          bytes / (elapsed * 1e-6) / 1e6,
+          epochs * UBX_MEAS_RATE_MS * 1e3 / elapsed);
+  result_end();
+}
+
+static const char *fs_name(const char *dir) {
+  struct statfs fs;
+  if (statfs(dir, &fs) == -1) {
+    return "unknown";
+  }
+  return fs.f_type == BENCH_TMPFS_MAGIC ? "tmpfs" : "disk";
+}
+
+int main(int argc, char **argv) {
+  bench_options_t options = {NULL, NULL, 1};
+  int opt;
+  while ((opt = getopt(argc, argv, "o:qh")) != -1) {
+    switch (opt) {
+    case 'o':
+      options.output = optarg;
+      break;
+    case 'q':
+      options.quick = 10;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  options.dir = argv[optind];
+
+  // Everything is created under <dir>/acr_bench and removed at the end
+  char basepath[1024];
+  char logs_path[2048];
+  snprintf(basepath, 1024, "%s/acr_bench", options.dir);
+  remove_tree(basepath);
+  mkdir(options.dir, 0777);
+  if (dir_exist_or_create(basepath) == -1) {
+    return EXIT_FAILURE;
+  }
+  snprintf(logs_path, 2048, "%s/logs", basepath);
+  dir_exist_or_create(logs_path);
+
+  if (options.output != NULL) {
+    out = fopen(options.output, "w");
+  } else {
+    // Sessions print their reports on stdout, keep it for the JSON only
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+  if (out == NULL) {
+    perror("Could not open output file");
+    return EXIT_FAILURE;
+  }
+
+  fprintf(out, "{\n  \"dir\": \"%s\",\n  \"fs\": \"%s\",\n  \"quick\": %s,\n",
+          options.dir, fs_name(basepath), options.quick > 1 ? "true" : "false");
+  fprintf(out, "  \"results\": [");
+
+  fprintf(stderr, "cone_session_write\n");
+  bench_cone_write(basepath, STORAGE_BUFFERED, 100000 / options.quick);
+  bench_cone_write(basepath, STORAGE_FLUSH, 20000 / options.quick);
+  bench_cone_write(basepath, STORAGE_SYNC, 1000 / options.quick);
+
+  fprintf(stderr, "dir_next_number\n");
+  bench_dir_next_number(basepath, 1000, 100);
+  bench_dir_next_number(basepath, 10000, 100 / options.quick);
+
+  fprintf(stderr, "csv_session_start\n");
+  bench_csv_session_start(basepath, 200 / options.quick);
+
+  for (size_t i = 0; i < sizeof(bench_mixes) / sizeof(bench_mixes[0]); i++) {
+    fprintf(stderr, "trajectory %s\n", bench_mixes[i].name);
+    bench_trajectory(basepath, &bench_mixes[i], 100000 / options.quick);
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+  fclose(out);
+  remove_tree(basepath);
+  return EXIT_SUCCESS;
+}
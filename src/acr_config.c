@@ -0,0 +1,179 @@
+#include "acr_config.h"
+#include "config.h"
+#include "defines.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+void acr_config_default(acr_config_t *config) {
+  memset(config, 0, sizeof(acr_config_t));
+  config->pins.led_green = 5;
+  config->pins.led_red = 6;
+  config->pins.button_yellow = 22;
+  config->pins.button_blue = 23;
+  config->pins.button_orange = 24;
+  config->pins.button_mode = 27;
+  config->pins.debounce_us = 10000;
+  config->cones.filter = CONE_FILTER_MEAN;
+  config->cones.mean_weight = 0.9;
+  config->cones.repress_us = 1000000;
+}
+
+static int config_ms(const char *value, uint64_t *out_us) {
+  int ms;
+  if (config_int(value, &ms) == -1 || ms < 0) {
+    return -1;
+  }
+  *out_us = ms * 1000ull;
+  return 0;
+}
+
+static int pins_handler(pins_config_t *pins, const char *key,
+                        const char *value) {
+  if (strcmp(key, "led_green") == 0) {
+    return config_int(value, &pins->led_green);
+  }
+  if (strcmp(key, "led_red") == 0) {
+    return config_int(value, &pins->led_red);
+  }
+  if (strcmp(key, "button_yellow") == 0) {
+    return config_int(value, &pins->button_yellow);
+  }
+  if (strcmp(key, "button_blue") == 0) {
+    return config_int(value, &pins->button_blue);
+  }
+  if (strcmp(key, "button_orange") == 0) {
+    return config_int(value, &pins->button_orange);
+  }
+  if (strcmp(key, "button_mode") == 0) {
+    return config_int(value, &pins->button_mode);
+  }
+  if (strcmp(key, "debounce_ms") == 0) {
+    return config_ms(value, &pins->debounce_us);
+  }
+  if (strcmp(key, "debounce_yellow_ms") == 0) {
+    return config_ms(value, &pins->debounce_yellow_us);
+  }
+  if (strcmp(key, "debounce_blue_ms") == 0) {
+    return config_ms(value, &pins->debounce_blue_us);
+  }
+  if (strcmp(key, "debounce_orange_ms") == 0) {
+    return config_ms(value, &pins->debounce_orange_us);
+  }
+  if (strcmp(key, "debounce_mode_ms") == 0) {
+    return config_ms(value, &pins->debounce_mode_us);
+  }
+  return -1;
+}
+
+static int cones_handler(cones_config_t *cones, const char *key,
+                         const char *value) {
+  if (strcmp(key, "filter") == 0) {
+    if (strcasecmp(value, "last") == 0) {
+      cones->filter = CONE_FILTER_LAST;
+    } else if (strcasecmp(value, "mean") == 0) {
+      cones->filter = CONE_FILTER_MEAN;
+    } else {
+      return -1;
+    }
+    return 0;
+  }
+  if (strcmp(key, "mean_weight") == 0) {
+    return config_double(value, &cones->mean_weight);
+  }
+  if (strcmp(key, "repress_ms") == 0) {
+    return config_ms(value, &cones->repress_us);
+  }
+  // Owned by the receivers configuration
+  if (strcmp(key, "source") == 0) {
+    return 0;
+  }
+  return -1;
+}
+
+int acr_config_handler(void *user, const char *section, const char *key,
+                       const char *value) {
+  acr_config_t *config = (acr_config_t *)user;
+  if (strcmp(section, "pins") == 0) {
+    return pins_handler(&config->pins, key, value);
+  }
+  if (strcmp(section, "cones") == 0) {
+    return cones_handler(&config->cones, key, value);
+  }
+  return 0;
+}
+
+int acr_config_validate(const acr_config_t *config) {
+  const pins_config_t *pins = &config->pins;
+  struct {
+    const char *name;
+    int pin;
+  } used[] = {
+      {"led_green", pins->led_green},
+      {"led_red", pins->led_red},
+      {"button_yellow", pins->button_yellow},
+      {"button_blue", pins->button_blue},
+      {"button_orange", pins->button_orange},
+      {"button_mode", pins->button_mode},
+  };
+  int count = sizeof(used) / sizeof(used[0]);
+  int ret = 0;
+  for (int i = 0; i < count; i++) {
+    if (used[i].pin < 0 || used[i].pin >= MAX_PINS) {
+      fprintf(stderr, "Invalid pin %s = %d\n", used[i].name, used[i].pin);
+      ret = -1;
+      continue;
+    }
+    for (int j = 0; j < i; j++) {
+      if (used[i].pin == used[j].pin) {
+        fprintf(stderr, "Pin %d used by %s and %s\n", used[i].pin,
+                used[j].name, used[i].name);
+        ret = -1;
+      }
+    }
+  }
+  struct {
+    const char *name;
+    uint64_t us;
+  } windows[] = {
+      {"debounce_ms", pins->debounce_us},
+      {"debounce_yellow_ms", pins->debounce_yellow_us},
+      {"debounce_blue_ms", pins->debounce_blue_us},
+      {"debounce_orange_ms", pins->debounce_orange_us},
+      {"debounce_mode_ms", pins->debounce_mode_us},
+  };
+  for (int i = 0; i < (int)(sizeof(windows) / sizeof(windows[0])); i++) {
+    if (windows[i].us > 1000000) {
+      fprintf(stderr, "Invalid %s, at most 1000\n", windows[i].name);
+      ret = -1;
+    }
+  }
+
+  const cones_config_t *cones = &config->cones;
+  if (cones->filter < 0 || cones->filter >= CONE_FILTER_SIZE) {
+    fprintf(stderr, "Invalid cone filter %d\n", cones->filter);
+    ret = -1;
+  }
+  if (!(cones->mean_weight >= 0.0 && cones->mean_weight < 1.0)) {
+    fprintf(stderr, "Invalid mean_weight %f, in [0, 1)\n",
+            cones->mean_weight);
+    ret = -1;
+  }
+  if (cones->filter == CONE_FILTER_MEAN && cones->repress_us == 0) {
+    fprintf(stderr, "The mean filter needs repress_ms > 0\n");
+    ret = -1;
+  }
+  return ret;
+}
+
+const char *cone_filter_to_string(cone_filter_t filter) {
+  switch (filter) {
+  case CONE_FILTER_LAST:
+    return "last";
+  case CONE_FILTER_MEAN:
+    return "mean";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "acr.h"
+#include "defines.h"
+#include "map_format.h"
+#include "track.h"
+#include "utils.h"
+
+#define EXPORT_LINE_SIZE 4096
+// Trajectory folder, gps_<part> folder, receiver folder
+#define EXPORT_MAX_DEPTH 2
+// Trajectory points closer than this do not give a heading
+#define EXPORT_HEADING_MIN_M (0.5)
+// Cones further from the trajectory do not vote for a side
+#define EXPORT_SIDE_MAX_M (TRACK_SEARCH_CELLS * TRACK_CELL_M)
+
+typedef struct export_cone_t {
+  int observations;
+  int left_votes;
+  int right_votes;
+} export_cone_t;
+
+typedef struct export_t {
+  // Deduplicated cones, with the local frame of the map
+  track_t track;
+  export_cone_t cones[TRACK_MAX_CONES];
+  int has_alt0;
+  double alt0;
+  double merge_m;
+
+  int has_heading_point;
+  double heading_x;
+  double heading_y;
+
+  int read;
+  int merged;
+  int dropped;
+  uint64_t points;
+  uint64_t side_points;
+} export_t;
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] <session>\n", name);
+  printf("  The session is a cone_<n> folder or its cones.csv\n");
+  printf("  -t <path>        trajectory_<n> folder or its NAV-HPPOSLLH csv, for "
+         "the sides\n");
+  printf("  -O <lat>,<lon>   origin of the map (default the first cone)\n");
+  printf("  -r <m>           cones of the same colour closer than this are "
+         "merged (default 1.0)\n");
+  printf("  -o <prefix>      writes <prefix>.bin, .yaml and .csv (default "
+         "<session>/map)\n");
+}
+
+// Cones are merged into the mean of their registrations as they are read
+static void export_cone(cone_t *cone, void *user) {
+  export_t *export = (export_t *)user;
+  track_t *track = &export->track;
+  export->read++;
+  if (!export->has_alt0) {
+    export->has_alt0 = 1;
+    export->alt0 = cone->alt;
+  }
+
+  double x, y;
+  if (track->has_origin) {
+    latlon_to_local(track->lat0, track->lon0, cone->lat, cone->lon, &x, &y);
+    int j = track_find_nearest(track, x, y, cone->id, export->merge_m);
+    if (j != -1) {
+      track_cone_t *c = &track->cones[j];
+      int n = ++export->cones[j].observations;
+      c->x += (x - c->x) / n;
+      c->y += (y - c->y) / n;
+      c->cone.alt += (cone->alt - c->cone.alt) / n;
+      local_to_latlon(track->lat0, track->lon0, c->x, c->y, &c->cone.lat,
+                      &c->cone.lon);
+      export->merged++;
+      return;
+    }
+  }
+
+  int i = track_insert(track, cone);
+  if (i == -1) {
+    export->dropped++;
+    return;
+  }
+  export->cones[i].observations = 1;
+}
+
+// Every cone near the trajectory votes for the side it is on
+static void export_point(export_t *export, double lat, double lon) {
+  track_t *track = &export->track;
+  double x, y;
+  latlon_to_local(track->lat0, track->lon0, lat, lon, &x, &y);
+  export->points++;
+  if (!export->has_heading_point) {
+    export->has_heading_point = 1;
+    export->heading_x = x;
+    export->heading_y = y;
+    return;
+  }
+  double hx = x - export->heading_x;
+  double hy = y - export->heading_y;
+  if (hypot(hx, hy) < EXPORT_HEADING_MIN_M) {
+    return;
+  }
+  export->heading_x = x;
+  export->heading_y = y;
+  export->side_points++;
+
+  for (int id = 0; id < CONE_ID_SIZE; id++) {
+    int j = track_find_nearest(track, x, y, id, EXPORT_SIDE_MAX_M);
+    if (j == -1) {
+      continue;
+    }
+    double cross = hx * (track->cones[j].y - y) - hy * (track->cones[j].x - x);
+    if (cross > 0.0) {
+      export->cones[j].left_votes++;
+    } else if (cross < 0.0) {
+      export->cones[j].right_votes++;
+    }
+  }
+}
+
+// Streams one NAV-HPPOSLLH csv written by gpslib, the columns are found by
+// name in the header. Returns the number of fixes used.
+static int export_csv(export_t *export, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  // Headings do not continue across files (parts, receivers)
+  export->has_heading_point = 0;
+
+  char line[EXPORT_LINE_SIZE];
+  int lat_column = -1, lon_column = -1, hacc_column = -1;
+  if (fgets(line, sizeof(line), file) != NULL) {
+    int column = 0;
+    char *save;
+    for (char *field = strtok_r(line, ",\r\n", &save); field != NULL;
+         field = strtok_r(NULL, ",\r\n", &save), column++) {
+      if (strcasecmp(field, "lat") == 0) {
+        lat_column = column;
+      } else if (strcasecmp(field, "lon") == 0) {
+        lon_column = column;
+      } else if (strcasecmp(field, "hAcc") == 0) {
+        hacc_column = column;
+      }
+    }
+  }
+  if (lat_column == -1 || lon_column == -1) {
+    fprintf(stderr, "No lat and lon columns in %s\n", path);
+    fclose(file);
+    return 0;
+  }
+
+  int used = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    double lat = NAN, lon = NAN, h_acc = 0.0;
+    int column = 0;
+    char *field = line;
+    while (field != NULL) {
+      char *next = strchr(field, ',');
+      if (column == lat_column) {
+        lat = strtod(field, NULL);
+      } else if (column == lon_column) {
+        lon = strtod(field, NULL);
+      } else if (column == hacc_column) {
+        h_acc = strtod(field, NULL);
+      }
+      field = next != NULL ? next + 1 : NULL;
+      column++;
+    }
+    // Only accurate fixes, like the ones that start the sessions
+    if (isnan(lat) || isnan(lon) || (lat == 0.0 && lon == 0.0) ||
+        h_acc >= FIX_MAX_HACC_M) {
+      continue;
+    }
+    export_point(export, lat, lon);
+    used++;
+  }
+  fclose(file);
+  return used;
+}
+
+// Every NAV-HPPOSLLH csv under path: the gps, gps_<part> folders of a
+// trajectory and their receiver subfolders. Returns the fixes used.
+static int export_trajectory(export_t *export, const char *path, int depth) {
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    perror(path);
+    return -1;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return export_csv(export, path);
+  }
+
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    perror(path);
+    return -1;
+  }
+  int used = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    char child[4096];
+    snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+    if (stat(child, &st) == -1) {
+      continue;
+    }
+    int count = 0;
+    if (S_ISDIR(st.st_mode) && depth < EXPORT_MAX_DEPTH) {
+      count = export_trajectory(export, child, depth + 1);
+    } else if (S_ISREG(st.st_mode) &&
+               strcasestr(entry->d_name, "hpposllh") != NULL &&
+               strcasestr(entry->d_name, ".csv") != NULL) {
+      count = export_csv(export, child);
+    }
+    used += count > 0 ? count : 0;
+  }
+  closedir(dir);
+  return used;
+}
+
+// Votes of the trajectory, else the colour: blue on the left, yellow on the
+// right, orange on the side of the nearest of them
+static map_side_t export_side(const export_t *export, int i) {
+  const export_cone_t *c = &export->cones[i];
+  if (c->left_votes != c->right_votes) {
+    return c->left_votes > c->right_votes ? MAP_SIDE_LEFT : MAP_SIDE_RIGHT;
+  }
+  const track_t *track = &export->track;
+  const track_cone_t *cone = &track->cones[i];
+  switch (cone->cone.id) {
+  case CONE_ID_BLUE:
+    return MAP_SIDE_LEFT;
+  case CONE_ID_YELLOW:
+    return MAP_SIDE_RIGHT;
+  default: {
+    int blue = track_find_nearest(track, cone->x, cone->y, CONE_ID_BLUE,
+                                  EXPORT_SIDE_MAX_M);
+    int yellow = track_find_nearest(track, cone->x, cone->y, CONE_ID_YELLOW,
+                                    EXPORT_SIDE_MAX_M);
+    if (blue == -1 && yellow == -1) {
+      return MAP_SIDE_UNKNOWN;
+    }
+    if (yellow == -1 ||
+        (blue != -1 && hypot(track->cones[blue].x - cone->x,
+                             track->cones[blue].y - cone->y) <
+                           hypot(track->cones[yellow].x - cone->x,
+                                 track->cones[yellow].y - cone->y))) {
+      return MAP_SIDE_LEFT;
+    }
+    return MAP_SIDE_RIGHT;
+  }
+  }
+}
+
+static const char *side_to_string(map_side_t side) {
+  switch (side) {
+  case MAP_SIDE_LEFT:
+    return "left";
+  case MAP_SIDE_RIGHT:
+    return "right";
+  default:
+    return "unknown";
+  }
+}
+
+static FILE *open_output(const char *prefix, const char *extension,
+                         const char *mode) {
+  char path[2048];
+  snprintf(path, sizeof(path), "%s.%s", prefix, extension);
+  FILE *file = fopen(path, mode);
+  if (file == NULL) {
+    perror(path);
+  }
+  return file;
+}
+
+// The three formats are written together, one cone at a time
+static int export_write(const export_t *export, const char *prefix,
+                        int *conflicts) {
+  FILE *bin = open_output(prefix, "bin", "wb");
+  FILE *yaml = open_output(prefix, "yaml", "w");
+  FILE *csv = open_output(prefix, "csv", "w");
+  if (bin == NULL || yaml == NULL || csv == NULL) {
+    return -1;
+  }
+
+  const track_t *track = &export->track;
+  map_header_t header;
+  memcpy(header.magic, MAP_MAGIC, 4);
+  header.version = MAP_VERSION;
+  header.count = track->count;
+  header.lat0 = track->lat0;
+  header.lon0 = track->lon0;
+  header.alt0 = export->alt0;
+  fwrite(&header, sizeof(header), 1, bin);
+
+  fprintf(yaml, "origin: {lat: %.9f, lon: %.9f, alt: %.4f}\n", track->lat0,
+          track->lon0, export->alt0);
+  fprintf(yaml, "cones:\n");
+  fprintf(csv, "index,cone_id,cone_name,side,x,y,z,lat,lon,alt,"
+               "observations\n");
+
+  *conflicts = 0;
+  for (int i = 0; i < track->count; i++) {
+    const track_cone_t *c = &track->cones[i];
+    map_side_t side = export_side(export, i);
+    double z = c->cone.alt - export->alt0;
+    int observations = export->cones[i].observations;
+    if ((c->cone.id == CONE_ID_BLUE && side == MAP_SIDE_RIGHT) ||
+        (c->cone.id == CONE_ID_YELLOW && side == MAP_SIDE_LEFT)) {
+      (*conflicts)++;
+    }
+
+    map_cone_t record;
+    record.x = c->x;
+    record.y = c->y;
+    record.z = z;
+    record.id = c->cone.id;
+    record.side = side;
+    record.observations = observations < UINT16_MAX ? observations : UINT16_MAX;
+    fwrite(&record, sizeof(record), 1, bin);
+
+    fprintf(yaml,
+            "  - {id: %d, class: %s, side: %s, x: %.4f, y: %.4f, z: %.4f, "
+            "observations: %d}\n",
+            c->cone.id, cone_id_to_string(c->cone.id), side_to_string(side),
+            c->x, c->y, z, observations);
+    fprintf(csv, "%d,%d,%s,%s,%.4f,%.4f,%.4f,%.9f,%.9f,%.4f,%d\n", i,
+            c->cone.id, cone_id_to_string(c->cone.id), side_to_string(side),
+            c->x, c->y, z, c->cone.lat, c->cone.lon, c->cone.alt,
+            observations);
+  }
+
+  int ret = ferror(bin) || ferror(yaml) || ferror(csv) ? -1 : 0;
+  if (fclose(bin) != 0 || fclose(yaml) != 0 || fclose(csv) != 0) {
+    ret = -1;
+  }
+  if (ret == -1) {
+    fprintf(stderr, "Could not write the map %s\n", prefix);
+  }
+  return ret;
+}
+
+int main(int argc, char **argv) {
+  static export_t export;
+  const char *trajectory = NULL;
+  const char *output = NULL;
+  double lat0 = 0.0, lon0 = 0.0;
+  int has_origin = 0;
+  export.merge_m = 1.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:O:r:o:h")) != -1) {
+    switch (opt) {
+    case 't':
+      trajectory = optarg;
+      break;
+    case 'O':
+      if (sscanf(optarg, "%lf,%lf", &lat0, &lon0) != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      has_origin = 1;
+      break;
+    case 'r':
+      export.merge_m = atof(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (argc - optind != 1 || export.merge_m < 0.0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (export.merge_m > TRACK_SEARCH_CELLS * TRACK_CELL_M) {
+    export.merge_m = TRACK_SEARCH_CELLS * TRACK_CELL_M;
+    printf("Merge distance limited to %.1f m\n", export.merge_m);
+  }
+
+  cone_session_t cone_session;
+  memset(&cone_session, 0, sizeof(cone_session_t));
+  snprintf(cone_session.session_path, sizeof(cone_session.session_path), "%s",
+           argv[optind]);
+  struct stat st;
+  if (stat(argv[optind], &st) == 0 && !S_ISDIR(st.st_mode)) {
+    // Path of cones.csv, the session is its folder
+    char *slash = strrchr(cone_session.session_path, '/');
+    if (slash != NULL) {
+      *slash = '\0';
+    } else {
+      strcpy(cone_session.session_path, ".");
+    }
+  }
+  char prefix[2048];
+  if (output != NULL) {
+    snprintf(prefix, sizeof(prefix), "%s", output);
+  } else {
+    snprintf(prefix, sizeof(prefix), "%s/map", cone_session.session_path);
+  }
+
+  track_init(&export.track);
+  if (has_origin) {
+    export.track.has_origin = 1;
+    export.track.lat0 = lat0;
+    export.track.lon0 = lon0;
+  }
+  if (cone_session_read(&cone_session, export_cone, &export) <= 0) {
+    fprintf(stderr, "No cones in %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  printf("%d cones read, %d merged, %d in the map\n", export.read,
+         export.merged, export.track.count);
+  if (export.dropped > 0) {
+    printf("%d cones dropped, the map is limited to %d\n", export.dropped,
+           TRACK_MAX_CONES);
+  }
+
+  if (trajectory != NULL) {
+    int used = export_trajectory(&export, trajectory, 0);
+    if (used <= 0) {
+      fprintf(stderr, "No NAV-HPPOSLLH fixes in %s\n", trajectory);
+      return EXIT_FAILURE;
+    }
+    printf("%d fixes of the trajectory, %" PRIu64 " headings\n", used,
+           export.side_points);
+  }
+
+  int conflicts;
+  if (export_write(&export, prefix, &conflicts) == -1) {
+    return EXIT_FAILURE;
+  }
+  if (conflicts > 0) {
+    printf("%d cones on the side of the other colour, check them\n",
+           conflicts);
+  }
+  printf("Map written to %s.bin, %s.yaml and %s.csv\n", prefix, prefix,
+         prefix);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+#include "clock_model.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#define CLOCK_WEEK_MS (604800000u)
+
+void clock_model_init(clock_model_t *model) {
+  memset(model, 0, sizeof(clock_model_t));
+  model->slope = 1.0;
+}
+
+static void clock_model_reset(clock_model_t *model) {
+  model->count = 0;
+  model->next = 0;
+  model->valid = 0;
+  model->resets++;
+}
+
+static int64_t clock_model_gps_us(const clock_model_t *model,
+                                  uint32_t itow_ms) {
+  return model->week_us + (int64_t)itow_ms * 1000;
+}
+
+static const clock_sample_t *clock_model_sample(const clock_model_t *model,
+                                                int i) {
+  int first = model->count < CLOCK_MODEL_WINDOW ? 0 : model->next;
+  return &model->samples[(first + i) % CLOCK_MODEL_WINDOW];
+}
+
+static void clock_model_fit(clock_model_t *model) {
+  if (model->count < CLOCK_MODEL_MIN_SAMPLES) {
+    model->valid = 0;
+    return;
+  }
+  const clock_sample_t *first = clock_model_sample(model, 0);
+  int64_t gps_ref = first->gps_us;
+  uint64_t host_ref = first->host_us;
+
+  // Least delayed epoch of each half gives the slope of the envelope
+  int half = model->count / 2;
+  int best[2] = {-1, -1};
+  double best_offset[2] = {INFINITY, INFINITY};
+  for (int i = 0; i < model->count; i++) {
+    const clock_sample_t *s = clock_model_sample(model, i);
+    double offset =
+        (double)(s->host_us - host_ref) - (double)(s->gps_us - gps_ref);
+    int h = i >= half;
+    if (offset < best_offset[h]) {
+      best_offset[h] = offset;
+      best[h] = i;
+    }
+  }
+  double g0 = clock_model_sample(model, best[0])->gps_us - gps_ref;
+  double g1 = clock_model_sample(model, best[1])->gps_us - gps_ref;
+  double slope = 1.0;
+  if (g1 > g0) {
+    slope += (best_offset[1] - best_offset[0]) / (g1 - g0);
+  }
+  if (fabs(slope - 1.0) * 1e6 > CLOCK_MODEL_MAX_SKEW_PPM) {
+    slope = model->valid ? model->slope : 1.0;
+  }
+
+  // The envelope touches the least delayed epoch of the window
+  double offset = INFINITY;
+  for (int i = 0; i < model->count; i++) {
+    const clock_sample_t *s = clock_model_sample(model, i);
+    offset = fmin(offset, (double)(s->host_us - host_ref) -
+                              slope * (double)(s->gps_us - gps_ref));
+  }
+  model->gps_ref = gps_ref;
+  model->host_ref = host_ref;
+  model->slope = slope;
+  model->offset_us = offset;
+  model->valid = 1;
+}
+
+void clock_model_update(clock_model_t *model, uint32_t itow_ms,
+                        uint64_t arrival_t) {
+  if (model->has_itow && itow_ms < model->last_itow &&
+      model->last_itow - itow_ms > CLOCK_WEEK_MS / 2) {
+    model->week_us += (int64_t)CLOCK_WEEK_MS * 1000;
+  }
+  int64_t gps_us = clock_model_gps_us(model, itow_ms);
+  if (model->count > 0) {
+    const clock_sample_t *last = clock_model_sample(model, model->count - 1);
+    // Receiver restarted or the stream stopped for longer than the window
+    if (gps_us <= last->gps_us || arrival_t <= last->host_us ||
+        gps_us - last->gps_us > 10000000) {
+      clock_model_reset(model);
+    }
+  }
+  model->has_itow = 1;
+  model->last_itow = itow_ms;
+
+  model->samples[model->next].gps_us = gps_us;
+  model->samples[model->next].host_us = arrival_t;
+  model->next = (model->next + 1) % CLOCK_MODEL_WINDOW;
+  if (model->count < CLOCK_MODEL_WINDOW) {
+    model->count++;
+  }
+  clock_model_fit(model);
+}
+
+uint64_t clock_model_host_time(const clock_model_t *model, uint32_t itow_ms,
+                               uint64_t arrival_t) {
+  if (!model->valid) {
+    return arrival_t;
+  }
+  int64_t gps_us = clock_model_gps_us(model, itow_ms);
+  return model->host_ref +
+         (int64_t)llround(model->offset_us +
+                          model->slope * (double)(gps_us - model->gps_ref));
+}
+
+void clock_model_add_latency(clock_model_t *model, uint64_t latency_us) {
+  clock_latency_t *latency = &model->latency;
+  int bin = latency_us / CLOCK_LATENCY_BIN_US;
+  latency->bins[bin < CLOCK_LATENCY_BINS ? bin : CLOCK_LATENCY_BINS - 1]++;
+  latency->count++;
+  latency->sum_us += latency_us;
+  if (latency_us > latency->max_us) {
+    latency->max_us = latency_us;
+  }
+}
+
+void clock_model_reset_latency(clock_model_t *model) {
+  memset(&model->latency, 0, sizeof(clock_latency_t));
+}
+
+int clock_model_write_latency(const clock_model_t *model, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror("Could not write latency histogram");
+    return -1;
+  }
+  fprintf(file, "latency_us,count\n");
+  for (int i = 0; i < CLOCK_LATENCY_BINS; i++) {
+    fprintf(file, "%d,%" PRIu64 "\n", i * CLOCK_LATENCY_BIN_US,
+            model->latency.bins[i]);
+  }
+  fclose(file);
+  return 0;
+}
+
+// Smallest latency with at least the given fraction of the samples below
+static uint64_t clock_latency_percentile(const clock_latency_t *latency,
+                                         double fraction) {
+  uint64_t target = ceil(latency->count * fraction);
+  uint64_t total = 0;
+  for (int i = 0; i < CLOCK_LATENCY_BINS; i++) {
+    total += latency->bins[i];
+    if (total >= target) {
+      return (uint64_t)(i + 1) * CLOCK_LATENCY_BIN_US;
+    }
+  }
+  return latency->max_us;
+}
+
+void clock_model_report(const clock_model_t *model, const char *name,
+                        FILE *file) {
+  const clock_latency_t *latency = &model->latency;
+  if (latency->count == 0) {
+    return;
+  }
+  fprintf(file,
+          "clock %s: skew %+.1f ppm, %" PRIu64 " resets, latency mean %.2f "
+          "ms p50 <%.1f ms p99 <%.1f ms max %.2f ms\n",
+          name, (model->slope - 1.0) * 1e6, model->resets,
+          latency->sum_us * 1e-3 / latency->count,
+          clock_latency_percentile(latency, 0.5) * 1e-3,
+          clock_latency_percentile(latency, 0.99) * 1e-3,
+          latency->max_us * 1e-3);
+}
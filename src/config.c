@@ -0,0 +1,108 @@
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static char *trim(char *s) {
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1])) {
+    end--;
+  }
+  *end = '\0';
+  return s;
+}
+
+int config_parse(const char *path, config_handler_t handler, void *user) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  char line[512];
+  char section[128] = "";
+  int line_number = 0;
+  int errors = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+    char *comment = strpbrk(line, "#;");
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char *s = trim(line);
+    if (*s == '\0') {
+      continue;
+    }
+
+    if (*s == '[') {
+      char *end = strchr(s, ']');
+      if (end == NULL) {
+        fprintf(stderr, "%s:%d: invalid section\n", path, line_number);
+        errors++;
+        continue;
+      }
+      *end = '\0';
+      snprintf(section, sizeof(section), "%s", trim(s + 1));
+      continue;
+    }
+
+    char *eq = strchr(s, '=');
+    if (eq == NULL) {
+      fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+      errors++;
+      continue;
+    }
+    *eq = '\0';
+    char *key = trim(s);
+    char *value = trim(eq + 1);
+    if (handler(user, section, key, value) == -1) {
+      fprintf(stderr, "%s:%d: invalid %s%s%s = %s\n", path, line_number,
+              section, *section ? "." : "", key, value);
+      errors++;
+    }
+  }
+  fclose(file);
+  return errors;
+}
+
+int config_int(const char *value, int *out) {
+  char *end;
+  errno = 0;
+  long v = strtol(value, &end, 0);
+  if (errno != 0 || end == value || *end != '\0') {
+    return -1;
+  }
+  *out = (int)v;
+  return 0;
+}
+
+int config_double(const char *value, double *out) {
+  char *end;
+  errno = 0;
+  double v = strtod(value, &end);
+  if (errno != 0 || end == value || *end != '\0') {
+    return -1;
+  }
+  *out = v;
+  return 0;
+}
+
+int config_bool(const char *value, int *out) {
+  if (strcasecmp(value, "1") == 0 || strcasecmp(value, "true") == 0 ||
+      strcasecmp(value, "yes") == 0 || strcasecmp(value, "on") == 0) {
+    *out = 1;
+    return 0;
+  }
+  if (strcasecmp(value, "0") == 0 || strcasecmp(value, "false") == 0 ||
+      strcasecmp(value, "no") == 0 || strcasecmp(value, "off") == 0) {
+    *out = 0;
+    return 0;
+  }
+  return -1;
+}
@@ -0,0 +1,212 @@
+#include "dispatch.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *policy_names[DISPATCH_POLICY_SIZE] = {
+    "ignore",
+    "log_raw",
+    "parse_log",
+    "parse_only",
+};
+
+const char *dispatch_policy_to_string(dispatch_policy_t policy) {
+  if ((int)policy < 0 || policy >= DISPATCH_POLICY_SIZE) {
+    return "unknown";
+  }
+  return policy_names[policy];
+}
+
+static int dispatch_protocol_from_string(const char *name) {
+  if (strcasecmp(name, "NMEA") == 0) {
+    return GPS_PROTOCOL_TYPE_NMEA;
+  }
+  if (strcasecmp(name, "UBX") == 0) {
+    return GPS_PROTOCOL_TYPE_UBX;
+  }
+  return -1;
+}
+
+static int dispatch_policy_from_string(const char *name) {
+  for (int i = 0; i < DISPATCH_POLICY_SIZE; i++) {
+    if (strcasecmp(name, policy_names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void dispatch_init(dispatch_table_t *table, dispatch_policy_t policy) {
+  memset(table, 0, sizeof(dispatch_table_t));
+  table->byte_budget = DISPATCH_BYTE_BUDGET;
+  for (int p = 0; p < GPS_PROTOCOL_TYPE_SIZE; p++) {
+    for (int m = 0; m < DISPATCH_MAX_MESSAGES; m++) {
+      table->entries[p][m].policy = policy;
+    }
+  }
+  // Cones are computed from it, it is always decoded
+  table->entries[GPS_PROTOCOL_TYPE_UBX][GPS_UBX_TYPE_NAV_HPPOSLLH].policy =
+      DISPATCH_PARSE_LOG;
+}
+
+int dispatch_set(dispatch_table_t *table, int protocol, int message,
+                 dispatch_policy_t policy, uint32_t min_interval_us) {
+  if (protocol < 0 || protocol >= GPS_PROTOCOL_TYPE_SIZE || message < 0 ||
+      message >= DISPATCH_MAX_MESSAGES) {
+    fprintf(stderr, "Invalid message %d:%d\n", protocol, message);
+    return -1;
+  }
+  if (protocol == GPS_PROTOCOL_TYPE_UBX &&
+      message == GPS_UBX_TYPE_NAV_HPPOSLLH &&
+      (policy == DISPATCH_IGNORE || policy == DISPATCH_LOG_RAW)) {
+    fprintf(stderr, "NAV-HPPOSLLH must be parsed\n");
+    return -1;
+  }
+  table->entries[protocol][message].policy = policy;
+  table->entries[protocol][message].min_interval_us = min_interval_us;
+  return 0;
+}
+
+int dispatch_load(dispatch_table_t *table, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  char line[256];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+
+    unsigned int budget;
+    if (sscanf(line, "budget %u", &budget) == 1) {
+      table->byte_budget = budget;
+      continue;
+    }
+
+    char protocol_name[32], policy_name[32];
+    int message;
+    unsigned int min_interval_us = 0;
+    int res = sscanf(line, "%31s %d %31s %u", protocol_name, &message,
+                     policy_name, &min_interval_us);
+    int protocol = dispatch_protocol_from_string(protocol_name);
+    int policy = dispatch_policy_from_string(policy_name);
+    if (res < 3 || protocol == -1 || policy == -1 ||
+        dispatch_set(table, protocol, message, policy, min_interval_us) ==
+            -1) {
+      fprintf(stderr, "Invalid dispatch rule %s:%d\n", path, line_number);
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+// Measures the byte rate of the type from its counters and sets the interval
+// that brings it back within the budget
+static void dispatch_rate_update(dispatch_table_t *table,
+                                 dispatch_entry_t *entry, int protocol,
+                                 int message, uint64_t t) {
+  if (entry->window_t == 0) {
+    entry->window_t = t;
+  }
+  if (t - entry->window_t < DISPATCH_RATE_WINDOW_US) {
+    return;
+  }
+  uint64_t count = entry->count - entry->window_count;
+  uint64_t bytes = entry->bytes - entry->window_bytes;
+  double rate = bytes * 1e6 / (t - entry->window_t);
+  uint32_t interval = 0;
+  // Cones and laps are computed from NAV-HPPOSLLH, it is never decimated
+  int exempt = protocol == GPS_PROTOCOL_TYPE_UBX &&
+               message == GPS_UBX_TYPE_NAV_HPPOSLLH;
+  if (!exempt && table->byte_budget != 0 && count > 0 &&
+      rate > table->byte_budget) {
+    // One message of the average size for each budget worth of bytes
+    interval = 1e6 * bytes / ((double)count * table->byte_budget);
+  }
+  if (interval != 0 && entry->auto_interval_us == 0) {
+    printf("Message %d:%d at %.0f B/s, decimated to one every %" PRIu32
+           " us\n",
+           protocol, message, rate, interval);
+  }
+  entry->auto_interval_us = interval;
+  entry->window_t = t;
+  entry->window_count = entry->count;
+  entry->window_bytes = entry->bytes;
+}
+
+int dispatch_message(dispatch_table_t *table,
+                     const gps_protocol_and_message *match, int source,
+                     int size, int logging, uint64_t t) {
+  if ((int)match->protocol < 0 ||
+      match->protocol >= GPS_PROTOCOL_TYPE_SIZE ||
+      match->message < 0 || match->message >= DISPATCH_MAX_MESSAGES) {
+    return DISPATCH_PARSE | (logging ? DISPATCH_LOG : 0);
+  }
+  dispatch_entry_t *entry = &table->entries[match->protocol][match->message];
+  entry->count++;
+  entry->bytes += size;
+  dispatch_rate_update(table, entry, match->protocol, match->message, t);
+
+  int actions = 0;
+  switch (entry->policy) {
+  case DISPATCH_IGNORE:
+    return 0;
+  case DISPATCH_LOG_RAW:
+    actions = DISPATCH_RAW;
+    break;
+  case DISPATCH_PARSE_LOG:
+    actions = DISPATCH_PARSE | DISPATCH_LOG;
+    break;
+  case DISPATCH_PARSE_ONLY:
+    actions = DISPATCH_PARSE;
+    break;
+  default:
+    break;
+  }
+  if (actions & DISPATCH_PARSE) {
+    entry->parsed++;
+  }
+
+  if (!logging) {
+    return actions & DISPATCH_PARSE;
+  }
+  if (actions & (DISPATCH_LOG | DISPATCH_RAW)) {
+    if (source < 0 || source >= DISPATCH_MAX_SOURCES) {
+      source = 0;
+    }
+    uint32_t interval = entry->min_interval_us > entry->auto_interval_us
+                            ? entry->min_interval_us
+                            : entry->auto_interval_us;
+    if (interval != 0 && t - entry->last_logged_t[source] < interval) {
+      entry->decimated++;
+      return actions & DISPATCH_PARSE;
+    }
+    entry->last_logged_t[source] = t;
+    entry->logged++;
+  }
+  return actions;
+}
+
+void dispatch_report(const dispatch_table_t *table, FILE *file) {
+  fprintf(file, "protocol,message,policy,count,bytes,parsed,logged,"
+                "decimated,auto_interval_us\n");
+  for (int p = 0; p < GPS_PROTOCOL_TYPE_SIZE; p++) {
+    for (int m = 0; m < DISPATCH_MAX_MESSAGES; m++) {
+      const dispatch_entry_t *entry = &table->entries[p][m];
+      if (entry->count == 0) {
+        continue;
+      }
+      fprintf(file,
+              "%d,%d,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+              ",%" PRIu64 ",%" PRIu32 "\n",
+              p, m, dispatch_policy_to_string(entry->policy), entry->count,
+              entry->bytes, entry->parsed, entry->logged, entry->decimated,
+              entry->auto_interval_us);
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#include "fault.h"
+#include "defines.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+void fault_init(fault_manager_t *manager) {
+  memset(manager, 0, sizeof(fault_manager_t));
+}
+
+void fault_raise(fault_manager_t *manager, acr_error_t error) {
+  __atomic_fetch_or(&manager->pending, 1u << error, __ATOMIC_RELEASE);
+}
+
+int fault_update(fault_manager_t *manager, uint64_t t) {
+  if (__atomic_load_n(&manager->pending, __ATOMIC_RELAXED) == 0) {
+    return manager->active_count;
+  }
+  uint32_t pending = __atomic_exchange_n(&manager->pending, 0, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < ERORR_SIZE; i++) {
+    fault_t *fault = &manager->faults[i];
+    if (!(pending & (1u << i)) || fault->active) {
+      continue;
+    }
+    fault->active = 1;
+    fault->start_t = t;
+    fault->backoff_us = FAULT_BACKOFF_MIN_US;
+    fault->retry_t = t + fault->backoff_us;
+    fault->attempts = 0;
+    fault->count++;
+    manager->active_count++;
+    printf("Fault: %s\n", error_to_string(i));
+  }
+  return manager->active_count;
+}
+
+int fault_active(const fault_manager_t *manager, acr_error_t error) {
+  return manager->faults[error].active;
+}
+
+int fault_retry(fault_manager_t *manager, acr_error_t error, uint64_t t) {
+  fault_t *fault = &manager->faults[error];
+  if (!fault->active || t < fault->retry_t) {
+    return 0;
+  }
+  fault->attempts++;
+  fault->backoff_us *= 2;
+  if (fault->backoff_us > FAULT_BACKOFF_MAX_US) {
+    fault->backoff_us = FAULT_BACKOFF_MAX_US;
+  }
+  fault->retry_t = t + fault->backoff_us;
+  return 1;
+}
+
+void fault_clear(fault_manager_t *manager, acr_error_t error, uint64_t t,
+                 const char *dir) {
+  fault_t *fault = &manager->faults[error];
+  if (!fault->active) {
+    return;
+  }
+  fault->active = 0;
+  manager->active_count--;
+  printf("Recovered: %s in %.1f ms, %d attempts\n", error_to_string(error),
+         (t - fault->start_t) * 1e-3, fault->attempts);
+
+  char path[2048];
+  snprintf(path, 2048, "%s/faults.csv", dir);
+  FILE *file = fopen(path, "a");
+  if (file == NULL) {
+    perror("Could not open faults file");
+    return;
+  }
+  if (ftell(file) == 0) {
+    fprintf(file, "error,error_name,start_timestamp,end_timestamp,"
+                  "duration,attempts\n");
+  }
+  fprintf(file, "%d,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d\n", error,
+          error_to_string(error), fault->start_t, t, t - fault->start_t,
+          fault->attempts);
+  fclose(file);
+}
+
+acr_error_t fault_first(const fault_manager_t *manager) {
+  for (int i = 0; i < ERORR_SIZE; i++) {
+    if (manager->faults[i].active) {
+      return i;
+    }
+  }
+  return ERORR_SIZE;
+}
@@ -0,0 +1,255 @@
+#include "geofence.h"
+#include "config.h"
+#include "utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void geofence_rectangle(geofence_track_t *track, const char *name,
+                               double lat_min, double lon_min, double lat_max,
+                               double lon_max) {
+  snprintf(track->name, sizeof(track->name), "%s", name);
+  track->count = 4;
+  track->lat[0] = lat_min;
+  track->lon[0] = lon_min;
+  track->lat[1] = lat_min;
+  track->lon[1] = lon_max;
+  track->lat[2] = lat_max;
+  track->lon[2] = lon_max;
+  track->lat[3] = lat_max;
+  track->lon[3] = lon_min;
+}
+
+void geofence_config_default(geofence_config_t *config) {
+  memset(config, 0, sizeof(geofence_config_t));
+  config->margin_m = 5.0;
+  config->enter_s = 3.0;
+  config->exit_s = 10.0;
+  geofence_rectangle(&config->tracks[0], "povo", 46.0658863580000002,
+                     11.1484815430000008, 46.0689583580000033,
+                     11.1515535430000003);
+  geofence_rectangle(&config->tracks[1], "vadena", 46.4300119620000018,
+                     11.3097566090000008, 46.4382039620000029,
+                     11.3169246090000009);
+  geofence_rectangle(&config->tracks[2], "fsg", 49.32344089057215,
+                     8.558931763076039, 49.335430701657735,
+                     8.595726757113576);
+  geofence_rectangle(&config->tracks[3], "ala", 45.784567764275764,
+                     11.010747212958533, 45.78713363420464,
+                     11.013506837511347);
+  geofence_rectangle(&config->tracks[4], "varano", 44.67756187921092,
+                     10.013347232876077, 44.684102509035036,
+                     10.031744729894845);
+  config->track_count = 5;
+}
+
+static geofence_track_t *geofence_track_get(geofence_config_t *config,
+                                            const char *name) {
+  for (int i = 0; i < config->track_count; i++) {
+    if (strcmp(config->tracks[i].name, name) == 0) {
+      return &config->tracks[i];
+    }
+  }
+  if (config->track_count >= GEOFENCE_MAX_TRACKS) {
+    return NULL;
+  }
+  geofence_track_t *track = &config->tracks[config->track_count++];
+  memset(track, 0, sizeof(geofence_track_t));
+  snprintf(track->name, sizeof(track->name), "%s", name);
+  return track;
+}
+
+int geofence_config_handler(void *user, const char *section, const char *key,
+                            const char *value) {
+  geofence_config_t *config = (geofence_config_t *)user;
+  if (strcmp(section, "geofence") == 0) {
+    if (strcmp(key, "enabled") == 0) {
+      return config_bool(value, &config->enabled);
+    }
+    if (strcmp(key, "margin_m") == 0) {
+      return config_double(value, &config->margin_m);
+    }
+    if (strcmp(key, "enter_s") == 0) {
+      return config_double(value, &config->enter_s);
+    }
+    if (strcmp(key, "exit_s") == 0) {
+      return config_double(value, &config->exit_s);
+    }
+    return -1;
+  }
+  if (strncmp(section, "track.", 6) != 0) {
+    return 0;
+  }
+
+  geofence_track_t *track = geofence_track_get(config, section + 6);
+  if (track == NULL) {
+    return -1;
+  }
+  if (strcmp(key, "bounds") == 0) {
+    double lat_min, lon_min, lat_max, lon_max;
+    if (sscanf(value, "%lf %lf %lf %lf", &lat_min, &lon_min, &lat_max,
+               &lon_max) != 4) {
+      return -1;
+    }
+    geofence_rectangle(track, track->name, lat_min, lon_min, lat_max,
+                       lon_max);
+    return 0;
+  }
+  if (strcmp(key, "point") == 0) {
+    // The first point replaces the default polygon
+    if (!track->has_points) {
+      track->has_points = 1;
+      track->count = 0;
+    }
+    if (track->count >= GEOFENCE_MAX_POINTS ||
+        sscanf(value, "%lf %lf", &track->lat[track->count],
+               &track->lon[track->count]) != 2) {
+      return -1;
+    }
+    track->count++;
+    return 0;
+  }
+  return -1;
+}
+
+const geofence_track_t *geofence_find(const geofence_config_t *config,
+                                      const char *name) {
+  for (int i = 0; i < config->track_count; i++) {
+    if (strcmp(config->tracks[i].name, name) == 0) {
+      return &config->tracks[i];
+    }
+  }
+  return NULL;
+}
+
+void geofence_bounds(const geofence_track_t *track, double *lat_min,
+                     double *lon_min, double *lat_max, double *lon_max) {
+  *lat_min = *lon_min = INFINITY;
+  *lat_max = *lon_max = -INFINITY;
+  for (int i = 0; i < track->count; i++) {
+    *lat_min = fmin(*lat_min, track->lat[i]);
+    *lon_min = fmin(*lon_min, track->lon[i]);
+    *lat_max = fmax(*lat_max, track->lat[i]);
+    *lon_max = fmax(*lon_max, track->lon[i]);
+  }
+}
+
+void geofence_init(geofence_t *geofence, const geofence_config_t *config) {
+  memset(geofence, 0, sizeof(geofence_t));
+  geofence->config = *config;
+  geofence->current = -1;
+  geofence->crossing_track = -1;
+
+  for (int k = 0; k < geofence->config.track_count; k++) {
+    geofence_track_t *track = &geofence->config.tracks[k];
+    track->min_x = track->min_y = INFINITY;
+    track->max_x = track->max_y = -INFINITY;
+    for (int i = 0; i < track->count; i++) {
+      latlon_to_local(track->lat[0], track->lon[0], track->lat[i],
+                      track->lon[i], &track->x[i], &track->y[i]);
+      track->min_x = fmin(track->min_x, track->x[i]);
+      track->min_y = fmin(track->min_y, track->y[i]);
+      track->max_x = fmax(track->max_x, track->x[i]);
+      track->max_y = fmax(track->max_y, track->y[i]);
+    }
+  }
+}
+
+static double geofence_segment_distance(double px, double py, double ax,
+                                        double ay, double bx, double by) {
+  double dx = bx - ax, dy = by - ay;
+  double length = dx * dx + dy * dy;
+  double f = length > 0.0 ? ((px - ax) * dx + (py - ay) * dy) / length : 0.0;
+  f = f < 0.0 ? 0.0 : (f > 1.0 ? 1.0 : f);
+  return hypot(px - (ax + f * dx), py - (ay + f * dy));
+}
+
+// 1 inside, 0 outside, -1 within the margin of the border
+static int geofence_side(const geofence_t *geofence, int k, double lat,
+                         double lon) {
+  const geofence_track_t *track = &geofence->config.tracks[k];
+  double margin = geofence->config.margin_m;
+  if (track->count < 3) {
+    return 0;
+  }
+  double x, y;
+  latlon_to_local(track->lat[0], track->lon[0], lat, lon, &x, &y);
+  if (x < track->min_x - margin || x > track->max_x + margin ||
+      y < track->min_y - margin || y > track->max_y + margin) {
+    return 0;
+  }
+
+  int inside = 0;
+  double distance = INFINITY;
+  for (int i = 0, j = track->count - 1; i < track->count; j = i++) {
+    if ((track->y[i] > y) != (track->y[j] > y) &&
+        x < (track->x[j] - track->x[i]) * (y - track->y[i]) /
+                    (track->y[j] - track->y[i]) +
+                track->x[i]) {
+      inside = !inside;
+    }
+    distance = fmin(distance,
+                    geofence_segment_distance(x, y, track->x[j], track->y[j],
+                                              track->x[i], track->y[i]));
+  }
+  return distance < margin ? -1 : inside;
+}
+
+geofence_event_t geofence_update(geofence_t *geofence, double lat, double lon,
+                                 uint64_t t) {
+  if (!geofence->config.enabled) {
+    return GEOFENCE_NONE;
+  }
+
+  if (geofence->inside) {
+    // Only the current track matters until it is left
+    if (geofence_side(geofence, geofence->current, lat, lon) != 0) {
+      geofence->crossing_t = 0;
+      return GEOFENCE_NONE;
+    }
+    if (geofence->crossing_t == 0) {
+      geofence->crossing_t = t;
+    }
+    if (t - geofence->crossing_t < geofence->config.exit_s * 1e6) {
+      return GEOFENCE_NONE;
+    }
+    geofence->inside = 0;
+    geofence->crossing_t = 0;
+    return GEOFENCE_EXIT;
+  }
+
+  int found = -1;
+  if (geofence->crossing_track != -1 &&
+      geofence_side(geofence, geofence->crossing_track, lat, lon) == 1) {
+    found = geofence->crossing_track;
+  }
+  for (int k = 0; found == -1 && k < geofence->config.track_count; k++) {
+    if (geofence_side(geofence, k, lat, lon) == 1) {
+      found = k;
+    }
+  }
+  if (found == -1) {
+    geofence->crossing_t = 0;
+    geofence->crossing_track = -1;
+    return GEOFENCE_NONE;
+  }
+  if (geofence->crossing_t == 0 || geofence->crossing_track != found) {
+    geofence->crossing_t = t;
+    geofence->crossing_track = found;
+  }
+  if (t - geofence->crossing_t < geofence->config.enter_s * 1e6) {
+    return GEOFENCE_NONE;
+  }
+  geofence->inside = 1;
+  geofence->current = found;
+  geofence->crossing_t = 0;
+  return GEOFENCE_ENTER;
+}
+
+const char *geofence_track_name(const geofence_t *geofence) {
+  return geofence->current == -1
+             ? "-"
+             : geofence->config.tracks[geofence->current].name;
+}
@@ -2,6 +2,10 @@
 #include "defines.h"
 #include "utils.h"
 
+static pins_config_t gpio_pins;
+
+void gpio_configure(const pins_config_t *pins) { gpio_pins = *pins; }
+
 #ifdef ACR_NO_PIGPIO
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,15 +31,14 @@ int setNonBlocking(int fd) {
 }
 
 char pinToKey(int pin) {
-    switch(pin) {
-        case P_BTN_YL:
-            return 'y';
-        case P_BTN_BL:
-            return 'b';
-        case P_BTN_OR:
-            return 'o';
-        case P_BTN_MODE:
-            return 'm';
+    if (pin == gpio_pins.button_yellow) {
+        return 'y';
+    } else if (pin == gpio_pins.button_blue) {
+        return 'b';
+    } else if (pin == gpio_pins.button_orange) {
+        return 'o';
+    } else if (pin == gpio_pins.button_mode) {
+        return 'm';
     }
     return ' ';
 }
@@ -83,6 +86,9 @@ int gpioSetMode(int pin, int mode){
     (void)mode;
     return 0;
 }
+uint32_t gpioTick(){
+    return (uint32_t)get_t();
+}
 int gpioSetPullUpDown(int pin, int pud){
     (void)pin;
     (void)pud;
@@ -96,20 +102,3 @@ void gpioSetAlertFuncEx(int pin, eventFuncEx_t func, void *user_data) {
 }
 
 #endif // ACR_NO_PIGPIO
-
-typedef struct deb_t {
-    int state;
-    uint64_t t;
-}deb_t;
-static deb_t debounce_pins[MAX_PINS];
-
-int gpioSkipForDebounce(int pin, int state) {
-    int ret = 0;
-    debounce_pins[pin].state = state;
-
-    if(get_t() - debounce_pins[pin].t < DEBOUNCE_US) {
-        ret = 1;
-    }
-    debounce_pins[pin].t = get_t();
-    return ret;
-}
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "gpio_input.h"
+#include "gpio.h"
+#include "utils.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+int gpio_input_init(gpio_input_t *inputs) {
+  memset(inputs, 0, sizeof(gpio_input_t));
+  inputs->event_fd = eventfd(0, EFD_NONBLOCK);
+  if (inputs->event_fd == -1) {
+    perror("Could not create the GPIO event");
+    return -1;
+  }
+  return 0;
+}
+
+// pigpio alert thread, only queues the edge
+static void gpio_input_alert(int gpio, int level, uint32_t tick, void *user) {
+  (void)gpio;
+  gpio_pin_t *pin = (gpio_pin_t *)user;
+  // Watchdog timeouts carry no edge
+  if (level != 0 && level != 1) {
+    return;
+  }
+  uint32_t head = pin->head;
+  uint32_t tail = __atomic_load_n(&pin->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= GPIO_INPUT_QUEUE_SIZE) {
+    __atomic_add_fetch(&pin->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  pin->queue[head % GPIO_INPUT_QUEUE_SIZE].tick = tick;
+  pin->queue[head % GPIO_INPUT_QUEUE_SIZE].level = level;
+  __atomic_store_n(&pin->head, head + 1, __ATOMIC_RELEASE);
+
+  uint64_t one = 1;
+  if (write(pin->inputs->event_fd, &one, sizeof(one)) == -1) {
+    // Already signalled
+  }
+}
+
+int gpio_input_add(gpio_input_t *inputs, int pin, const char *name,
+                   uint64_t debounce_us) {
+  if (inputs->count >= GPIO_INPUT_MAX) {
+    fprintf(stderr, "Too many GPIO inputs, %s not added\n", name);
+    return -1;
+  }
+  gpio_pin_t *p = &inputs->pins[inputs->count];
+  memset(p, 0, sizeof(gpio_pin_t));
+  p->pin = pin;
+  snprintf(p->name, sizeof(p->name), "%s", name);
+  p->debounce_us = debounce_us;
+  p->inputs = inputs;
+  // Released until the first edge
+  p->level = 1;
+  p->raw_level = 1;
+  p->accepted_tick = gpioTick() - p->debounce_us;
+  p->stats.min_press_us = UINT32_MAX;
+  inputs->count++;
+
+  gpioSetMode(pin, PI_INPUT);
+  gpioSetPullUpDown(pin, PI_PUD_UP);
+  gpioSetAlertFuncEx(pin, gpio_input_alert, p);
+  return 0;
+}
+
+int gpio_input_fd(const gpio_input_t *inputs) { return inputs->event_fd; }
+
+static void gpio_input_accept(gpio_pin_t *p, uint32_t tick, int level,
+                              uint32_t now_tick, uint64_t now_t,
+                              gpio_event_handler_t handler, void *user) {
+  p->level = level;
+  p->accepted_tick = tick;
+  if (level == 0) {
+    p->stats.presses++;
+    p->press_tick = tick;
+  } else {
+    p->stats.releases++;
+    uint32_t press_us = tick - p->press_tick;
+    if (p->stats.presses > 0 && press_us < p->stats.min_press_us) {
+      p->stats.min_press_us = press_us;
+    }
+  }
+  gpio_event_t event;
+  event.pin = p->pin;
+  event.level = level;
+  event.tick = tick;
+  event.t = now_t - (uint32_t)(now_tick - tick);
+  handler(&event, user);
+}
+
+static void gpio_input_bounce(gpio_pin_t *p, uint32_t since_us) {
+  p->stats.bounces++;
+  int bin = since_us / GPIO_INPUT_BOUNCE_BIN_US;
+  if (bin >= GPIO_INPUT_BOUNCE_BINS) {
+    bin = GPIO_INPUT_BOUNCE_BINS - 1;
+  }
+  p->stats.bounce_bins[bin]++;
+  if (since_us > p->stats.max_bounce_us) {
+    p->stats.max_bounce_us = since_us;
+  }
+}
+
+void gpio_input_service(gpio_input_t *inputs, gpio_event_handler_t handler,
+                        void *user) {
+  uint64_t events;
+  if (read(inputs->event_fd, &events, sizeof(events)) == -1) {
+    // Nothing signalled, pending levels are still settled below
+  }
+  uint32_t now_tick = gpioTick();
+  uint64_t now_t = get_t();
+
+  for (int i = 0; i < inputs->count; i++) {
+    gpio_pin_t *p = &inputs->pins[i];
+    uint32_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+    while (p->tail != head) {
+      gpio_edge_t edge = p->queue[p->tail % GPIO_INPUT_QUEUE_SIZE];
+      __atomic_store_n(&p->tail, p->tail + 1, __ATOMIC_RELEASE);
+      p->stats.edges++;
+      p->raw_level = edge.level;
+      p->raw_tick = edge.tick;
+
+      uint32_t since_us = edge.tick - p->accepted_tick;
+      if (since_us < p->debounce_us) {
+        gpio_input_bounce(p, since_us);
+      } else if (edge.level != p->level) {
+        gpio_input_accept(p, edge.tick, edge.level, now_tick, now_t, handler,
+                          user);
+      }
+    }
+
+    // Changed during the window and stable since, e.g. a short tap
+    if (p->raw_level != p->level &&
+        now_tick - p->accepted_tick >= p->debounce_us) {
+      gpio_input_accept(p, p->raw_tick, p->raw_level, now_tick, now_t, handler,
+                        user);
+    }
+  }
+}
+
+int gpio_input_level(const gpio_input_t *inputs, int pin) {
+  for (int i = 0; i < inputs->count; i++) {
+    if (inputs->pins[i].pin == pin) {
+      return inputs->pins[i].level;
+    }
+  }
+  return -1;
+}
+
+// Smallest bounce delay with at least the given fraction of the bounces below
+static uint32_t gpio_bounce_percentile(const gpio_input_stats_t *stats,
+                                       double fraction) {
+  uint64_t target = stats->bounces * fraction + 0.5;
+  uint64_t total = 0;
+  for (int i = 0; i < GPIO_INPUT_BOUNCE_BINS; i++) {
+    total += stats->bounce_bins[i];
+    if (total >= target) {
+      return (i + 1) * GPIO_INPUT_BOUNCE_BIN_US;
+    }
+  }
+  return stats->max_bounce_us;
+}
+
+int gpio_input_write_stats(const gpio_input_t *inputs, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror("Could not write button statistics");
+    return -1;
+  }
+  fprintf(file, "button,pin,debounce_us,edges,presses,releases,bounces,"
+                "dropped,bounce_p99_us,max_bounce_us,min_press_us\n");
+  for (int i = 0; i < inputs->count; i++) {
+    const gpio_pin_t *p = &inputs->pins[i];
+    const gpio_input_stats_t *stats = &p->stats;
+    fprintf(file,
+            "%s,%d,%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+            ",%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+            p->name, p->pin, p->debounce_us, stats->edges, stats->presses,
+            stats->releases, stats->bounces,
+            __atomic_load_n(&p->dropped, __ATOMIC_RELAXED),
+            stats->bounces > 0 ? gpio_bounce_percentile(stats, 0.99) : 0,
+            stats->max_bounce_us,
+            stats->min_press_us == UINT32_MAX ? 0 : stats->min_press_us);
+  }
+  fclose(file);
+  return 0;
+}
+
+void gpio_input_report(const gpio_input_t *inputs, FILE *file) {
+  for (int i = 0; i < inputs->count; i++) {
+    const gpio_pin_t *p = &inputs->pins[i];
+    const gpio_input_stats_t *stats = &p->stats;
+    if (stats->edges == 0) {
+      continue;
+    }
+    fprintf(file,
+            "button %s: %" PRIu64 " presses, %" PRIu64 " bounces (max %.1f ms,"
+            " window %.1f ms), shortest press %.1f ms, %" PRIu64
+            " dropped\n",
+            p->name, stats->presses, stats->bounces,
+            stats->max_bounce_us * 1e-3, p->debounce_us * 1e-3,
+            stats->min_press_us == UINT32_MAX ? 0.0
+                                              : stats->min_press_us * 1e-3,
+            __atomic_load_n(&p->dropped, __ATOMIC_RELAXED));
+  }
+}
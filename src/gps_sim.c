@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ubx_cfg.h"
+#include "utils.h"
+
+#define SIM_MAX_EPOCH_SIZE (64 * 1024)
+// Largest sentence and frame of a synthetic epoch
+#define SIM_NMEA_MAX_SIZE (1 + 128 + 5)
+#define SIM_UBX_PVT_SIZE (8 + 92)
+// NAV-HPPOSLLH
+#define SIM_EPOCH_RESERVED (1024)
+// Acknowledgements of the configuration, queued apart from the epochs
+#define SIM_ACK_SIZE (1024)
+#define SIM_REPORT_US (1000000)
+
+// Povo track, used as centre of the synthetic trajectory
+#define SIM_CENTER_LAT (46.0674223580)
+#define SIM_CENTER_LON (11.1500175430)
+#define SIM_RADIUS_M (40.0)
+#define SIM_SPEED_MS (1.5)
+
+typedef struct sim_options_t {
+  double rate_hz;
+  double ramp_step_hz;
+  double ramp_period_s;
+  double duration_s;
+  int nmea_per_epoch;
+  int ubx_per_epoch;
+  const char *replay_path;
+  const char *link_path;
+} sim_options_t;
+
+typedef struct sim_stats_t {
+  uint64_t epochs;
+  uint64_t sent;
+  uint64_t dropped;
+  uint64_t late;
+  uint64_t bytes;
+  uint64_t max_late_us;
+} sim_stats_t;
+
+typedef struct sim_replay_t {
+  unsigned char *data;
+  size_t size;
+  size_t offset;
+} sim_replay_t;
+
+static volatile sig_atomic_t sim_stop = 0;
+
+static void sim_sig_handler(int signum) {
+  (void)signum;
+  sim_stop = 1;
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  -r <hz>    NAV-HPPOSLLH rate (default 10)\n");
+  printf("  -s <hz>    increase the rate by this step every ramp period\n");
+  printf("  -p <s>     ramp period (default 5)\n");
+  printf("  -t <s>     stop after this many seconds\n");
+  printf("  -n <count> NMEA sentences for each epoch (default 0)\n");
+  printf("  -u <count> extra UBX NAV-PVT messages for each epoch (default 0)\n");
+  printf("  -f <file>  replay a raw receiver log instead of the synthetic "
+         "track\n");
+  printf("  -l <path>  symlink to the pseudo terminal (e.g. /tmp/ttyACR)\n");
+}
+
+static int nmea_gga(char *out, uint32_t itow, double lat, double lon,
+                    double height) {
+  uint32_t s = (itow / 1000) % 86400;
+  double lat_min = (lat - floor(lat)) * 60.0;
+  double lon_min = (lon - floor(lon)) * 60.0;
+  char body[128];
+  snprintf(body, sizeof(body),
+           "GNGGA,%02u%02u%02u.%02u,%02d%010.7f,N,%03d%010.7f,E,4,12,0.50,"
+           "%.3f,M,47.000,M,1.0,0000",
+           s / 3600, (s / 60) % 60, s % 60, (itow % 1000) / 10, (int)lat,
+           lat_min, (int)lon, lon_min, height);
+  unsigned char cs = 0;
+  for (char *c = body; *c; c++) {
+    cs ^= *c;
+  }
+  return sprintf(out, "$%s*%02X\r\n", body, cs);
+}
+
+static int replay_load(sim_replay_t *replay, const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror("Could not open replay file");
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  replay->data = malloc(size > 0 ? size : 1);
+  replay->size = fread(replay->data, 1, size, file);
+  replay->offset = 0;
+  fclose(file);
+  if (replay->size == 0) {
+    fprintf(stderr, "Replay file %s is empty\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+// Bytes of the log up to and including the next NAV-HPPOSLLH frame
+static int replay_epoch(sim_replay_t *replay, unsigned char *out) {
+  size_t start = replay->offset;
+  size_t i = start;
+  while (i + 8 <= replay->size && i - start < SIM_MAX_EPOCH_SIZE - 1024) {
+    const unsigned char *p = replay->data + i;
+    if (p[0] == 0xB5 && p[1] == 0x62) {
+      size_t len = 8 + (p[4] | (p[5] << 8));
+      if (i + len > replay->size) {
+        break;
+      }
+      i += len;
+      if (p[2] == 0x01 && p[3] == 0x14) {
+        break;
+      }
+    } else {
+      i++;
+    }
+  }
+  if (i + 8 > replay->size) {
+    i = replay->size;
+  }
+
+  size_t size = i - start;
+  memcpy(out, replay->data + start, size);
+  replay->offset = i >= replay->size ? 0 : i;
+  return size;
+}
+
+static int synthetic_epoch(unsigned char *out, const sim_options_t *opt,
+                           uint64_t elapsed_us) {
+  double angle = SIM_SPEED_MS / SIM_RADIUS_M * elapsed_us * 1e-6;
+  uint32_t itow = (uint32_t)((elapsed_us / 1000) % (7 * 86400 * 1000));
+
+  double lat = SIM_CENTER_LAT +
+               SIM_RADIUS_M * sin(angle) / 6378137.0 * 180.0 / M_PI;
+  double lon = SIM_CENTER_LON + SIM_RADIUS_M * cos(angle) / 6378137.0 *
+                                    180.0 / M_PI /
+                                    cos(SIM_CENTER_LAT * M_PI / 180.0);
+  double height = 420.0;
+
+  int size = 0;
+  for (int i = 0; i < opt->nmea_per_epoch; i++) {
+    size += nmea_gga((char *)out + size, itow, lat, lon, height);
+  }
+  for (int i = 0; i < opt->ubx_per_epoch; i++) {
+    size += ubx_pvt_build(out + size, itow);
+  }
+  size += ubx_hpposllh_build(out + size, itow, lat, lon, height);
+  return size;
+}
+
+static void report(const sim_stats_t *stats, double rate_hz, const char *tag) {
+  printf("%s rate %.1f Hz: epochs %" PRIu64 " sent %" PRIu64
+         " dropped %" PRIu64 " late %" PRIu64 " (max %.1f ms) bytes %" PRIu64
+         "\n",
+         tag, rate_hz, stats->epochs, stats->sent, stats->dropped, stats->late,
+         stats->max_late_us * 1e-3, stats->bytes);
+  fflush(stdout);
+}
+
+static int open_pty(const sim_options_t *opt) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+    perror("Could not open pseudo terminal");
+    return -1;
+  }
+  struct termios tio;
+  tcgetattr(master, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(master, TCSANOW, &tio);
+
+  const char *slave = ptsname(master);
+  printf("Pseudo terminal: %s\n", slave);
+  if (opt->link_path) {
+    unlink(opt->link_path);
+    if (symlink(slave, opt->link_path) == -1) {
+      perror("Could not create link");
+    } else {
+      printf("Linked to: %s\n", opt->link_path);
+    }
+  }
+  return master;
+}
+
+// Until someone opens the slave the master reports a hangup
+static void wait_reader(int master, const sim_options_t *opt,
+                        uint64_t start_t) {
+  printf("Waiting for a reader\n");
+  struct pollfd pfd = {.fd = master, .events = POLLOUT};
+  while (!sim_stop) {
+    if (opt->duration_s > 0.0 && get_t() - start_t > opt->duration_s * 1e6) {
+      sim_stop = 1;
+      break;
+    }
+    poll(&pfd, 1, 100);
+    if (!(pfd.revents & POLLHUP)) {
+      break;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  sim_options_t opt;
+  memset(&opt, 0, sizeof(sim_options_t));
+  opt.rate_hz = 10.0;
+  opt.ramp_period_s = 5.0;
+
+  int c;
+  while ((c = getopt(argc, argv, "r:s:p:t:n:u:f:l:h")) != -1) {
+    switch (c) {
+    case 'r':
+      opt.rate_hz = atof(optarg);
+      break;
+    case 's':
+      opt.ramp_step_hz = atof(optarg);
+      break;
+    case 'p':
+      opt.ramp_period_s = atof(optarg);
+      break;
+    case 't':
+      opt.duration_s = atof(optarg);
+      break;
+    case 'n':
+      opt.nmea_per_epoch = atoi(optarg);
+      break;
+    case 'u':
+      opt.ubx_per_epoch = atoi(optarg);
+      break;
+    case 'f':
+      opt.replay_path = optarg;
+      break;
+    case 'l':
+      opt.link_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (opt.rate_hz <= 0.0 || opt.nmea_per_epoch < 0 || opt.ubx_per_epoch < 0) {
+    usage(argv[0]);
+    return -1;
+  }
+  // An epoch must fit in the epoch buffer
+  int max_nmea = (SIM_MAX_EPOCH_SIZE - SIM_EPOCH_RESERVED) / SIM_NMEA_MAX_SIZE;
+  if (opt.nmea_per_epoch > max_nmea) {
+    opt.nmea_per_epoch = max_nmea;
+    printf("NMEA sentences limited to %d for each epoch\n", max_nmea);
+  }
+  int max_ubx = (SIM_MAX_EPOCH_SIZE - SIM_EPOCH_RESERVED -
+                 opt.nmea_per_epoch * SIM_NMEA_MAX_SIZE) /
+                SIM_UBX_PVT_SIZE;
+  if (opt.ubx_per_epoch > max_ubx) {
+    opt.ubx_per_epoch = max_ubx;
+    printf("UBX messages limited to %d for each epoch\n", max_ubx);
+  }
+
+  sim_replay_t replay;
+  if (opt.replay_path && replay_load(&replay, opt.replay_path) == -1) {
+    return -1;
+  }
+
+  signal(SIGINT, sim_sig_handler);
+  signal(SIGTERM, sim_sig_handler);
+
+  int master = open_pty(&opt);
+  if (master == -1) {
+    return -1;
+  }
+
+  wait_reader(master, &opt, get_t());
+
+  static unsigned char epoch_buffer[SIM_MAX_EPOCH_SIZE];
+  unsigned char ack_buffer[SIM_ACK_SIZE];
+  unsigned char rx[1024];
+  int rx_size = 0;
+  size_t pending = 0;
+  size_t written = 0;
+  size_t ack_pending = 0;
+  size_t ack_written = 0;
+  uint64_t epoch_t = 0;
+
+  sim_stats_t total, window;
+  memset(&total, 0, sizeof(sim_stats_t));
+  memset(&window, 0, sizeof(sim_stats_t));
+
+  double rate_hz = opt.rate_hz;
+  double sustained_hz = 0.0;
+  uint64_t start_t = get_t();
+  uint64_t ramp_t = start_t;
+  uint64_t report_t = start_t;
+  uint64_t deadline = start_t;
+
+  while (!sim_stop) {
+    uint64_t now = get_t();
+    if (opt.duration_s > 0.0 && now - start_t > opt.duration_s * 1e6) {
+      break;
+    }
+
+    if (now >= deadline) {
+      uint64_t period = 1e6 / rate_hz;
+      window.epochs++;
+      if (pending > written) {
+        // The reader did not drain the previous epoch in time
+        window.dropped++;
+      } else {
+        if (opt.replay_path) {
+          pending = replay_epoch(&replay, epoch_buffer);
+        } else {
+          pending = synthetic_epoch(epoch_buffer, &opt, deadline - start_t);
+        }
+        written = 0;
+        epoch_t = deadline;
+        window.sent++;
+      }
+      deadline += period;
+      // Do not try to catch up after a long stall
+      if (deadline + period < now) {
+        deadline = now + period;
+      }
+    }
+
+    // Never interleave a started frame with another one: an acknowledgement
+    // goes out between epochs, and an epoch waits for a started one
+    int ack = ack_pending > ack_written &&
+              (ack_written > 0 || pending == written);
+    if (ack || pending > written) {
+      ssize_t res = ack ? write(master, ack_buffer + ack_written,
+                                ack_pending - ack_written)
+                        : write(master, epoch_buffer + written,
+                                pending - written);
+      if (res > 0) {
+        window.bytes += res;
+        if (ack) {
+          ack_written += res;
+          if (ack_written == ack_pending) {
+            ack_pending = 0;
+            ack_written = 0;
+          }
+        } else {
+          written += res;
+          // Late when the reader drained the epoch after half a period
+          uint64_t delay = get_t() - epoch_t;
+          if (written == pending && delay > 5e5 / rate_hz) {
+            window.late++;
+          }
+          if (written == pending && delay > window.max_late_us) {
+            window.max_late_us = delay;
+          }
+        }
+      } else if (res == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("Write failed");
+        break;
+      }
+    }
+
+    // Acknowledge the configuration messages sent by the reader
+    ssize_t received = read(master, rx + rx_size, sizeof(rx) - rx_size);
+    if (received > 0) {
+      rx_size += received;
+      int offset, length;
+      while (ubx_frame_find(rx, rx_size, sizeof(rx), &offset, &length)) {
+        if (rx[offset + 2] == 0x06 &&
+            ack_pending + 10 <= sizeof(ack_buffer)) {
+          ack_pending += ubx_frame_build(ack_buffer + ack_pending, 0x05,
+                                         0x01, rx + offset + 2, 2);
+        }
+        offset += length;
+        memmove(rx, rx + offset, rx_size - offset);
+        rx_size -= offset;
+      }
+      memmove(rx, rx + offset, rx_size - offset);
+      rx_size -= offset;
+    }
+
+    now = get_t();
+    if (now - report_t >= SIM_REPORT_US) {
+      report(&window, rate_hz, "[sim]");
+      total.epochs += window.epochs;
+      total.sent += window.sent;
+      total.dropped += window.dropped;
+      total.late += window.late;
+      total.bytes += window.bytes;
+      if (window.max_late_us > total.max_late_us) {
+        total.max_late_us = window.max_late_us;
+      }
+      if (window.dropped == 0 && window.late == 0 && rate_hz > sustained_hz) {
+        sustained_hz = rate_hz;
+      }
+      memset(&window, 0, sizeof(sim_stats_t));
+      report_t = now;
+    }
+    if (opt.ramp_step_hz > 0.0 && now - ramp_t >= opt.ramp_period_s * 1e6) {
+      rate_hz += opt.ramp_step_hz;
+      ramp_t = now;
+    }
+
+    int sending = pending > written || ack_pending > ack_written;
+    struct pollfd wait = {.fd = master, .events = sending ? POLLOUT : 0};
+    int timeout_ms = deadline > now ? (deadline - now) / 1000 : 0;
+    poll(&wait, 1, timeout_ms);
+    if (wait.revents & POLLHUP) {
+      // The reader may reopen the port (e.g. after configuring the receiver)
+      printf("Reader closed the port\n");
+      pending = 0;
+      written = 0;
+      ack_pending = 0;
+      ack_written = 0;
+      rx_size = 0;
+      wait_reader(master, &opt, get_t());
+      deadline = get_t();
+    }
+  }
+
+  report(&total, rate_hz, "[total]");
+  printf("Max sustained rate: %.1f Hz\n", sustained_hz);
+
+  if (opt.link_path) {
+    unlink(opt.link_path);
+  }
+  close(master);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+#include "lap.h"
+#include "defines.h"
+#include "utils.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+int lap_line_load(lap_line_t *line, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  int res = fscanf(file, "%lf,%lf,%lf,%lf", &line->lat0, &line->lon0,
+                   &line->lat1, &line->lon1);
+  fclose(file);
+  if (res != 4) {
+    fprintf(stderr, "Invalid lap line file %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int lap_line_save(const lap_line_t *line, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror("Could not open lap line file");
+    return -1;
+  }
+  fprintf(file, "%.9f,%.9f,%.9f,%.9f\n", line->lat0, line->lon0, line->lat1,
+          line->lon1);
+  fclose(file);
+  return 0;
+}
+
+void lap_detector_init(lap_detector_t *laps, const lap_line_t *line) {
+  // Keep the index of the running session
+  lap_detector_t running = *laps;
+  memset(laps, 0, sizeof(lap_detector_t));
+  laps->index = running.index;
+  laps->row = running.row;
+  memcpy(laps->gps_dir, running.gps_dir, sizeof(laps->gps_dir));
+  if (line != NULL) {
+    laps->line = *line;
+    laps->enabled = 1;
+  }
+}
+
+void lap_detector_reset(lap_detector_t *laps) {
+  laps->has_prev = 0;
+  laps->row = 0;
+  laps->direction = 0;
+  laps->in_lap = 0;
+  laps->lap_count = 0;
+}
+
+int lap_index_open(lap_detector_t *laps, const char *session_path,
+                   const char *gps_dir) {
+  lap_detector_reset(laps);
+  if (!laps->enabled) {
+    return 0;
+  }
+  snprintf(laps->gps_dir, sizeof(laps->gps_dir), "%s", gps_dir);
+
+  char index_path[2048];
+  snprintf(index_path, 2048, "%s/laps.csv", session_path);
+
+  // A resumed session keeps its index, numbering continues after its laps
+  FILE *previous = fopen(index_path, "r");
+  if (previous != NULL) {
+    char line[256];
+    while (fgets(line, sizeof(line), previous) != NULL) {
+      if (line[0] >= '0' && line[0] <= '9') {
+        laps->lap_count++;
+      }
+    }
+    fclose(previous);
+  }
+
+  laps->index = fopen(index_path, "a");
+  if (laps->index == NULL) {
+    perror("Could not open laps file");
+    return -1;
+  }
+  if (ftell(laps->index) == 0) {
+    fprintf(laps->index, "lap,start_row,end_row,start_timestamp,"
+                         "end_timestamp,lap_time,gps\n");
+  }
+  fflush(laps->index);
+  return 0;
+}
+
+int lap_index_close(lap_detector_t *laps) {
+  if (laps->index != NULL) {
+    fclose(laps->index);
+    laps->index = NULL;
+  }
+  return 0;
+}
+
+static void lap_index_write(lap_detector_t *laps, lap_t *lap) {
+  if (laps->index == NULL) {
+    return;
+  }
+  fprintf(laps->index,
+          "%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+          ",%s\n",
+          lap->number, lap->start_row, lap->end_row, lap->start_t, lap->end_t,
+          lap->end_t - lap->start_t, laps->gps_dir);
+  fflush(laps->index);
+}
+
+int lap_detector_update(lap_detector_t *laps, double lat, double lon,
+                        uint64_t t) {
+  if (!laps->enabled) {
+    return 0;
+  }
+
+  // Work in metres with the origin on the first end of the line
+  double x, y, ex, ey;
+  latlon_to_local(laps->line.lat0, laps->line.lon0, lat, lon, &x, &y);
+  latlon_to_local(laps->line.lat0, laps->line.lon0, laps->line.lat1,
+                  laps->line.lon1, &ex, &ey);
+
+  uint64_t row = laps->row++;
+  int completed = 0;
+
+  if (laps->has_prev && t > laps->prev_t) {
+    double dx = x - laps->prev_x;
+    double dy = y - laps->prev_y;
+    double denom = dx * ey - dy * ex;
+    if (fabs(denom) > 1e-9) {
+      // Solve prev + s * d = u * e
+      double s = (laps->prev_y * ex - laps->prev_x * ey) / denom;
+      double u = (laps->prev_y * dx - laps->prev_x * dy) / denom;
+      int side = denom > 0.0 ? 1 : -1;
+      if (s > 0.0 && s <= 1.0 && u >= 0.0 && u <= 1.0 &&
+          (laps->direction == 0 || laps->direction == side)) {
+        uint64_t crossing_t = laps->prev_t + (uint64_t)(s * (t - laps->prev_t));
+
+        if (!laps->in_lap) {
+          laps->direction = side;
+          laps->in_lap = 1;
+          laps->current.number = laps->lap_count + 1;
+          laps->current.start_row = row;
+          laps->current.start_t = crossing_t;
+        } else if (crossing_t - laps->current.start_t > LAP_MIN_US) {
+          laps->current.end_row = row;
+          laps->current.end_t = crossing_t;
+          laps->last = laps->current;
+          laps->lap_count++;
+          lap_index_write(laps, &laps->last);
+
+          laps->current.number++;
+          laps->current.start_row = row;
+          laps->current.start_t = crossing_t;
+          completed = 1;
+        }
+      }
+    }
+  }
+
+  laps->has_prev = 1;
+  laps->prev_x = x;
+  laps->prev_y = y;
+  laps->prev_t = t;
+  return completed;
+}
@@ -14,6 +14,9 @@ typedef struct _led_t{
 	uint32_t off_us;
 	int state;
 	int one_shot;
+	// Blink code: code blinks, then a pause
+	int code;
+	uint32_t pause_us;
 	uint32_t t;
 }led_t;
 
@@ -29,6 +32,8 @@ led_t *led_new(int pin) {
 	leds[last_led].off_us = 0;
 	leds[last_led].state = 0;
 	leds[last_led].one_shot = 0;
+	leds[last_led].code = 0;
+	leds[last_led].pause_us = 0;
 	leds[last_led].t = get_t();
 
 	return &(leds[last_led]);
@@ -37,13 +42,25 @@ led_t *led_new(int pin) {
 void led_set_state(led_t *led, int on_ms, int off_ms) {
 	assert(led);
 	led->one_shot = 0;
+	led->code = 0;
 	led->on_us = on_ms * 1e3;
 	led->off_us = off_ms * 1e3;
 }
 
+void led_set_code(led_t *led, int code, int on_ms, int off_ms, int pause_ms) {
+	assert(led);
+	led->one_shot = 0;
+	led->code = code;
+	led->on_us = on_ms * 1e3;
+	led->off_us = off_ms * 1e3;
+	led->pause_us = pause_ms * 1e3;
+	led->t = get_t();
+}
+
 void led_blink_once(led_t *led, int on_ms) {
 	assert(led);
 	led->one_shot = 1;
+	led->code = 0;
 	led->on_us = on_ms * 1e3;
 	led->off_us = 0;
 	led->t = get_t();
@@ -52,6 +69,17 @@ void led_blink_once(led_t *led, int on_ms) {
 void led_run() {
 	uint32_t t = get_t();
 	for(int i = 0; i <= last_led; ++i) {
+		if(leds[i].code > 0) {
+			uint32_t period = leds[i].on_us + leds[i].off_us;
+			uint32_t elapsed = t - leds[i].t;
+			if(elapsed >= leds[i].code * period + leds[i].pause_us) {
+				leds[i].t = t;
+				elapsed = 0;
+			}
+			gpioWrite(leds[i].PIN, elapsed < leds[i].code * period &&
+			                       elapsed % period < leds[i].on_us);
+			continue;
+		}
 		int cond = (t - leds[i].t) <= leds[i].on_us;
 		gpioWrite(leds[i].PIN, cond);
 		if(t - leds[i].t > (leds[i].on_us + leds[i].off_us)) {
@@ -0,0 +1,149 @@
+#include "live.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int live_create(live_t *live) {
+  int fd = shm_open(LIVE_SHM_NAME, O_CREAT | O_RDWR, 0644);
+  if (fd == -1) {
+    perror("Could not open live shared memory");
+    return -1;
+  }
+  if (ftruncate(fd, sizeof(live_shm_t)) == -1) {
+    perror("Could not size live shared memory");
+    close(fd);
+    return -1;
+  }
+  live->shm = mmap(NULL, sizeof(live_shm_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  close(fd);
+  if (live->shm == MAP_FAILED) {
+    perror("Could not map live shared memory");
+    live->shm = NULL;
+    return -1;
+  }
+  live->writer = 1;
+
+  // Readers check the magic last, after the segment is consistent
+  __atomic_store_n(&live->shm->magic, 0, __ATOMIC_RELEASE);
+  memset(&live->shm->state, 0, sizeof(live_state_t));
+  live->shm->version = LIVE_VERSION;
+  __atomic_store_n(&live->shm->seq, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&live->shm->cone_head, 0, __ATOMIC_RELAXED);
+  // The segment outlives main, a reader notices the restart from this
+  __atomic_add_fetch(&live->shm->generation, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&live->shm->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void live_publish(live_t *live, const gps_parsed_data_t *gps_data,
+                  const full_session_t *session,
+                  const cone_session_t *cone_session) {
+  if (live->shm == NULL) {
+    return;
+  }
+  live_shm_t *shm = live->shm;
+  uint32_t seq = shm->seq;
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  live_state_t *state = &shm->state;
+  state->fix_count++;
+  state->timestamp = gps_data->hpposllh._timestamp;
+  state->lat = gps_data->hpposllh.lat;
+  state->lon = gps_data->hpposllh.lon;
+  state->alt = gps_data->hpposllh.height;
+  state->h_acc = gps_data->hpposllh.hAcc;
+  state->trajectory_active = session->active;
+  state->cone_session_active = cone_session->active;
+  strncpy(state->trajectory_name, session->session_name,
+          sizeof(state->trajectory_name) - 1);
+  strncpy(state->cone_session_name, cone_session->session_name,
+          sizeof(state->cone_session_name) - 1);
+
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void live_publish_cone(live_t *live, const cone_t *cone) {
+  if (live->shm == NULL) {
+    return;
+  }
+  live_shm_t *shm = live->shm;
+  uint64_t head = shm->cone_head;
+  shm->cones[head & (LIVE_CONE_RING - 1)] = *cone;
+  __atomic_store_n(&shm->cone_head, head + 1, __ATOMIC_RELEASE);
+}
+
+int live_attach(live_t *live) {
+  int fd = shm_open(LIVE_SHM_NAME, O_RDONLY, 0);
+  if (fd == -1) {
+    perror("Could not open live shared memory (is main running?)");
+    return -1;
+  }
+  live->shm = mmap(NULL, sizeof(live_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (live->shm == MAP_FAILED) {
+    perror("Could not map live shared memory");
+    live->shm = NULL;
+    return -1;
+  }
+  live->writer = 0;
+  if (live->shm->version != LIVE_VERSION) {
+    fprintf(stderr, "Live shared memory version %u, expected %u\n",
+            live->shm->version, LIVE_VERSION);
+    live_close(live);
+    return -1;
+  }
+  return 0;
+}
+
+int live_read_state(const live_t *live, live_state_t *state) {
+  const live_shm_t *shm = live->shm;
+  if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != LIVE_MAGIC) {
+    return -1;
+  }
+  uint32_t begin, end = 0;
+  do {
+    begin = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+    if (begin & 1) {
+      continue;
+    }
+    memcpy(state, &shm->state, sizeof(live_state_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    end = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+  } while ((begin & 1) || begin != end);
+  return state->fix_count == 0 ? -1 : 0;
+}
+
+uint32_t live_generation(const live_t *live) {
+  return __atomic_load_n(&live->shm->generation, __ATOMIC_ACQUIRE);
+}
+
+uint64_t live_cone_count(const live_t *live) {
+  return __atomic_load_n(&live->shm->cone_head, __ATOMIC_ACQUIRE);
+}
+
+int live_read_cone(const live_t *live, uint64_t index, cone_t *cone) {
+  const live_shm_t *shm = live->shm;
+  // At head == index + LIVE_CONE_RING the writer is already reusing the slot
+  if (live_cone_count(live) - index >= LIVE_CONE_RING) {
+    return -1;
+  }
+  memcpy(cone, &shm->cones[index & (LIVE_CONE_RING - 1)], sizeof(cone_t));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  // The writer may have wrapped around while copying
+  if (__atomic_load_n(&shm->cone_head, __ATOMIC_RELAXED) - index >=
+      LIVE_CONE_RING) {
+    return -1;
+  }
+  return 0;
+}
+
+void live_close(live_t *live) {
+  if (live->shm != NULL) {
+    munmap(live->shm, sizeof(live_shm_t));
+    live->shm = NULL;
+  }
+}
@@ -1,6 +1,7 @@
 #include "main.h"
 
 #include <dirent.h>
+#include <errno.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -9,22 +10,67 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "acr_config.h"
+#include "clock_model.h"
+#include "config.h"
 #include "defines.h"
+#include "dispatch.h"
+#include "fault.h"
+#include "geofence.h"
 #include "gpio.h"
+#include "gpio_input.h"
 #include "led.h"
+#include "live.h"
+#include "receiver.h"
+#include "resume.h"
+#include "rt.h"
+#include "rtcm.h"
+#include "telemetry.h"
+#include "track.h"
+#include "ubx_cfg.h"
 #include "utils.h"
 
 pthread_t led_thread;
-int in_error_state = 0;
-int kill_thread = 0;
+volatile sig_atomic_t kill_thread = 0;
 led_t *led_gn;
 led_t *led_rd;
-
-int main(void) {
+track_t track;
+dispatch_table_t dispatch;
+rt_config_t rt_config;
+rt_jitter_t gps_jitter;
+rt_jitter_t led_jitter;
+live_t live;
+telemetry_t telemetry;
+char resume_path[2048];
+fault_manager_t faults;
+int has_fix = 0;
+// Sessions closed after a storage error, recreated by the fault manager
+int recreate_session = 0;
+int recreate_cones = 0;
+receivers_config_t receivers_config;
+receivers_t receivers;
+// Last fix of each receiver, for the combined cone position
+gps_parsed_data_t source_fixes[RECEIVER_MAX];
+rtcm_t rtcm;
+geofence_t geofence;
+clock_model_t clocks[RECEIVER_MAX];
+acr_config_t acr_config;
+gpio_input_t buttons;
+fix_pipeline_t fix_pipeline;
+cone_pipeline_t cone_pipeline;
+// Cone requested by a button, saved when the filter is done
+int cone_pending = 0;
+uint64_t cone_request_t = 0;
+int cone_samples = 0;
+
+static fix_pipeline_t fix_pipeline_select(cone_filter_t filter,
+                                          motion_mode_t mode);
+static cone_pipeline_t cone_pipeline_select(cone_filter_t filter);
+
+int main(int argc, char **argv) {
+  uint64_t start_t = get_t();
   printf("ACR: Advanced Cone Registration\n");
   user_data_t user_data;
-  led_gn = led_new(P_LED_GN);
-  led_rd = led_new(P_LED_RD);
 
   cone_t cone;
   full_session_t session;
@@ -36,250 +82,795 @@ int main(void) {
   // char *basepath = getenv("USER");
   char *basepath = "/home/philpi";
 
+  char config_path[2048];
+  snprintf(config_path, 2048, "%s/logs/acr/%s", basepath, ACR_CONFIG_FILE);
+  rt_config_default(&rt_config);
+  if (config_parse(config_path, rt_config_handler, &rt_config) > 0) {
+    printf("Invalid entries in %s\n", config_path);
+  }
+  acr_config_default(&acr_config);
+  if (config_parse(config_path, acr_config_handler, &acr_config) > 0 ||
+      acr_config_validate(&acr_config) == -1) {
+    printf("Invalid pins or cone filter in %s, using the defaults\n",
+           config_path);
+    acr_config_default(&acr_config);
+  }
+  led_gn = led_new(acr_config.pins.led_green);
+  led_rd = led_new(acr_config.pins.led_red);
+  gpio_configure(&acr_config.pins);
+  telemetry_config_t telemetry_config;
+  telemetry_config_default(&telemetry_config);
+  config_parse(config_path, telemetry_config_handler, &telemetry_config);
+  motion_config_t motion_config;
+  motion_config_default(&motion_config);
+  config_parse(config_path, motion_config_handler, &motion_config);
+  motion_init(&session.motion, &motion_config);
+  // The configuration is not tested again for every fix
+  fix_pipeline = fix_pipeline_select(acr_config.cones.filter,
+                                     motion_config.mode);
+  cone_pipeline = cone_pipeline_select(acr_config.cones.filter);
+  printf("Cone filter %s, %s logging\n",
+         cone_filter_to_string(acr_config.cones.filter),
+         motion_config.mode == MOTION_ADAPTIVE ? "adaptive" : "lossless");
+  receivers_config_default(&receivers_config);
+  config_parse(config_path, receivers_config_handler, &receivers_config);
+  receivers_config_resolve(&receivers_config);
+  // The port can be overridden to use a simulated receiver (gps_sim)
+  if (argc > 1) {
+    snprintf(receivers_config.receivers[0].port, 256, "%s", argv[1]);
+  }
+  geofence_config_t geofence_config;
+  geofence_config_default(&geofence_config);
+  config_parse(config_path, geofence_config_handler, &geofence_config);
+  geofence_init(&geofence, &geofence_config);
+  for (int i = 0; i < RECEIVER_MAX; i++) {
+    clock_model_init(&clocks[i]);
+  }
+  rtcm_config_t rtcm_config;
+  rtcm_config_default(&rtcm_config);
+  config_parse(config_path, rtcm_config_handler, &rtcm_config);
+  session.source_count = receivers_config.count;
+  for (int i = 0; i < receivers_config.count; i++) {
+    snprintf(session.sources[i].name, 32, "%s",
+             receivers_config.receivers[i].name);
+  }
+  rt_jitter_init(&gps_jitter, "gps", UBX_MEAS_RATE_MS * 1000);
+  rt_jitter_init(&led_jitter, "led", 1000);
+
   if (gpioInitialise() == PI_INIT_FAILED) {
-    error_state(ERROR_GPIO_INIT);
+    // Nothing works without it, let the service restart the process
+    fprintf(stderr, "Error: %s\n", error_to_string(ERROR_GPIO_INIT));
+    return EXIT_FAILURE;
+  }
+
+  if (rt_config.enabled) {
+    // Threads started by gpioInitialise belong to pigpio
+    printf("Real-time mode enabled\n");
+    rt_setup_memory(&rt_config);
+    rt_setup_other_threads(&rt_config.pigpio, "pigpio");
+    rt_setup_thread(&rt_config.main, "main");
   }
 
+  // Ctrl+C and systemctl stop
   signal(SIGINT, sig_handler);
-  signal(SIGKILL, sig_handler);
+  signal(SIGTERM, sig_handler);
+
+  char lap_line_path[2048];
+  lap_line_t lap_line;
+  snprintf(lap_line_path, 2048, "%s/logs/acr/%s", basepath, LAP_LINE_FILE);
+  if (lap_line_load(&lap_line, lap_line_path) == 0) {
+    printf("Lap detection enabled [%s]\n", lap_line_path);
+    lap_detector_init(&session.laps, &lap_line);
+  } else {
+    lap_detector_init(&session.laps, NULL);
+  }
+
+  char dispatch_path[2048];
+  snprintf(dispatch_path, 2048, "%s/logs/acr/%s", basepath, DISPATCH_FILE);
+  dispatch_init(&dispatch, DISPATCH_PARSE_LOG);
+  if (dispatch_load(&dispatch, dispatch_path) == 0) {
+    printf("Message policies loaded [%s]\n", dispatch_path);
+  }
 
   user_data.basepath = basepath;
   user_data.cone = &cone;
   user_data.session = &session;
   user_data.cone_session = &cone_session;
 
-  pin_setup(&user_data);
+  // Local tools (viewer) attach to it instead of opening the port
+  if (live_create(&live) == -1) {
+    printf("Live feed disabled\n");
+  }
+
+  if (telemetry_open(&telemetry, &telemetry_config) == -1) {
+    printf("Telemetry disabled\n");
+  }
+
+  track_init(&track);
+  fault_init(&faults);
+  snprintf(resume_path, 2048, "%s/logs/acr/%s", basepath, RESUME_FILE);
+  resume_sessions(&user_data);
+  pin_setup();
 
   pthread_create(&led_thread, NULL, led_runner, NULL);
 
   led_set_state(led_gn, 200, 300);
   led_set_state(led_rd, 200, 300);
 
-  gps_serial_port gps;
-  gps_interface_initialize(&gps);
-  int res = gps_interface_open(&gps, "/dev/ttyACM0", B230400);
-  if (res == -1) {
-    error_state(ERROR_GPS_NOT_FOUND);
+  // Restrict the receiver output to what is used, skipped when unchanged
+  for (int i = 0; i < receivers_config.count; i++) {
+    const receiver_config_t *receiver = &receivers_config.receivers[i];
+    char ubx_cfg_path[2048];
+    ubx_cfg_t ubx_cfg;
+    if (i == 0) {
+      snprintf(ubx_cfg_path, 2048, "%s/logs/acr/%s", basepath, UBX_CFG_FILE);
+    } else {
+      snprintf(ubx_cfg_path, 2048, "%s/logs/acr/%s_%s", basepath, UBX_CFG_FILE,
+               receiver->name);
+    }
+    ubx_cfg_default(&ubx_cfg);
+    if (ubx_cfg_apply(&ubx_cfg, receiver->port, B230400, ubx_cfg_path) ==
+        -1) {
+      printf("Using the current configuration of %s\n", receiver->name);
+    }
   }
 
-  unsigned char start_sequence[GPS_MAX_START_SEQUENCE_SIZE];
-  char line[GPS_MAX_LINE_SIZE];
-
-  double lat, lon, alt;
-  gps_parsed_data_t gps_data;
+  if (receivers_start(&receivers, &receivers_config,
+                      rt_config.enabled ? &rt_config.main : NULL,
+                      receiver_fault, NULL) == -1) {
+    return EXIT_FAILURE;
+  }
 
-  usleep(1e6);
+  // Corrections start right away, so the fix converges after a restart
+  int rtcm_receiver = 0;
+  for (int i = 0; i < receivers_config.count; i++) {
+    if (strcmp(rtcm_config.receiver, receivers_config.receivers[i].name) ==
+        0) {
+      rtcm_receiver = i;
+    }
+  }
+  if (rtcm_open(&rtcm, &rtcm_config,
+                receivers_config.receivers[rtcm_receiver].port) == -1) {
+    printf("RTCM corrections disabled\n");
+  }
 
-  led_set_state(led_gn, 0, 0);
-  led_set_state(led_rd, 0, 0);
+  receiver_message_t message;
+  gps_parsed_data_t gps_data[RECEIVER_MAX];
+  memset(gps_data, 0, sizeof(gps_data));
 
-  int fail_count = 0;
+  // Leds blink until the first valid fix
   while (!kill_thread) {
-    int start_size, line_size;
-    gps_protocol_type protocol;
-    protocol = gps_interface_get_line(&gps, start_sequence, &start_size, line,
-                                      &line_size, true);
-    if (protocol == GPS_PROTOCOL_TYPE_SIZE) {
-      fail_count++;
-      if (fail_count > 10) {
-        error_state(ERROR_GPS_READ);
-      }
+    fault_service(&user_data, get_t());
+    struct pollfd watch[RECEIVER_MAX_WATCH];
+    int watch_count = rtcm_pollfds(&rtcm, watch);
+    watch[watch_count].fd = gpio_input_fd(&buttons);
+    watch[watch_count].events = POLLIN;
+    watch_count++;
+    // Subscriptions are answered even when no receiver is streaming
+    watch[watch_count].fd = telemetry.fd;
+    watch[watch_count].events = POLLIN;
+    watch_count++;
+    int received =
+        receivers_next(&receivers, &message, 10, watch, watch_count);
+    // Corrections go between the messages, the port is never waited
+    rtcm_service(&rtcm, get_t());
+    telemetry_poll(&telemetry, get_t());
+    // Buttons are handled here, the pigpio thread only queues the edges
+    gpio_input_service(&buttons, button_event, &user_data);
+    if (!received) {
       continue;
-    } else {
-      fail_count = 0;
     }
 
     gps_protocol_and_message match;
-    res = gps_match_message(&match, line, protocol);
-    if (res == -1) {
+    if (gps_match_message(&match, message.line, message.protocol) == -1) {
       continue;
     }
 
-    gps_parse_buffer(&gps_data, &match, line, get_t());
-
-    if (match.protocol == GPS_PROTOCOL_TYPE_UBX) {
-      if (match.message == GPS_UBX_TYPE_NAV_HPPOSLLH) {
-        lat = gps_data.hpposllh.lat;
-        lon = gps_data.hpposllh.lon;
-        alt = gps_data.hpposllh.height;
-
-        cone.timestamp = gps_data.hpposllh._timestamp;
-        if (CONE_ENABLE_MEAN && user_data.requested_save) {
-          cone.lat = cone.lat * CONE_MEAN_COMPLEMENTARY +
-                     lat * (1.0 - CONE_MEAN_COMPLEMENTARY);
-          cone.lon = cone.lon * CONE_MEAN_COMPLEMENTARY +
-                     lon * (1.0 - CONE_MEAN_COMPLEMENTARY);
-          cone.alt = cone.alt * CONE_MEAN_COMPLEMENTARY +
-                     alt * (1.0 - CONE_MEAN_COMPLEMENTARY);
-        } else {
-          cone.lat = lat;
-          cone.lon = lon;
-          cone.alt = alt;
+    int source = message.source;
+    uint64_t t = message.t;
+    geofence_event_t fence = GEOFENCE_NONE;
+    int actions = dispatch_message(&dispatch, &match, source,
+                                   message.line_size, session.active, t);
+    if (actions & DISPATCH_RAW) {
+      csv_session_write_raw(&session, source, message.start_sequence,
+                            message.start_size, message.line,
+                            message.line_size);
+    }
+    if (actions & DISPATCH_PARSE) {
+      gps_parse_buffer(&gps_data[source], &match, message.line, t);
+    }
+
+    if (actions & DISPATCH_PARSE && match.protocol == GPS_PROTOCOL_TYPE_UBX &&
+        match.message == GPS_UBX_TYPE_NAV_HPPOSLLH) {
+      gps_parsed_data_t *fix = &gps_data[source];
+      // Stamped with the least delayed epoch arrival, not when it was read
+      fix_timestamp(source, fix, message.t);
+      if (!has_fix && fix->hpposllh.hAcc > 0.0 &&
+          fix->hpposllh.hAcc < FIX_MAX_HACC_M) {
+        has_fix = 1;
+        printf("First fix %.1f ms after start\n", (t - start_t) * 1e-3);
+        led_set_state(led_gn, 0, 0);
+        if (faults.active_count == 0) {
+          led_set_state(led_rd, 0, 0);
+          if (session.active) {
+            led_on(led_rd);
+          }
         }
       }
+
+      actions = fix_pipeline(&user_data, source, fix, actions, t, &fence);
     }
 
-    if (session.active) {
-      gps_to_file(&session.files, &gps_data, &match);
+    if (actions & DISPATCH_LOG) {
+      gps_to_file(&session.sources[source].files, &gps_data[source], &match);
     }
 
-    static uint64_t cone_t = 0;
-    static int request_toggled = 0;
-    if (user_data.requested_save && request_toggled == 0) {
-      user_data.requested_save = 0;
-      request_toggled = 1;
-      cone_t = get_t();
+    // Sessions follow the track area, after the fix is written
+    if (fence == GEOFENCE_ENTER) {
+      printf("Entered %s\n", geofence_track_name(&geofence));
+      session_begin(&user_data);
+    } else if (fence == GEOFENCE_EXIT) {
+      printf("Left %s\n", geofence_track_name(&geofence));
+      session_end(&user_data);
     }
-    if (request_toggled) {
-      if (CONE_ENABLE_MEAN == 0 || get_t() - cone_t > CONE_REPRESS_US) {
-        cone_session_write(&cone_session, &cone);
-        // print to stdout
-        FILE *tmp = cone_session.file;
-        cone_session.file = stdout;
-        cone_session_write(&cone_session, &cone);
-        cone_session.file = tmp;
-
-        if (CONE_ENABLE_MEAN) {
-          led_off(led_gn);
-        } else {
-          led_blink_once(led_gn, 100);
-        }
-        request_toggled = 0;
+
+    cone_pipeline(&user_data);
+  }
+
+  shutdown_clean(&user_data);
+  return EXIT_SUCCESS;
+}
+
+static void fault_show(user_data_t *data) {
+  acr_error_t first = fault_first(&faults);
+  if (first != ERORR_SIZE) {
+    // Same codes as the errors list: error number + 1 blinks
+    led_set_code(led_rd, first + 1, 150, 150, 1000);
+  } else if (!has_fix) {
+    led_set_state(led_rd, 200, 300);
+  } else if (data->session->active) {
+    led_on(led_rd);
+  } else {
+    led_off(led_rd);
+  }
+}
+
+int session_begin(user_data_t *data) {
+  if (data->session->active) {
+    return 0;
+  }
+  if (csv_session_setup(data->session, data->basepath) == -1) {
+    fault_raise(&faults, ERROR_FULL_SESSION_SETUP);
+    return -1;
+  }
+  if (csv_session_start(data->session) == -1) {
+    fault_raise(&faults, ERROR_FULL_SESSION_START);
+    return -1;
+  }
+  printf("Session %s started [%s]\n", data->session->session_name,
+         data->session->session_path);
+  for (int i = 0; i < receivers_config.count; i++) {
+    clock_model_reset_latency(&clocks[i]);
+  }
+  resume_update(data);
+  // The fault code keeps blinking until it is recovered
+  if (faults.active_count == 0) {
+    led_on(led_rd);
+  }
+  return 0;
+}
+
+void session_end(user_data_t *data) {
+  // Stopped by the user, a session lost to a write error is not recreated
+  recreate_session = 0;
+  if (!data->session->active) {
+    return;
+  }
+  csv_session_stop(data->session);
+  printf("Session %s ended\n", data->session->session_name);
+  dispatch_report_session(data->session);
+  for (int i = 0; i < receivers_config.count; i++) {
+    char path[2048];
+    if (i == 0) {
+      snprintf(path, 2048, "%s/latency.csv", data->session->session_path);
+    } else {
+      snprintf(path, 2048, "%s/latency_%s.csv", data->session->session_path,
+               receivers_config.receivers[i].name);
+    }
+    clock_model_write_latency(&clocks[i], path);
+  }
+  char buttons_path[2048];
+  snprintf(buttons_path, 2048, "%s/buttons.csv", data->session->session_path);
+  gpio_input_write_stats(&buttons, buttons_path);
+  resume_update(data);
+  if (faults.active_count == 0) {
+    led_off(led_rd);
+  }
+}
+
+int cone_session_begin(user_data_t *data) {
+  if (data->cone_session->active) {
+    return 0;
+  }
+  if (cone_session_setup(data->cone_session, data->basepath) == -1) {
+    fault_raise(&faults, ERROR_CONE_SESSION_SETUP);
+    return -1;
+  }
+  if (cone_session_start(data->cone_session) == -1) {
+    fault_raise(&faults, ERROR_CONE_SESSION_START);
+    return -1;
+  }
+  printf("Cone session %s started [%s]\n", data->cone_session->session_name,
+         data->cone_session->session_path);
+  resume_update(data);
+  return 0;
+}
+
+static int fault_recover(acr_error_t error, user_data_t *data) {
+  switch (error) {
+  case ERROR_GPS_NOT_FOUND:
+  case ERROR_GPS_READ:
+    // Reopened by the reader threads
+    return receivers_all_open(&receivers) ? 0 : -1;
+  case ERROR_FULL_SESSION_SETUP:
+  case ERROR_FULL_SESSION_START:
+    return session_begin(data);
+  case ERROR_CONE_SESSION_SETUP:
+  case ERROR_CONE_SESSION_START:
+    return cone_session_begin(data);
+  case ERROR_STORAGE_WRITE:
+    if (recreate_session) {
+      if (session_begin(data) == -1) {
+        return -1;
       }
+      recreate_session = 0;
+    }
+    if (recreate_cones) {
+      if (cone_session_begin(data) == -1) {
+        return -1;
+      }
+      recreate_cones = 0;
+    }
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+void fault_service(user_data_t *data, uint64_t t) {
+  // A session that cannot write anymore is replaced by a new one
+  if (data->session->active && csv_session_errors(data->session) > 0) {
+    csv_session_stop(data->session);
+    recreate_session = 1;
+    fault_raise(&faults, ERROR_STORAGE_WRITE);
+  }
+  if (data->cone_session->active &&
+      data->cone_session->storage.stats.errors > 0) {
+    cone_session_stop(data->cone_session);
+    recreate_cones = 1;
+    fault_raise(&faults, ERROR_STORAGE_WRITE);
+  }
+
+  static acr_error_t shown = ERORR_SIZE;
+  if (fault_update(&faults, t) == 0 && shown == ERORR_SIZE) {
+    return;
+  }
+
+  for (int i = 0; i < ERORR_SIZE; i++) {
+    if (!fault_retry(&faults, i, t) ||
+        fault_recover(i, data) == -1) {
+      continue;
     }
+    // Recorded in the session that is logging, if any
+    char dir[1024];
+    if (data->session->active) {
+      snprintf(dir, 1024, "%s", data->session->session_path);
+    } else if (data->cone_session->active) {
+      snprintf(dir, 1024, "%s", data->cone_session->session_path);
+    } else {
+      snprintf(dir, 1024, "%s/logs/acr", data->basepath);
+    }
+    fault_clear(&faults, i, t, dir);
   }
 
-  return EXIT_SUCCESS;
+  if (fault_first(&faults) != shown) {
+    shown = fault_first(&faults);
+    fault_show(data);
+  }
+}
+
+void receiver_fault(int source, acr_error_t error, void *user) {
+  (void)user;
+  printf("Receiver %s: %s\n", receivers_config.receivers[source].name,
+         error_to_string(error));
+  fault_raise(&faults, error);
+}
+
+void fix_timestamp(int source, gps_parsed_data_t *fix, uint64_t arrival_t) {
+  clock_model_t *model = &clocks[source];
+  clock_model_update(model, fix->hpposllh.iTOW, arrival_t);
+  uint64_t epoch_t =
+      clock_model_host_time(model, fix->hpposllh.iTOW, arrival_t);
+  uint64_t parse_t = get_t();
+  if (parse_t > epoch_t) {
+    clock_model_add_latency(model, parse_t - epoch_t);
+  }
+  fix->hpposllh._timestamp = epoch_t;
 }
 
-void error_state(acr_error_t err) {
-  in_error_state = 1;
-  led_off(led_gn);
-  led_off(led_rd);
-
-  int total_blink_ms = 2000;
-  int increment_ms = total_blink_ms / (ERORR_SIZE * 2);
-  printf("\r\nError: %s\n", error_to_string(err));
-  while (true) {
-    for (uint8_t i = 0; i <= err; i++) {
-      led_blink_once(led_rd, increment_ms);
-      usleep(2 * increment_ms * 1e3);
+int cone_source_fix(int source, const gps_parsed_data_t *fix, double *lat,
+                    double *lon, double *alt) {
+  source_fixes[source] = *fix;
+  if (receivers_config.cone_source != RECEIVER_COMBINE) {
+    if (source != receivers_config.cone_source) {
+      return 0;
     }
-    usleep((total_blink_ms - increment_ms) * 1e3);
+    *lat = fix->hpposllh.lat;
+    *lon = fix->hpposllh.lon;
+    *alt = fix->hpposllh.height;
+    return 1;
   }
+
+  // Inverse variance weighted mean of the recent fixes
+  double weight_sum = 0.0;
+  *lat = *lon = *alt = 0.0;
+  for (int i = 0; i < receivers_config.count; i++) {
+    const gps_parsed_data_t *other = &source_fixes[i];
+    // Either fix can be the newer one
+    int64_t age = (int64_t)(fix->hpposllh._timestamp -
+                            other->hpposllh._timestamp);
+    if (other->hpposllh.hAcc <= 0.0 || llabs(age) > CONE_COMBINE_MAX_AGE_US) {
+      continue;
+    }
+    double weight = 1.0 / (other->hpposllh.hAcc * other->hpposllh.hAcc);
+    *lat += weight * other->hpposllh.lat;
+    *lon += weight * other->hpposllh.lon;
+    *alt += weight * other->hpposllh.height;
+    weight_sum += weight;
+  }
+  if (weight_sum == 0.0) {
+    return 0;
+  }
+  *lat /= weight_sum;
+  *lon /= weight_sum;
+  *alt /= weight_sum;
+  return 1;
+}
+
+// Body of the pipelines, filter and mode are constants in each variant
+static inline __attribute__((always_inline)) int
+fix_process(user_data_t *data, int source, gps_parsed_data_t *fix,
+            int actions, uint64_t t, geofence_event_t *fence,
+            const cone_filter_t filter, const motion_mode_t mode) {
+  full_session_t *session = data->session;
+  cone_t *cone = data->cone;
+  double lat, lon, alt;
+  if (cone_source_fix(source, fix, &lat, &lon, &alt)) {
+    cone->timestamp = fix->hpposllh._timestamp;
+    cone->itow = fix->hpposllh.iTOW;
+    if (filter == CONE_FILTER_MEAN && cone_samples > 0) {
+      double w = acr_config.cones.mean_weight;
+      cone->lat = cone->lat * w + lat * (1.0 - w);
+      cone->lon = cone->lon * w + lon * (1.0 - w);
+      cone->alt = cone->alt * w + alt * (1.0 - w);
+    } else {
+      cone->lat = lat;
+      cone->lon = lon;
+      cone->alt = alt;
+    }
+    // The mean starts from the first fix after the button
+    if (filter == CONE_FILTER_MEAN && cone_pending) {
+      cone_samples++;
+    }
+  }
+
+  // Live feed, laps and adaptive logging follow the first receiver
+  if (source != 0) {
+    return actions;
+  }
+  rt_jitter_sample(&gps_jitter, t);
+  live_publish(&live, fix, session, data->cone_session);
+  telemetry_send_position(&telemetry, fix, session, data->cone_session, t);
+
+  lat = fix->hpposllh.lat;
+  lon = fix->hpposllh.lon;
+  if (fix->hpposllh.hAcc > 0.0 && fix->hpposllh.hAcc < FIX_MAX_HACC_M) {
+    *fence = geofence_update(&geofence, lat, lon, t);
+  }
+  // Stationary fixes go in a summary instead of the csv
+  if (mode == MOTION_ADAPTIVE && actions & DISPATCH_LOG &&
+      !motion_update(&session->motion, lat, lon, fix->hpposllh.height,
+                     fix->hpposllh.hAcc, fix->hpposllh._timestamp)) {
+    actions &= ~DISPATCH_LOG;
+  }
+
+  // Lap rows follow the logged NAV-HPPOSLLH rows
+  if (actions & DISPATCH_LOG &&
+      lap_detector_update(&session->laps, lat, lon,
+                          fix->hpposllh._timestamp)) {
+    lap_t *lap = &session->laps.last;
+    printf("Lap %d: %.3f s\n", lap->number,
+           (lap->end_t - lap->start_t) * 1e-6);
+  }
+  return actions;
+}
+
+static inline __attribute__((always_inline)) void
+cone_process(user_data_t *data, const cone_filter_t filter) {
+  if (data->requested_save && !cone_pending) {
+    data->requested_save = 0;
+    cone_pending = 1;
+    cone_samples = 0;
+    cone_request_t = get_t();
+  }
+  if (!cone_pending) {
+    return;
+  }
+  if (filter == CONE_FILTER_MEAN &&
+      get_t() - cone_request_t <= acr_config.cones.repress_us) {
+    return;
+  }
+
+  cone_t *cone = data->cone;
+  // Not running if it could not be started, the fault manager retries
+  if (data->cone_session->active) {
+    cone_session_write(data->cone_session, cone);
+  }
+  cone_print(stdout, cone);
+  track_warn_gaps(&track, track_insert(&track, cone));
+  live_publish_cone(&live, cone);
+  telemetry_send_cone(&telemetry, cone);
+
+  if (filter == CONE_FILTER_MEAN) {
+    led_off(led_gn);
+  } else {
+    led_blink_once(led_gn, 100);
+  }
+  cone_pending = 0;
+}
+
+#define FIX_PIPELINE(name, filter, mode)                                       \
+  static int name(user_data_t *data, int source, gps_parsed_data_t *fix,       \
+                  int actions, uint64_t t, geofence_event_t *fence) {          \
+    return fix_process(data, source, fix, actions, t, fence, filter, mode);    \
+  }
+FIX_PIPELINE(fix_last_lossless, CONE_FILTER_LAST, MOTION_LOSSLESS)
+FIX_PIPELINE(fix_last_adaptive, CONE_FILTER_LAST, MOTION_ADAPTIVE)
+FIX_PIPELINE(fix_mean_lossless, CONE_FILTER_MEAN, MOTION_LOSSLESS)
+FIX_PIPELINE(fix_mean_adaptive, CONE_FILTER_MEAN, MOTION_ADAPTIVE)
+
+static void cone_last(user_data_t *data) {
+  cone_process(data, CONE_FILTER_LAST);
+}
+static void cone_mean(user_data_t *data) {
+  cone_process(data, CONE_FILTER_MEAN);
+}
+
+static fix_pipeline_t fix_pipeline_select(cone_filter_t filter,
+                                          motion_mode_t mode) {
+  static const fix_pipeline_t pipelines[CONE_FILTER_SIZE][MOTION_MODE_SIZE] =
+      {
+          [CONE_FILTER_LAST] = {[MOTION_LOSSLESS] = fix_last_lossless,
+                                [MOTION_ADAPTIVE] = fix_last_adaptive},
+          [CONE_FILTER_MEAN] = {[MOTION_LOSSLESS] = fix_mean_lossless,
+                                [MOTION_ADAPTIVE] = fix_mean_adaptive},
+      };
+  return pipelines[filter][mode];
+}
+
+static cone_pipeline_t cone_pipeline_select(cone_filter_t filter) {
+  static const cone_pipeline_t pipelines[CONE_FILTER_SIZE] = {
+      [CONE_FILTER_LAST] = cone_last,
+      [CONE_FILTER_MEAN] = cone_mean,
+  };
+  return pipelines[filter];
+}
+
+void track_warn_gaps(track_t *track, int i) {
+  if (i == -1) {
+    return;
+  }
+  int prev = track->cones[i].prev;
+  int missing = track_edge_missing(track, i);
+  if (prev != -1) {
+    missing += track_edge_missing(track, prev);
+  }
+  if (missing > 0) {
+    printf("Gap near %s cone, %d cones likely missing\n",
+           cone_id_to_string(track->cones[i].cone.id), missing);
+  }
+  // Where they should be, on the edges before and after the cone
+  int edges[2] = {prev, i};
+  for (int e = 0; e < 2; e++) {
+    if (edges[e] == -1) {
+      continue;
+    }
+    for (int k = 0; k < track_edge_missing(track, edges[e]); k++) {
+      double lat, lon;
+      track_missing_position(track, edges[e], k, &lat, &lon);
+      printf("  missing at %.7f,%.7f\n", lat, lon);
+    }
+  }
+}
+
+void dispatch_report_session(full_session_t *session) {
+  char report_path[2048];
+  snprintf(report_path, 2048, "%s/dispatch.csv", session->session_path);
+  FILE *report = fopen(report_path, "w");
+  if (report == NULL) {
+    perror("Could not open dispatch report");
+    return;
+  }
+  dispatch_report(&dispatch, report);
+  fclose(report);
+}
+
+static void resume_cone(cone_t *cone, void *user) {
+  (void)user;
+  track_insert(&track, cone);
+  live_publish_cone(&live, cone);
+}
+
+void resume_sessions(user_data_t *data) {
+  resume_state_t state;
+  if (resume_load(&state, resume_path) == -1) {
+    return;
+  }
+  if (state.trajectory[0] != '\0' &&
+      csv_session_resume(data->session, data->basepath, state.trajectory,
+                         state.trajectory_part + 1) == 0) {
+    printf("Session %s resumed [part %d]\n", data->session->session_name,
+           data->session->part);
+  }
+  if (state.cones[0] != '\0' &&
+      cone_session_resume(data->cone_session, data->basepath, state.cones) ==
+          0) {
+    int count = cone_session_read(data->cone_session, resume_cone, NULL);
+    printf("Cone session %s resumed [%d cones]\n",
+           data->cone_session->session_name, count);
+  }
+  resume_update(data);
+}
+
+void resume_update(user_data_t *data) {
+  resume_state_t state;
+  memset(&state, 0, sizeof(resume_state_t));
+  if (data->session->active) {
+    snprintf(state.trajectory, sizeof(state.trajectory), "%s",
+             data->session->session_name);
+    state.trajectory_part = data->session->part;
+  }
+  if (data->cone_session->active) {
+    snprintf(state.cones, sizeof(state.cones), "%s",
+             data->cone_session->session_name);
+  }
+  resume_save(&state, resume_path);
 }
 
 void *led_runner() {
+  if (rt_config.enabled) {
+    rt_setup_thread(&rt_config.led, "led");
+  }
   while (!kill_thread) {
     led_run();
     usleep(1000);
+    rt_jitter_sample(&led_jitter, get_t());
   }
   return NULL;
 }
 
 void sig_handler(int signum) {
-  if (signum == SIGKILL || signum == SIGINT) {
+  if (signum == SIGINT || signum == SIGTERM) {
+    // The main loop stops and calls shutdown_clean, the files are not
+    // touched from here while it may be writing them
     kill_thread = 1;
-    pthread_join(led_thread, NULL);
-    gpioWrite(P_LED_GN, 0);
-    gpioWrite(P_LED_RD, 0);
-    gpioTerminate();
-    printf("\rExiting\n");
-    exit(EXIT_FAILURE);
   }
 }
 
-void pin_setup(user_data_t *user_data) {
-  gpioSetMode(P_LED_GN, PI_OUTPUT);
-  gpioSetMode(P_LED_RD, PI_OUTPUT);
-  gpioSetMode(P_BTN_YL, PI_INPUT);
-  gpioSetMode(P_BTN_OR, PI_INPUT);
-  gpioSetMode(P_BTN_BL, PI_INPUT);
-  gpioSetMode(P_BTN_MODE, PI_INPUT);
-
-  gpioSetPullUpDown(P_BTN_YL, PI_PUD_UP);
-  gpioSetPullUpDown(P_BTN_OR, PI_PUD_UP);
-  gpioSetPullUpDown(P_BTN_BL, PI_PUD_UP);
-  gpioSetPullUpDown(P_BTN_MODE, PI_PUD_UP);
-
-  gpioSetAlertFuncEx(P_BTN_YL, pin_interrupt, user_data);
-  gpioSetAlertFuncEx(P_BTN_OR, pin_interrupt, user_data);
-  gpioSetAlertFuncEx(P_BTN_BL, pin_interrupt, user_data);
-  gpioSetAlertFuncEx(P_BTN_MODE, pin_interrupt, user_data);
+void shutdown_clean(user_data_t *data) {
+  // Whatever is left in the storage blocks and csv streams is written
+  session_end(data);
+  if (data->cone_session->active) {
+    cone_session_stop(data->cone_session);
+  }
+  // The sessions are ended, the next start must not resume them
+  if (unlink(resume_path) == -1 && errno != ENOENT) {
+    perror("Could not remove the resume state");
+  }
+
+  pthread_join(led_thread, NULL);
+  gpioWrite(acr_config.pins.led_green, 0);
+  gpioWrite(acr_config.pins.led_red, 0);
+  gpioTerminate();
+  printf("\r\n");
+  dispatch_report(&dispatch, stdout);
+  rt_jitter_report(&gps_jitter, stdout);
+  rt_jitter_report(&led_jitter, stdout);
+  telemetry_report(&telemetry, stdout);
+  receivers_report(&receivers, stdout);
+  rtcm_report(&rtcm, stdout);
+  gpio_input_report(&buttons, stdout);
+  for (int i = 0; i < receivers_config.count; i++) {
+    clock_model_report(&clocks[i], receivers_config.receivers[i].name,
+                       stdout);
+  }
+  printf("Exiting\n");
 }
 
-void pin_interrupt(int gpio, int level, uint32_t tick, void *user_data) {
-  (void)tick;
-  if (gpioSkipForDebounce(gpio, level))
-    return;
-  if (level != 0)
+// Window of a button, the common one when not set
+static uint64_t pin_debounce(uint64_t button_us) {
+  return button_us > 0 ? button_us : acr_config.pins.debounce_us;
+}
+
+void pin_setup() {
+  const pins_config_t *pins = &acr_config.pins;
+  gpioSetMode(pins->led_green, PI_OUTPUT);
+  gpioSetMode(pins->led_red, PI_OUTPUT);
+
+  if (gpio_input_init(&buttons) == -1) {
     return;
+  }
+  gpio_input_add(&buttons, pins->button_yellow, "yellow",
+                 pin_debounce(pins->debounce_yellow_us));
+  gpio_input_add(&buttons, pins->button_orange, "orange",
+                 pin_debounce(pins->debounce_orange_us));
+  gpio_input_add(&buttons, pins->button_blue, "blue",
+                 pin_debounce(pins->debounce_blue_us));
+  gpio_input_add(&buttons, pins->button_mode, "mode",
+                 pin_debounce(pins->debounce_mode_us));
+}
 
-  if (in_error_state) {
-    if (!gpioRead(P_BTN_BL) && !gpioRead(P_BTN_OR)) {
-      printf("\nRequested kill\n");
-      raise(SIGKILL);
-    }
+void button_event(const gpio_event_t *event, void *user_data) {
+  if (event->level != 0) {
     return;
   }
 
+  int gpio = event->pin;
+  const pins_config_t *pins = &acr_config.pins;
+  if (faults.active_count > 0 &&
+      gpio_input_level(&buttons, pins->button_blue) == 0 &&
+      gpio_input_level(&buttons, pins->button_orange) == 0) {
+    printf("\nRequested kill\n");
+    raise(SIGKILL);
+  }
+
   user_data_t *data = (user_data_t *)user_data;
 
-  switch (gpio) {
-  case P_BTN_MODE:
+  int cone_button = gpio == pins->button_yellow ||
+                    gpio == pins->button_blue || gpio == pins->button_orange;
+  if (gpio == pins->button_mode) {
     if (data->session->active) {
-      csv_session_stop(data->session);
-      printf("Session %s ended\n", data->session->session_name);
-      led_off(led_rd);
+      session_end(data);
     } else {
-      if (csv_session_setup(data->session, data->basepath) == -1) {
-        error_state(ERROR_FULL_SESSION_SETUP);
-      }
-      if (csv_session_start(data->session) == -1) {
-        error_state(ERROR_FULL_SESSION_START);
-      }
-      printf("Session %s started [%s]\n", data->session->session_name,
-             data->session->session_path);
-      led_on(led_rd);
+      session_begin(data);
     }
-    break;
-  case P_BTN_YL:
-  case P_BTN_OR:
-  case P_BTN_BL:
-    if (data->cone_session->active == 0) {
-      if (cone_session_setup(data->cone_session, data->basepath) == -1) {
-        error_state(ERROR_CONE_SESSION_SETUP);
-      }
-      if (cone_session_start(data->cone_session) == -1) {
-        error_state(ERROR_CONE_SESSION_START);
-      }
-      printf("Cone session %s started [%s]\n", data->cone_session->session_name,
-             data->cone_session->session_path);
-    }
-    break;
-  default:
-    break;
+  } else if (cone_button) {
+    cone_session_begin(data);
   }
 
   static uint64_t t_cone[CONE_ID_SIZE];
-  if (gpio == P_BTN_YL || gpio == P_BTN_BL || gpio == P_BTN_OR) {
-    if (gpio == P_BTN_YL) {
+  if (cone_button) {
+    if (gpio == pins->button_yellow) {
       data->cone->id = CONE_ID_YELLOW;
-    } else if (gpio == P_BTN_BL) {
+    } else if (gpio == pins->button_blue) {
       data->cone->id = CONE_ID_BLUE;
-    } else if (gpio == P_BTN_OR) {
+    } else if (gpio == pins->button_orange) {
       data->cone->id = CONE_ID_ORANGE;
     }
 
-    if (get_t() - t_cone[data->cone->id] > CONE_REPRESS_US) {
+    // Edges of different pins are not in order, t can be earlier
+    if (event->t > t_cone[data->cone->id] + acr_config.cones.repress_us) {
       data->requested_save = 1;
       led_on(led_gn);
     }
 
     // Update time for each cone.
-    // Preventing that two cones are saved simultaneously
+    // Preventing that two cones are saved simultaneously.
+    // An older edge must not move the time back
     for (int i = 0; i < CONE_ID_SIZE; i++) {
-      t_cone[i] = get_t();
+      if (event->t > t_cone[i]) {
+        t_cone[i] = event->t;
+      }
     }
   }
 }
@@ -0,0 +1,184 @@
+#include "motion.h"
+#include "config.h"
+#include "utils.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+// Time constant of the velocity filter
+#define MOTION_SPEED_TAU_S (1.0)
+
+void motion_config_default(motion_config_t *config) {
+  config->mode = MOTION_LOSSLESS;
+  config->stationary_speed_ms = 0.2;
+  config->deadband_m = 0.3;
+  config->stationary_after_s = 1.0;
+  config->summary_period_s = 5.0;
+}
+
+int motion_config_handler(void *user, const char *section, const char *key,
+                          const char *value) {
+  motion_config_t *config = (motion_config_t *)user;
+  if (strcmp(section, "logging") != 0) {
+    return 0;
+  }
+  if (strcmp(key, "mode") == 0) {
+    if (strcasecmp(value, "lossless") == 0) {
+      config->mode = MOTION_LOSSLESS;
+    } else if (strcasecmp(value, "adaptive") == 0) {
+      config->mode = MOTION_ADAPTIVE;
+    } else {
+      return -1;
+    }
+    return 0;
+  }
+  if (strcmp(key, "stationary_speed_ms") == 0) {
+    return config_double(value, &config->stationary_speed_ms);
+  }
+  if (strcmp(key, "deadband_m") == 0) {
+    return config_double(value, &config->deadband_m);
+  }
+  if (strcmp(key, "stationary_after_s") == 0) {
+    return config_double(value, &config->stationary_after_s);
+  }
+  if (strcmp(key, "summary_period_s") == 0) {
+    return config_double(value, &config->summary_period_s);
+  }
+  return -1;
+}
+
+void motion_init(motion_t *motion, const motion_config_t *config) {
+  memset(motion, 0, sizeof(motion_t));
+  motion->config = *config;
+}
+
+int motion_open(motion_t *motion, const char *gps_path) {
+  motion_config_t config = motion->config;
+  motion_init(motion, &config);
+  if (config.mode != MOTION_ADAPTIVE) {
+    return 0;
+  }
+
+  char path[2048];
+  snprintf(path, 2048, "%s/stationary.csv", gps_path);
+  // Summaries are rare and replace the fixes, none is lost on a crash
+  if (storage_open(&motion->file, path, STORAGE_FLUSH) == -1) {
+    return -1;
+  }
+  motion->file_open = 1;
+  storage_printf(&motion->file,
+                 "start_timestamp,end_timestamp,samples,lat,lon,height,"
+                 "std_east,std_north,std_height,h_acc\n");
+  return 0;
+}
+
+static void motion_summary_flush(motion_t *motion) {
+  motion_summary_t *summary = &motion->summary;
+  if (summary->count == 0) {
+    return;
+  }
+  double std[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < 3 && summary->count > 1; i++) {
+    std[i] = sqrt(summary->m2[i] / (summary->count - 1));
+  }
+  double lat, lon;
+  local_to_latlon(motion->lat0, motion->lon0, summary->mean[0],
+                  summary->mean[1], &lat, &lon);
+  storage_printf(&motion->file,
+                 "%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                 ",%.9f,%.9f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                 summary->start_t, summary->end_t, summary->count, lat, lon,
+                 summary->mean[2], std[0], std[1], std[2],
+                 summary->h_acc_sum / summary->count);
+  storage_flush(&motion->file);
+  motion->summaries++;
+  memset(summary, 0, sizeof(motion_summary_t));
+}
+
+int motion_close(motion_t *motion) {
+  if (!motion->file_open) {
+    return 0;
+  }
+  motion_summary_flush(motion);
+  motion->file_open = 0;
+  printf("Adaptive logging: %" PRIu64 " fixes logged, %" PRIu64
+         " in %" PRIu64 " stationary summaries\n",
+         motion->logged, motion->summarised, motion->summaries);
+  return storage_close(&motion->file);
+}
+
+static void motion_summary_add(motion_summary_t *summary, double x, double y,
+                               double height, double h_acc, uint64_t t) {
+  if (summary->count == 0) {
+    summary->start_t = t;
+  }
+  summary->end_t = t;
+  summary->count++;
+  double values[3] = {x, y, height};
+  for (int i = 0; i < 3; i++) {
+    double delta = values[i] - summary->mean[i];
+    summary->mean[i] += delta / summary->count;
+    summary->m2[i] += delta * (values[i] - summary->mean[i]);
+  }
+  summary->h_acc_sum += h_acc;
+}
+
+int motion_update(motion_t *motion, double lat, double lon, double height,
+                  double h_acc, uint64_t t) {
+  if (!motion->file_open) {
+    return 1;
+  }
+  if (!motion->has_origin) {
+    motion->has_origin = 1;
+    motion->lat0 = lat;
+    motion->lon0 = lon;
+  }
+
+  double x, y;
+  latlon_to_local(motion->lat0, motion->lon0, lat, lon, &x, &y);
+  if (motion->has_prev && t > motion->prev_t) {
+    double dt = (t - motion->prev_t) * 1e-6;
+    double alpha = dt < MOTION_SPEED_TAU_S ? dt / MOTION_SPEED_TAU_S : 1.0;
+    motion->vx += alpha * ((x - motion->prev_x) / dt - motion->vx);
+    motion->vy += alpha * ((y - motion->prev_y) / dt - motion->vy);
+  }
+
+  int still = motion->has_prev &&
+              hypot(motion->vx, motion->vy) < motion->config.stationary_speed_ms &&
+              hypot(x - motion->anchor_x, y - motion->anchor_y) <
+                  motion->config.deadband_m;
+  motion->has_prev = 1;
+  motion->prev_x = x;
+  motion->prev_y = y;
+  motion->prev_t = t;
+
+  if (!still) {
+    // Moving, or left the dead-band: back to full rate
+    if (motion->stationary) {
+      motion_summary_flush(motion);
+      motion->stationary = 0;
+    }
+    motion->anchor_x = x;
+    motion->anchor_y = y;
+    motion->still_since_t = t;
+  } else if (!motion->stationary &&
+             t - motion->still_since_t >=
+                 motion->config.stationary_after_s * 1e6) {
+    motion->stationary = 1;
+  }
+
+  if (!motion->stationary) {
+    motion->logged++;
+    return 1;
+  }
+
+  motion_summary_add(&motion->summary, x, y, height, h_acc, t);
+  motion->summarised++;
+  if (t - motion->summary.start_t >= motion->config.summary_period_s * 1e6) {
+    motion_summary_flush(motion);
+  }
+  return 0;
+}
@@ -0,0 +1,273 @@
+#include "receiver.h"
+#include "defines.h"
+#include "utils.h"
+
+#include <inttypes.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+void receivers_config_default(receivers_config_t *config) {
+  memset(config, 0, sizeof(receivers_config_t));
+  config->count = 1;
+  for (int i = 0; i < RECEIVER_MAX; i++) {
+    snprintf(config->receivers[i].name, 32, "gps%d", i);
+    snprintf(config->receivers[i].port, 256, "/dev/ttyACM%d", i);
+  }
+  config->cone_source = 0;
+}
+
+int receivers_config_handler(void *user, const char *section, const char *key,
+                             const char *value) {
+  receivers_config_t *config = (receivers_config_t *)user;
+  if (strcmp(section, "cones") == 0) {
+    if (strcmp(key, "source") == 0) {
+      snprintf(config->cone_source_name, 32, "%s", value);
+    }
+    // The filter keys belong to acr_config
+    return 0;
+  }
+  if (strncmp(section, "receiver.", 9) != 0) {
+    return 0;
+  }
+  char *end;
+  long index = strtol(section + 9, &end, 10);
+  if (*end != '\0' || index < 0 || index >= RECEIVER_MAX) {
+    return -1;
+  }
+  if (index + 1 > config->count) {
+    config->count = index + 1;
+  }
+  receiver_config_t *receiver = &config->receivers[index];
+  if (strcmp(key, "port") == 0) {
+    snprintf(receiver->port, 256, "%s", value);
+    return 0;
+  }
+  if (strcmp(key, "name") == 0) {
+    snprintf(receiver->name, 32, "%s", value);
+    return 0;
+  }
+  return -1;
+}
+
+int receivers_config_resolve(receivers_config_t *config) {
+  if (config->cone_source_name[0] == '\0') {
+    config->cone_source = 0;
+    return 0;
+  }
+  if (strcmp(config->cone_source_name, "combine") == 0) {
+    config->cone_source = RECEIVER_COMBINE;
+    return 0;
+  }
+  for (int i = 0; i < config->count; i++) {
+    if (strcmp(config->cone_source_name, config->receivers[i].name) == 0) {
+      config->cone_source = i;
+      return 0;
+    }
+  }
+  fprintf(stderr, "Unknown cone source %s\n", config->cone_source_name);
+  config->cone_source = 0;
+  return -1;
+}
+
+static void receiver_notify(receivers_t *receivers) {
+  uint64_t one = 1;
+  if (write(receivers->event_fd, &one, sizeof(one)) == -1) {
+    // Already signalled
+  }
+}
+
+static void receiver_push(receiver_t *receiver, receiver_message_t *message) {
+  uint32_t head = receiver->head;
+  uint32_t tail = __atomic_load_n(&receiver->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= RECEIVER_QUEUE_SIZE) {
+    // The merge never blocks the reader, the message is lost
+    receiver->dropped++;
+    return;
+  }
+  message->source = receiver->index;
+  receiver->queue[head % RECEIVER_QUEUE_SIZE] = *message;
+  __atomic_store_n(&receiver->head, head + 1, __ATOMIC_RELEASE);
+  receiver->received++;
+  receiver_notify(receiver->receivers);
+}
+
+static void *receiver_runner(void *arg) {
+  receiver_t *receiver = (receiver_t *)arg;
+  receivers_t *receivers = receiver->receivers;
+  if (receivers->rt != NULL) {
+    rt_setup_thread(receivers->rt, receiver->config.name);
+  }
+
+  receiver_message_t message;
+  uint64_t backoff_us = FAULT_BACKOFF_MIN_US;
+  int fail_count = 0;
+  while (!receivers->stop) {
+    if (!__atomic_load_n(&receiver->open, __ATOMIC_RELAXED)) {
+      usleep(backoff_us);
+      if (gps_interface_open(&receiver->port, receiver->config.port,
+                             B230400) == -1) {
+        backoff_us = backoff_us * 2 < FAULT_BACKOFF_MAX_US
+                         ? backoff_us * 2
+                         : FAULT_BACKOFF_MAX_US;
+        continue;
+      }
+      printf("Receiver %s reopened [%s]\n", receiver->config.name,
+             receiver->config.port);
+      backoff_us = FAULT_BACKOFF_MIN_US;
+      receiver->reopened++;
+      __atomic_store_n(&receiver->open, 1, __ATOMIC_RELEASE);
+    }
+
+    message.protocol = gps_interface_get_line(
+        &receiver->port, message.start_sequence, &message.start_size,
+        message.line, &message.line_size, true);
+    if (message.protocol == GPS_PROTOCOL_TYPE_SIZE) {
+      fail_count++;
+      if (fail_count > 10) {
+        // Unplugged or stuck
+        gps_interface_close(&receiver->port);
+        __atomic_store_n(&receiver->open, 0, __ATOMIC_RELEASE);
+        fail_count = 0;
+        receivers->on_fault(receiver->index, ERROR_GPS_READ, receivers->user);
+      }
+      continue;
+    }
+    fail_count = 0;
+    message.t = get_t();
+    receiver_push(receiver, &message);
+  }
+  return NULL;
+}
+
+int receivers_start(receivers_t *receivers, const receivers_config_t *config,
+                    const rt_thread_config_t *rt, receiver_fault_t on_fault,
+                    void *user) {
+  memset(receivers, 0, sizeof(receivers_t));
+  receivers->count = config->count;
+  receivers->rt = rt;
+  receivers->on_fault = on_fault;
+  receivers->user = user;
+  receivers->event_fd = eventfd(0, EFD_NONBLOCK);
+  if (receivers->event_fd == -1) {
+    perror("Could not create the receivers event");
+    return -1;
+  }
+
+  for (int i = 0; i < receivers->count; i++) {
+    receiver_t *receiver = &receivers->receivers[i];
+    receiver->index = i;
+    receiver->config = config->receivers[i];
+    receiver->receivers = receivers;
+    receiver->queue = calloc(RECEIVER_QUEUE_SIZE, sizeof(receiver_message_t));
+    if (receiver->queue == NULL) {
+      perror("Could not allocate the receiver queue");
+      return -1;
+    }
+
+    gps_interface_initialize(&receiver->port);
+    if (gps_interface_open(&receiver->port, receiver->config.port, B230400) ==
+        -1) {
+      on_fault(i, ERROR_GPS_NOT_FOUND, user);
+    } else {
+      receiver->open = 1;
+    }
+    if (pthread_create(&receiver->thread, NULL, receiver_runner, receiver) !=
+        0) {
+      perror("Could not start the receiver thread");
+      return -1;
+    }
+    printf("Receiver %s on %s\n", receiver->config.name,
+           receiver->config.port);
+  }
+  return 0;
+}
+
+static receiver_message_t *receiver_peek(receiver_t *receiver) {
+  uint32_t head = __atomic_load_n(&receiver->head, __ATOMIC_ACQUIRE);
+  if (head == receiver->tail) {
+    return NULL;
+  }
+  return &receiver->queue[receiver->tail % RECEIVER_QUEUE_SIZE];
+}
+
+int receivers_next(receivers_t *receivers, receiver_message_t *message,
+                   int timeout_ms, struct pollfd *watch, int watch_count) {
+  uint64_t deadline = get_t() + timeout_ms * 1000ull;
+  while (1) {
+    receiver_t *earliest = NULL;
+    int waiting = 0;
+    for (int i = 0; i < receivers->count; i++) {
+      receiver_t *receiver = &receivers->receivers[i];
+      receiver_message_t *head = receiver_peek(receiver);
+      if (head == NULL) {
+        // Only an open receiver can still deliver an earlier message
+        waiting += __atomic_load_n(&receiver->open, __ATOMIC_ACQUIRE);
+        continue;
+      }
+      if (earliest == NULL || head->t < receiver_peek(earliest)->t) {
+        earliest = receiver;
+      }
+    }
+
+    uint64_t t = get_t();
+    uint64_t wake = deadline;
+    if (earliest != NULL) {
+      uint64_t release = receiver_peek(earliest)->t + RECEIVER_MERGE_US;
+      if (waiting == 0 || t >= release) {
+        *message = *receiver_peek(earliest);
+        __atomic_store_n(&earliest->tail, earliest->tail + 1,
+                         __ATOMIC_RELEASE);
+        return 1;
+      }
+      wake = release < deadline ? release : deadline;
+    }
+    if (t >= deadline) {
+      return 0;
+    }
+
+    struct pollfd pfds[1 + RECEIVER_MAX_WATCH];
+    pfds[0].fd = receivers->event_fd;
+    pfds[0].events = POLLIN;
+    for (int i = 0; i < watch_count; i++) {
+      pfds[1 + i] = watch[i];
+    }
+    if (poll(pfds, 1 + watch_count, (wake - t + 999) / 1000) > 0) {
+      if (pfds[0].revents & POLLIN) {
+        uint64_t events;
+        if (read(receivers->event_fd, &events, sizeof(events)) == -1) {
+          // Drained by a previous read
+        }
+      }
+      for (int i = 0; i < watch_count; i++) {
+        watch[i].revents = pfds[1 + i].revents;
+        if (watch[i].revents != 0) {
+          return 0;
+        }
+      }
+    }
+  }
+}
+
+int receivers_all_open(const receivers_t *receivers) {
+  for (int i = 0; i < receivers->count; i++) {
+    if (!__atomic_load_n(&receivers->receivers[i].open, __ATOMIC_ACQUIRE)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void receivers_report(const receivers_t *receivers, FILE *file) {
+  for (int i = 0; i < receivers->count; i++) {
+    const receiver_t *receiver = &receivers->receivers[i];
+    fprintf(file,
+            "receiver %s: received %" PRIu64 " dropped %" PRIu64
+            " reopened %" PRIu64 "\n",
+            receiver->config.name, receiver->received, receiver->dropped,
+            receiver->reopened);
+  }
+}
@@ -0,0 +1,78 @@
+#include "resume.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define RESUME_BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+static int resume_boot_id(char *boot_id, int size) {
+  FILE *file = fopen(RESUME_BOOT_ID_PATH, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  int res = fgets(boot_id, size, file) != NULL ? 0 : -1;
+  fclose(file);
+  boot_id[strcspn(boot_id, "\n")] = '\0';
+  return res;
+}
+
+int resume_load(resume_state_t *state, const char *path) {
+  memset(state, 0, sizeof(resume_state_t));
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  char boot_id[64] = "";
+  char current_boot_id[64] = "";
+  char line[512];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "boot_id %63s", boot_id) == 1) {
+      continue;
+    }
+    if (sscanf(line, "trajectory %255s %d", state->trajectory,
+               &state->trajectory_part) == 2) {
+      continue;
+    }
+    sscanf(line, "cones %255s", state->cones);
+  }
+  fclose(file);
+
+  if (resume_boot_id(current_boot_id, sizeof(current_boot_id)) == -1 ||
+      strcmp(boot_id, current_boot_id) != 0) {
+    memset(state, 0, sizeof(resume_state_t));
+    return -1;
+  }
+  if (state->trajectory[0] == '\0' && state->cones[0] == '\0') {
+    return -1;
+  }
+  return 0;
+}
+
+int resume_save(const resume_state_t *state, const char *path) {
+  char boot_id[64] = "";
+  resume_boot_id(boot_id, sizeof(boot_id));
+
+  // Replaced with a rename, a crash never leaves half a state. No fsync:
+  // after a power loss the boot id changes and the state is unused anyway.
+  char tmp_path[2048];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE *file = fopen(tmp_path, "w");
+  if (file == NULL) {
+    perror("Could not write resume state");
+    return -1;
+  }
+  fprintf(file, "boot_id %s\n", boot_id);
+  if (state->trajectory[0] != '\0') {
+    fprintf(file, "trajectory %s %d\n", state->trajectory,
+            state->trajectory_part);
+  }
+  if (state->cones[0] != '\0') {
+    fprintf(file, "cones %s\n", state->cones);
+  }
+  if (fclose(file) != 0 || rename(tmp_path, path) == -1) {
+    perror("Could not write resume state");
+    return -1;
+  }
+  return 0;
+}
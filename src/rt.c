@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include "rt.h"
+#include "config.h"
+
+#include <alloca.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void rt_config_default(rt_config_t *config) {
+  memset(config, 0, sizeof(rt_config_t));
+  config->lock_memory = 1;
+  config->prefault_stack_kb = 256;
+  config->prefault_heap_kb = 4096;
+
+  config->main.policy = SCHED_FIFO;
+  config->main.priority = 80;
+  config->main.cpu = -1;
+  config->led.policy = SCHED_OTHER;
+  config->led.cpu = -1;
+  config->pigpio.policy = SCHED_FIFO;
+  config->pigpio.priority = 70;
+  config->pigpio.cpu = -1;
+}
+
+static int rt_policy_from_string(const char *value, int *policy) {
+  if (strcasecmp(value, "other") == 0) {
+    *policy = SCHED_OTHER;
+  } else if (strcasecmp(value, "fifo") == 0) {
+    *policy = SCHED_FIFO;
+  } else if (strcasecmp(value, "rr") == 0) {
+    *policy = SCHED_RR;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int rt_thread_handler(rt_thread_config_t *thread, const char *key,
+                             const char *value) {
+  if (strcmp(key, "policy") == 0) {
+    return rt_policy_from_string(value, &thread->policy);
+  }
+  if (strcmp(key, "priority") == 0) {
+    if (config_int(value, &thread->priority) == -1) {
+      return -1;
+    }
+    return thread->priority >= 0 && thread->priority <= 99 ? 0 : -1;
+  }
+  if (strcmp(key, "cpu") == 0) {
+    if (config_int(value, &thread->cpu) == -1) {
+      return -1;
+    }
+    return thread->cpu >= -1 && thread->cpu < CPU_SETSIZE ? 0 : -1;
+  }
+  return -1;
+}
+
+int rt_config_handler(void *user, const char *section, const char *key,
+                      const char *value) {
+  rt_config_t *config = (rt_config_t *)user;
+  if (strcmp(section, "rt") == 0) {
+    if (strcmp(key, "enabled") == 0) {
+      return config_bool(value, &config->enabled);
+    }
+    if (strcmp(key, "lock_memory") == 0) {
+      return config_bool(value, &config->lock_memory);
+    }
+    if (strcmp(key, "prefault_stack_kb") == 0) {
+      return config_int(value, &config->prefault_stack_kb);
+    }
+    if (strcmp(key, "prefault_heap_kb") == 0) {
+      return config_int(value, &config->prefault_heap_kb);
+    }
+    return -1;
+  }
+  if (strcmp(section, "rt.main") == 0) {
+    return rt_thread_handler(&config->main, key, value);
+  }
+  if (strcmp(section, "rt.led") == 0) {
+    return rt_thread_handler(&config->led, key, value);
+  }
+  if (strcmp(section, "rt.pigpio") == 0) {
+    return rt_thread_handler(&config->pigpio, key, value);
+  }
+  // Other sections belong to other modules
+  return 0;
+}
+
+static void rt_prefault_stack(int kb) {
+  // Touch the pages so that the loop never takes a fault on the stack
+  volatile unsigned char *stack = alloca(kb * 1024);
+  for (int i = 0; i < kb * 1024; i += 4096) {
+    stack[i] = 0;
+  }
+}
+
+int rt_setup_memory(const rt_config_t *config) {
+  if (!config->lock_memory) {
+    return 0;
+  }
+
+  // Keep freed memory in the process and never use mmap for malloc, so the
+  // prefaulted heap is reused instead of faulting new pages
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+    perror("mlockall");
+    return -1;
+  }
+
+  rt_prefault_stack(config->prefault_stack_kb);
+  if (config->prefault_heap_kb > 0) {
+    size_t size = (size_t)config->prefault_heap_kb * 1024;
+    unsigned char *heap = malloc(size);
+    if (heap != NULL) {
+      memset(heap, 0, size);
+      free(heap);
+    }
+  }
+  return 0;
+}
+
+static int rt_setup_tid(pid_t tid, const rt_thread_config_t *thread,
+                        const char *name) {
+  int res = 0;
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = thread->policy == SCHED_OTHER ? 0 : thread->priority;
+  if (sched_setscheduler(tid, thread->policy, &param) == -1) {
+    fprintf(stderr, "Could not set the scheduling of %s [%d]: ", name, tid);
+    perror("");
+    res = -1;
+  }
+
+  if (thread->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(thread->cpu, &set);
+    if (sched_setaffinity(tid, sizeof(set), &set) == -1) {
+      fprintf(stderr, "Could not pin %s [%d] to cpu %d: ", name, tid,
+              thread->cpu);
+      perror("");
+      res = -1;
+    }
+  }
+  return res;
+}
+
+int rt_setup_thread(const rt_thread_config_t *thread, const char *name) {
+  return rt_setup_tid(syscall(SYS_gettid), thread, name);
+}
+
+int rt_setup_other_threads(const rt_thread_config_t *thread,
+                           const char *name) {
+  DIR *dir = opendir("/proc/self/task");
+  if (dir == NULL) {
+    perror("Could not list threads");
+    return -1;
+  }
+  pid_t self = syscall(SYS_gettid);
+  int res = 0;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    pid_t tid = atoi(ent->d_name);
+    if (tid <= 0 || tid == self) {
+      continue;
+    }
+    if (rt_setup_tid(tid, thread, name) == -1) {
+      res = -1;
+    }
+  }
+  closedir(dir);
+  return res;
+}
+
+void rt_jitter_init(rt_jitter_t *jitter, const char *name,
+                    uint64_t expected_us) {
+  memset(jitter, 0, sizeof(rt_jitter_t));
+  jitter->name = name;
+  jitter->expected_us = expected_us;
+}
+
+void rt_jitter_sample(rt_jitter_t *jitter, uint64_t t) {
+  if (jitter->last_t == 0) {
+    jitter->last_t = t;
+    return;
+  }
+  int64_t deviation = (int64_t)(t - jitter->last_t) - jitter->expected_us;
+  jitter->last_t = t;
+
+  if (jitter->count == 0 || deviation < jitter->min_us) {
+    jitter->min_us = deviation;
+  }
+  if (jitter->count == 0 || deviation > jitter->max_us) {
+    jitter->max_us = deviation;
+  }
+  // Welford
+  jitter->count++;
+  double delta = deviation - jitter->mean_us;
+  jitter->mean_us += delta / jitter->count;
+  jitter->m2 += delta * (deviation - jitter->mean_us);
+
+  uint64_t magnitude = deviation < 0 ? -deviation : deviation;
+  int bucket = 0;
+  while (magnitude > 1 && bucket < RT_JITTER_BUCKETS - 1) {
+    magnitude >>= 1;
+    bucket++;
+  }
+  jitter->histogram[bucket]++;
+}
+
+void rt_jitter_report(const rt_jitter_t *jitter, FILE *file) {
+  if (jitter->count == 0) {
+    fprintf(file, "%s: no samples\n", jitter->name);
+    return;
+  }
+  double stddev = jitter->count > 1 ? sqrt(jitter->m2 / (jitter->count - 1))
+                                    : 0.0;
+  fprintf(file,
+          "%s: period %" PRIu64 " us, %" PRIu64 " samples, deviation min %" PRId64
+          " max %" PRId64 " mean %.1f stddev %.1f us\n",
+          jitter->name, jitter->expected_us, jitter->count, jitter->min_us,
+          jitter->max_us, jitter->mean_us, stddev);
+  for (int i = 0; i < RT_JITTER_BUCKETS; i++) {
+    if (jitter->histogram[i] != 0) {
+      fprintf(file, "  < %6u us: %" PRIu64 "\n", 2u << i,
+              jitter->histogram[i]);
+    }
+  }
+}
@@ -0,0 +1,407 @@
+#include "rtcm.h"
+#include "config.h"
+#include "defines.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RTCM_PREAMBLE (0xD3)
+#define RTCM_CRC24Q_POLY (0x1864CFB)
+#define RTCM_REPORT_US (10000000)
+
+static uint32_t crc24q_table[256];
+
+static void rtcm_crc_init(void) {
+  for (int i = 0; i < 256; i++) {
+    uint32_t crc = i << 16;
+    for (int bit = 0; bit < 8; bit++) {
+      crc <<= 1;
+      if (crc & 0x1000000) {
+        crc ^= RTCM_CRC24Q_POLY;
+      }
+    }
+    crc24q_table[i] = crc & 0xFFFFFF;
+  }
+}
+
+static uint32_t rtcm_crc24q(const unsigned char *data, int size) {
+  uint32_t crc = 0;
+  for (int i = 0; i < size; i++) {
+    crc = ((crc << 8) & 0xFFFFFF) ^ crc24q_table[(crc >> 16) ^ data[i]];
+  }
+  return crc;
+}
+
+void rtcm_config_default(rtcm_config_t *config) {
+  memset(config, 0, sizeof(rtcm_config_t));
+}
+
+int rtcm_config_handler(void *user, const char *section, const char *key,
+                        const char *value) {
+  rtcm_config_t *config = (rtcm_config_t *)user;
+  if (strcmp(section, "rtcm") != 0) {
+    return 0;
+  }
+  if (strcmp(key, "enabled") == 0) {
+    return config_bool(value, &config->enabled);
+  }
+  if (strcmp(key, "source") == 0) {
+    snprintf(config->source, sizeof(config->source), "%s", value);
+    return 0;
+  }
+  if (strcmp(key, "receiver") == 0) {
+    snprintf(config->receiver, sizeof(config->receiver), "%s", value);
+    return 0;
+  }
+  return -1;
+}
+
+static int rtcm_parse_source(rtcm_t *rtcm) {
+  const char *source = rtcm->config.source;
+  const char *address;
+  if (strncmp(source, "tcp://", 6) == 0) {
+    rtcm->type = RTCM_SOURCE_TCP;
+    address = source + 6;
+  } else if (strncmp(source, "udp://", 6) == 0) {
+    rtcm->type = RTCM_SOURCE_UDP;
+    address = source + 6;
+  } else {
+    rtcm->type = RTCM_SOURCE_FILE;
+    return source[0] == '\0' ? -1 : 0;
+  }
+
+  const char *colon = strrchr(address, ':');
+  if (colon == NULL || colon - address >= (int)sizeof(rtcm->host)) {
+    return -1;
+  }
+  snprintf(rtcm->host, colon - address + 1, "%s", address);
+  if (rtcm->host[0] == '\0') {
+    snprintf(rtcm->host, sizeof(rtcm->host), "127.0.0.1");
+  }
+  return config_int(colon + 1, &rtcm->port);
+}
+
+static int rtcm_socket_open(rtcm_t *rtcm) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = rtcm->type == RTCM_SOURCE_TCP ? SOCK_STREAM : SOCK_DGRAM;
+  if (getaddrinfo(rtcm->host, NULL, &hints, &res) != 0) {
+    fprintf(stderr, "Could not resolve %s\n", rtcm->host);
+    return -1;
+  }
+  struct sockaddr_in addr;
+  memcpy(&addr, res->ai_addr, sizeof(addr));
+  addr.sin_port = htons(rtcm->port);
+  freeaddrinfo(res);
+
+  int fd = socket(AF_INET, hints.ai_socktype | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    perror("Could not open RTCM socket");
+    return -1;
+  }
+  if (rtcm->type == RTCM_SOURCE_UDP) {
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      perror("Could not bind RTCM socket");
+      close(fd);
+      return -1;
+    }
+  } else if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (errno != EINPROGRESS) {
+      close(fd);
+      return -1;
+    }
+    rtcm->connecting = 1;
+  }
+  return fd;
+}
+
+static int rtcm_source_open(rtcm_t *rtcm) {
+  if (rtcm->type == RTCM_SOURCE_FILE) {
+    // Non-blocking so a FIFO without writer does not stop the loop
+    rtcm->in_fd = open(rtcm->config.source, O_RDONLY | O_NONBLOCK);
+  } else {
+    rtcm->in_fd = rtcm_socket_open(rtcm);
+  }
+  if (rtcm->in_fd == -1) {
+    return -1;
+  }
+  printf("RTCM source open [%s]\n", rtcm->config.source);
+  return 0;
+}
+
+static void rtcm_queue(rtcm_t *rtcm, const unsigned char *frame, int size) {
+  if (rtcm->out_fd == -1 ||
+      rtcm->out_size + size > (int)sizeof(rtcm->out)) {
+    rtcm->dropped++;
+    return;
+  }
+  memcpy(rtcm->out + rtcm->out_size, frame, size);
+  rtcm->out_size += size;
+}
+
+static int rtcm_output_open(rtcm_t *rtcm) {
+  // A second descriptor on the port, the reader keeps its own
+  rtcm->out_fd = open(rtcm->tty, O_WRONLY | O_NOCTTY | O_NONBLOCK);
+  if (rtcm->out_fd == -1) {
+    return -1;
+  }
+  rtcm->out_size = 0;
+  if (rtcm->station_size > 0) {
+    rtcm_queue(rtcm, rtcm->station, rtcm->station_size);
+  }
+  return 0;
+}
+
+static void rtcm_retry(rtcm_t *rtcm, uint64_t t) {
+  rtcm->retry_t = t + rtcm->backoff_us;
+  rtcm->backoff_us = rtcm->backoff_us * 2 < FAULT_BACKOFF_MAX_US
+                         ? rtcm->backoff_us * 2
+                         : FAULT_BACKOFF_MAX_US;
+}
+
+static void rtcm_source_close(rtcm_t *rtcm, uint64_t t) {
+  close(rtcm->in_fd);
+  rtcm->in_fd = -1;
+  rtcm->connecting = 0;
+  rtcm->in_size = 0;
+  rtcm->reconnects++;
+  rtcm_retry(rtcm, t);
+}
+
+int rtcm_open(rtcm_t *rtcm, const rtcm_config_t *config, const char *tty) {
+  memset(rtcm, 0, sizeof(rtcm_t));
+  rtcm->config = *config;
+  rtcm->in_fd = -1;
+  rtcm->out_fd = -1;
+  if (!config->enabled) {
+    return 0;
+  }
+  if (rtcm_parse_source(rtcm) == -1) {
+    fprintf(stderr, "Invalid RTCM source %s\n", config->source);
+    rtcm->config.enabled = 0;
+    return -1;
+  }
+  rtcm_crc_init();
+  snprintf(rtcm->tty, sizeof(rtcm->tty), "%s", tty);
+  rtcm->backoff_us = FAULT_BACKOFF_MIN_US;
+  printf("RTCM corrections from %s to %s\n", config->source, tty);
+  return 0;
+}
+
+// Reading stops while the port is behind, instead of dropping frames
+static int rtcm_can_read(const rtcm_t *rtcm) {
+  return rtcm->out_size + RTCM_BUFFER_SIZE <= (int)sizeof(rtcm->out);
+}
+
+int rtcm_pollfds(const rtcm_t *rtcm, struct pollfd *pfds) {
+  int count = 0;
+  if (rtcm->in_fd != -1 && (rtcm->connecting || rtcm_can_read(rtcm))) {
+    pfds[count].fd = rtcm->in_fd;
+    pfds[count].events = rtcm->connecting ? POLLOUT : POLLIN;
+    pfds[count].revents = 0;
+    count++;
+  }
+  if (rtcm->out_fd != -1 && rtcm->out_size > 0) {
+    pfds[count].fd = rtcm->out_fd;
+    pfds[count].events = POLLOUT;
+    pfds[count].revents = 0;
+    count++;
+  }
+  return count;
+}
+
+static void rtcm_forward(rtcm_t *rtcm, const unsigned char *frame, int size,
+                         uint64_t t) {
+  int type = (frame[3] << 4) | (frame[4] >> 4);
+  if ((type == 1005 || type == 1006) && size <= RTCM_MAX_FRAME) {
+    memcpy(rtcm->station, frame, size);
+    rtcm->station_size = size;
+  }
+  if (rtcm->frames == 0) {
+    rtcm->start_t = t;
+  } else if (t - rtcm->last_frame_t > rtcm->max_age_us) {
+    rtcm->max_age_us = t - rtcm->last_frame_t;
+  }
+  rtcm->last_frame_t = t;
+  rtcm->frames++;
+  rtcm->bytes += size;
+  rtcm->window_frames++;
+  rtcm->window_bytes += size;
+  rtcm_queue(rtcm, frame, size);
+}
+
+// Forwards the complete frames in the input buffer, skips garbage
+static void rtcm_parse(rtcm_t *rtcm, uint64_t t) {
+  int offset = 0;
+  while (rtcm->in_size - offset >= 3) {
+    const unsigned char *frame = rtcm->in + offset;
+    if (frame[0] != RTCM_PREAMBLE || (frame[1] & 0xFC) != 0) {
+      offset++;
+      continue;
+    }
+    int size = 3 + (((frame[1] & 0x03) << 8) | frame[2]) + 3;
+    if (rtcm->in_size - offset < size) {
+      break;
+    }
+    uint32_t crc = (frame[size - 3] << 16) | (frame[size - 2] << 8) |
+                   frame[size - 1];
+    if (rtcm_crc24q(frame, size - 3) != crc) {
+      rtcm->crc_errors++;
+      offset++;
+      continue;
+    }
+    rtcm_forward(rtcm, frame, size, t);
+    offset += size;
+  }
+  memmove(rtcm->in, rtcm->in + offset, rtcm->in_size - offset);
+  rtcm->in_size -= offset;
+}
+
+static void rtcm_read(rtcm_t *rtcm, uint64_t t) {
+  if (rtcm->connecting) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    struct pollfd pfd = {.fd = rtcm->in_fd, .events = POLLOUT};
+    if (poll(&pfd, 1, 0) <= 0) {
+      return;
+    }
+    if (getsockopt(rtcm->in_fd, SOL_SOCKET, SO_ERROR, &error, &length) ==
+            -1 ||
+        error != 0) {
+      rtcm_source_close(rtcm, t);
+      return;
+    }
+    rtcm->connecting = 0;
+  }
+
+  while (rtcm_can_read(rtcm)) {
+    ssize_t res = read(rtcm->in_fd, rtcm->in + rtcm->in_size,
+                       sizeof(rtcm->in) - rtcm->in_size);
+    if (res > 0) {
+      rtcm->in_size += res;
+      rtcm_parse(rtcm, t);
+      if (rtcm->in_size == (int)sizeof(rtcm->in)) {
+        // Cannot be a frame anymore
+        rtcm->in_size = 0;
+      }
+      continue;
+    }
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (res == 0 && rtcm->type == RTCM_SOURCE_UDP) {
+      return;
+    }
+
+    struct stat st;
+    if (res == 0 && rtcm->type == RTCM_SOURCE_FILE &&
+        fstat(rtcm->in_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      printf("RTCM file forwarded [%s]\n", rtcm->config.source);
+      close(rtcm->in_fd);
+      rtcm->in_fd = -1;
+      rtcm->finished = 1;
+      return;
+    }
+    // Writer or server gone
+    rtcm_source_close(rtcm, t);
+    return;
+  }
+}
+
+static void rtcm_write(rtcm_t *rtcm, uint64_t t) {
+  while (rtcm->out_size > 0) {
+    ssize_t res = write(rtcm->out_fd, rtcm->out, rtcm->out_size);
+    if (res > 0) {
+      memmove(rtcm->out, rtcm->out + res, rtcm->out_size - res);
+      rtcm->out_size -= res;
+      continue;
+    }
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    perror("Could not write RTCM to receiver");
+    close(rtcm->out_fd);
+    rtcm->out_fd = -1;
+    rtcm->out_size = 0;
+    rtcm_retry(rtcm, t);
+    return;
+  }
+}
+
+void rtcm_service(rtcm_t *rtcm, uint64_t t) {
+  if (!rtcm->config.enabled) {
+    return;
+  }
+  if ((rtcm->out_fd == -1 || (rtcm->in_fd == -1 && !rtcm->finished)) &&
+      t >= rtcm->retry_t) {
+    int res = 0;
+    if (rtcm->out_fd == -1) {
+      res |= rtcm_output_open(rtcm);
+    }
+    if (rtcm->in_fd == -1 && !rtcm->finished) {
+      res |= rtcm_source_open(rtcm);
+    }
+    if (res == -1) {
+      rtcm_retry(rtcm, t);
+    } else {
+      rtcm->backoff_us = FAULT_BACKOFF_MIN_US;
+    }
+  }
+
+  if (rtcm->in_fd != -1) {
+    rtcm_read(rtcm, t);
+  }
+  if (rtcm->out_fd != -1) {
+    rtcm_write(rtcm, t);
+  }
+
+  if (t - rtcm->report_t >= RTCM_REPORT_US) {
+    double elapsed = (t - rtcm->report_t) * 1e-6;
+    if (rtcm->report_t != 0 && rtcm->frames > 0) {
+      printf("RTCM: %.2f kB/s, %.1f frames/s, age %.1f s\n",
+             rtcm->window_bytes / elapsed * 1e-3,
+             rtcm->window_frames / elapsed, rtcm_age_us(rtcm, t) * 1e-6);
+    }
+    rtcm->report_t = t;
+    rtcm->window_bytes = 0;
+    rtcm->window_frames = 0;
+  }
+}
+
+uint64_t rtcm_age_us(const rtcm_t *rtcm, uint64_t t) {
+  return rtcm->frames > 0 ? t - rtcm->last_frame_t : 0;
+}
+
+void rtcm_report(const rtcm_t *rtcm, FILE *file) {
+  if (!rtcm->config.enabled) {
+    return;
+  }
+  double elapsed = (rtcm->last_frame_t - rtcm->start_t) * 1e-6;
+  fprintf(file,
+          "rtcm: %" PRIu64 " frames, %" PRIu64 " bytes (%.2f kB/s), %" PRIu64
+          " crc errors, %" PRIu64 " dropped, %" PRIu64
+          " reconnects, max age %.1f s\n",
+          rtcm->frames, rtcm->bytes,
+          elapsed > 0.0 ? rtcm->bytes / elapsed * 1e-3 : 0.0,
+          rtcm->crc_errors, rtcm->dropped, rtcm->reconnects,
+          rtcm->max_age_us * 1e-6);
+}
+
+void rtcm_close(rtcm_t *rtcm) {
+  if (rtcm->in_fd != -1) {
+    close(rtcm->in_fd);
+    rtcm->in_fd = -1;
+  }
+  if (rtcm->out_fd != -1) {
+    close(rtcm->out_fd);
+    rtcm->out_fd = -1;
+  }
+}
@@ -0,0 +1,68 @@
+#include "seglog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int seglog_init(seglog_t *log, size_t item_size, size_t block_items) {
+  memset(log, 0, sizeof(seglog_t));
+  if (item_size == 0 || block_items == 0) {
+    return -1;
+  }
+  log->item_size = item_size;
+  log->block_items = block_items;
+  return 0;
+}
+
+void seglog_free(seglog_t *log) {
+  for (int i = 0; i < SEGLOG_MAX_BLOCKS; i++) {
+    free(log->blocks[i]);
+    log->blocks[i] = NULL;
+  }
+  log->length = 0;
+}
+
+int seglog_append(seglog_t *log, const void *item) {
+  size_t i = log->length;
+  size_t b = i / log->block_items;
+  if (b >= SEGLOG_MAX_BLOCKS) {
+    return -1;
+  }
+  if (log->blocks[b] == NULL) {
+    // Only the writer touches blocks past the published length
+    log->blocks[b] = malloc(log->block_items * log->item_size);
+    if (log->blocks[b] == NULL) {
+      perror("Could not allocate log block");
+      return -1;
+    }
+  }
+  memcpy((char *)log->blocks[b] + (i % log->block_items) * log->item_size,
+         item, log->item_size);
+  __atomic_store_n(&log->length, i + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+size_t seglog_length(const seglog_t *log) {
+  return __atomic_load_n(&log->length, __ATOMIC_ACQUIRE);
+}
+
+void *seglog_get(const seglog_t *log, size_t i) {
+  return (char *)log->blocks[i / log->block_items] +
+         (i % log->block_items) * log->item_size;
+}
+
+void *seglog_block(const seglog_t *log, size_t b, size_t length,
+                   size_t *count) {
+  size_t first = b * log->block_items;
+  if (first >= length) {
+    *count = 0;
+    return NULL;
+  }
+  *count = length - first < log->block_items ? length - first
+                                             : log->block_items;
+  return log->blocks[b];
+}
+
+size_t seglog_block_count(const seglog_t *log, size_t length) {
+  return (length + log->block_items - 1) / log->block_items;
+}
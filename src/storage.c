@@ -0,0 +1,400 @@
+#include "storage.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *storage_durability_to_string(storage_durability_t durability) {
+  switch (durability) {
+  case STORAGE_BUFFERED:
+    return "buffered";
+  case STORAGE_FLUSH:
+    return "flush";
+  case STORAGE_SYNC:
+    return "sync";
+  default:
+    return "unknown";
+  }
+}
+
+// Writes what the asynchronous write left out, returns -1 on error
+static int storage_write_remainder(storage_t *storage, storage_block_t *block,
+                                   ssize_t done) {
+  while (done >= 0 && (size_t)done < block->size) {
+    ssize_t res = pwrite(storage->fd, block->data + done, block->size - done,
+                         block->offset + done);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return -1;
+    }
+    done += res;
+  }
+  return done < 0 ? -1 : 0;
+}
+
+#ifndef ACR_NO_URING
+
+static int storage_uring_start(storage_t *storage) {
+  int res = io_uring_queue_init(STORAGE_BLOCKS, &storage->ring, 0);
+  if (res < 0) {
+    fprintf(stderr, "Could not setup io_uring: %s\n", strerror(-res));
+    return -1;
+  }
+  return 0;
+}
+
+static void storage_complete(storage_t *storage, struct io_uring_cqe *cqe) {
+  intptr_t index = (intptr_t)io_uring_cqe_get_data(cqe);
+  storage_block_t *block = &storage->blocks[index];
+  int res = cqe->res;
+  io_uring_cqe_seen(&storage->ring, cqe);
+  if (res < 0 || storage_write_remainder(storage, block, res) == -1) {
+    storage->stats.errors++;
+  }
+  block->inflight = 0;
+  storage->inflight--;
+}
+
+static void storage_reap(storage_t *storage, int wait) {
+  struct io_uring_cqe *cqe;
+  if (wait && io_uring_wait_cqe(&storage->ring, &cqe) == 0) {
+    storage_complete(storage, cqe);
+  }
+  while (io_uring_peek_cqe(&storage->ring, &cqe) == 0) {
+    storage_complete(storage, cqe);
+  }
+}
+
+static void storage_uring_submit(storage_t *storage, int index) {
+  struct io_uring_sqe *sqe;
+  while ((sqe = io_uring_get_sqe(&storage->ring)) == NULL) {
+    storage_reap(storage, 1);
+  }
+  storage_block_t *block = &storage->blocks[index];
+  block->inflight = 1;
+  storage->inflight++;
+  io_uring_prep_write(sqe, storage->fd, block->data, block->size,
+                      block->offset);
+  io_uring_sqe_set_data(sqe, (void *)(intptr_t)index);
+  io_uring_submit(&storage->ring);
+}
+
+static void storage_uring_wait_block(storage_t *storage, int index) {
+  storage_reap(storage, 0);
+  while (storage->blocks[index].inflight) {
+    storage_reap(storage, 1);
+  }
+}
+
+static void storage_uring_wait_all(storage_t *storage) {
+  while (storage->inflight > 0) {
+    storage_reap(storage, 1);
+  }
+}
+
+static void storage_uring_stop(storage_t *storage) {
+  io_uring_queue_exit(&storage->ring);
+}
+
+#endif // ACR_NO_URING
+
+static void *storage_writer(void *arg) {
+  storage_t *storage = (storage_t *)arg;
+  pthread_mutex_lock(&storage->lock);
+  while (!storage->stop || storage->queue_size > 0) {
+    if (storage->queue_size == 0) {
+      pthread_cond_wait(&storage->cond, &storage->lock);
+      continue;
+    }
+    int index = storage->queue[storage->queue_head];
+    storage->queue_head = (storage->queue_head + 1) % STORAGE_BLOCKS;
+    storage->queue_size--;
+    pthread_mutex_unlock(&storage->lock);
+
+    int res = storage_write_remainder(storage, &storage->blocks[index], 0);
+
+    pthread_mutex_lock(&storage->lock);
+    if (res == -1) {
+      storage->stats.errors++;
+    }
+    storage->blocks[index].inflight = 0;
+    storage->inflight--;
+    pthread_cond_broadcast(&storage->cond);
+  }
+  pthread_mutex_unlock(&storage->lock);
+  return NULL;
+}
+
+static int storage_thread_start(storage_t *storage) {
+  pthread_mutex_init(&storage->lock, NULL);
+  pthread_cond_init(&storage->cond, NULL);
+  storage->queue_head = 0;
+  storage->queue_size = 0;
+  storage->stop = 0;
+  if (pthread_create(&storage->thread, NULL, storage_writer, storage) != 0) {
+    perror("Could not start the writer thread");
+    return -1;
+  }
+  return 0;
+}
+
+static void storage_thread_submit(storage_t *storage, int index) {
+  pthread_mutex_lock(&storage->lock);
+  storage->blocks[index].inflight = 1;
+  storage->inflight++;
+  int tail = (storage->queue_head + storage->queue_size) % STORAGE_BLOCKS;
+  storage->queue[tail] = index;
+  storage->queue_size++;
+  pthread_cond_broadcast(&storage->cond);
+  pthread_mutex_unlock(&storage->lock);
+}
+
+static void storage_thread_wait_block(storage_t *storage, int index) {
+  pthread_mutex_lock(&storage->lock);
+  while (storage->blocks[index].inflight) {
+    pthread_cond_wait(&storage->cond, &storage->lock);
+  }
+  pthread_mutex_unlock(&storage->lock);
+}
+
+static void storage_thread_wait_all(storage_t *storage) {
+  pthread_mutex_lock(&storage->lock);
+  while (storage->inflight > 0) {
+    pthread_cond_wait(&storage->cond, &storage->lock);
+  }
+  pthread_mutex_unlock(&storage->lock);
+}
+
+static void storage_thread_stop(storage_t *storage) {
+  pthread_mutex_lock(&storage->lock);
+  storage->stop = 1;
+  pthread_cond_broadcast(&storage->cond);
+  pthread_mutex_unlock(&storage->lock);
+  pthread_join(storage->thread, NULL);
+  pthread_mutex_destroy(&storage->lock);
+  pthread_cond_destroy(&storage->cond);
+}
+
+static int storage_backend_start(storage_t *storage) {
+#ifndef ACR_NO_URING
+  // Old kernels, seccomp or a low RLIMIT_MEMLOCK refuse io_uring
+  static int uring_failed = 0;
+  if (!uring_failed) {
+    if (storage_uring_start(storage) == 0) {
+      storage->uring = 1;
+      return 0;
+    }
+    uring_failed = 1;
+    fprintf(stderr, "Using the writer thread instead of io_uring\n");
+  }
+#endif // ACR_NO_URING
+  storage->uring = 0;
+  return storage_thread_start(storage);
+}
+
+static void storage_submit(storage_t *storage, int index) {
+#ifndef ACR_NO_URING
+  if (storage->uring) {
+    storage_uring_submit(storage, index);
+    return;
+  }
+#endif // ACR_NO_URING
+  storage_thread_submit(storage, index);
+}
+
+static void storage_wait_block(storage_t *storage, int index) {
+#ifndef ACR_NO_URING
+  if (storage->uring) {
+    storage_uring_wait_block(storage, index);
+    return;
+  }
+#endif // ACR_NO_URING
+  storage_thread_wait_block(storage, index);
+}
+
+static void storage_wait_all(storage_t *storage) {
+#ifndef ACR_NO_URING
+  if (storage->uring) {
+    storage_uring_wait_all(storage);
+    return;
+  }
+#endif // ACR_NO_URING
+  storage_thread_wait_all(storage);
+}
+
+static void storage_backend_stop(storage_t *storage) {
+#ifndef ACR_NO_URING
+  if (storage->uring) {
+    storage_uring_stop(storage);
+    return;
+  }
+#endif // ACR_NO_URING
+  storage_thread_stop(storage);
+}
+
+// Frees the blocks and closes the file, nothing must be in flight
+static void storage_release(storage_t *storage) {
+  for (int i = 0; i < STORAGE_BLOCKS; i++) {
+    free(storage->blocks[i].data);
+    storage->blocks[i].data = NULL;
+  }
+  if (storage->fd != -1) {
+    close(storage->fd);
+    storage->fd = -1;
+  }
+}
+
+int storage_open(storage_t *storage, const char *path,
+                 storage_durability_t durability) {
+  int fd = open(path, O_WRONLY | O_CREAT, 0644);
+  if (fd == -1) {
+    perror("Could not open storage file");
+    return -1;
+  }
+  return storage_open_fd(storage, fd, durability);
+}
+
+int storage_open_fd(storage_t *storage, int fd,
+                    storage_durability_t durability) {
+  memset(storage, 0, sizeof(storage_t));
+  storage->durability = durability;
+  storage->fd = fd;
+  storage->offset = lseek(storage->fd, 0, SEEK_END);
+
+  // The other blocks are allocated when the file needs them
+  if (posix_memalign((void **)&storage->blocks[0].data, STORAGE_ALIGNMENT,
+                     STORAGE_BLOCK_SIZE) != 0) {
+    perror("Could not allocate storage blocks");
+    storage_release(storage);
+    return -1;
+  }
+  if (storage_backend_start(storage) == -1) {
+    storage_release(storage);
+    return -1;
+  }
+  return 0;
+}
+
+// Submits the current block and moves to the next free one
+static void storage_next_block(storage_t *storage) {
+  storage_block_t *block = &storage->blocks[storage->current];
+  if (block->size == 0) {
+    return;
+  }
+  block->offset = storage->offset;
+  storage->offset += block->size;
+  storage->stats.bytes += block->size;
+  storage->stats.writes++;
+  storage_submit(storage, storage->current);
+  if ((uint64_t)storage->inflight > storage->stats.max_inflight) {
+    storage->stats.max_inflight = storage->inflight;
+  }
+
+  storage->current = (storage->current + 1) % STORAGE_BLOCKS;
+  storage_block_t *next = &storage->blocks[storage->current];
+  if (next->data == NULL &&
+      posix_memalign((void **)&next->data, STORAGE_ALIGNMENT,
+                     STORAGE_BLOCK_SIZE) != 0) {
+    // Out of memory, wait for the block just submitted and reuse it
+    next->data = NULL;
+    storage->current = (storage->current + STORAGE_BLOCKS - 1) % STORAGE_BLOCKS;
+  }
+  if (__atomic_load_n(&storage->blocks[storage->current].inflight,
+                      __ATOMIC_ACQUIRE)) {
+    // Backpressure, the card is slower than the data
+    uint64_t t = get_t();
+    storage_wait_block(storage, storage->current);
+    storage->stats.waits++;
+    storage->stats.wait_us += get_t() - t;
+  }
+  storage->blocks[storage->current].size = 0;
+}
+
+int storage_write(storage_t *storage, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  while (size > 0) {
+    storage_block_t *block = &storage->blocks[storage->current];
+    size_t free_size = STORAGE_BLOCK_SIZE - block->size;
+    size_t chunk = size < free_size ? size : free_size;
+    memcpy(block->data + block->size, bytes, chunk);
+    block->size += chunk;
+    bytes += chunk;
+    size -= chunk;
+    if (block->size == STORAGE_BLOCK_SIZE) {
+      storage_next_block(storage);
+    }
+  }
+  return storage->stats.errors == 0 ? 0 : -1;
+}
+
+int storage_printf(storage_t *storage, const char *format, ...) {
+  storage_block_t *block = &storage->blocks[storage->current];
+  size_t free_size = STORAGE_BLOCK_SIZE - block->size;
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf((char *)block->data + block->size, free_size, format,
+                       args);
+  va_end(args);
+  if (size < 0) {
+    return -1;
+  }
+  if ((size_t)size < free_size) {
+    block->size += size;
+    if (block->size == STORAGE_BLOCK_SIZE) {
+      storage_next_block(storage);
+    }
+    return 0;
+  }
+
+  // Does not fit in what is left of the block, format it on the side
+  char line[1024];
+  va_start(args, format);
+  size = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (size >= (int)sizeof(line)) {
+    size = sizeof(line) - 1;
+  }
+  return storage_write(storage, line, size);
+}
+
+int storage_flush(storage_t *storage) {
+  if (storage->durability == STORAGE_BUFFERED) {
+    return 0;
+  }
+  storage_next_block(storage);
+  if (storage->durability == STORAGE_SYNC) {
+    storage_wait_all(storage);
+    if (fdatasync(storage->fd) == -1) {
+      perror("Could not sync storage file");
+      return -1;
+    }
+  }
+  return storage->stats.errors == 0 ? 0 : -1;
+}
+
+int storage_close(storage_t *storage) {
+  if (storage->fd == -1) {
+    return 0;
+  }
+  storage_next_block(storage);
+  storage_wait_all(storage);
+  storage_backend_stop(storage);
+  storage_release(storage);
+  return storage->stats.errors == 0 ? 0 : -1;
+}
+
+void storage_report(const storage_t *storage, const char *name, FILE *file) {
+  const storage_stats_t *stats = &storage->stats;
+  fprintf(file,
+          "%s: %" PRIu64 " bytes in %" PRIu64 " writes, max in flight %" PRIu64
+          ", waited %" PRIu64 " times for %.1f ms, %" PRIu64 " errors\n",
+          name, stats->bytes, stats->writes, stats->max_inflight, stats->waits,
+          stats->wait_us * 1e-3, stats->errors);
+}
@@ -0,0 +1,364 @@
+#include "telemetry.h"
+#include "config.h"
+#include "utils.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TELEMETRY_RESUBSCRIBE_US (2000000)
+
+void telemetry_config_default(telemetry_config_t *config) {
+  memset(config, 0, sizeof(telemetry_config_t));
+  config->port = 5005;
+  config->destination_port = 5006;
+  config->multicast_ttl = 1;
+}
+
+int telemetry_config_handler(void *user, const char *section, const char *key,
+                             const char *value) {
+  telemetry_config_t *config = (telemetry_config_t *)user;
+  if (strcmp(section, "telemetry") != 0) {
+    return 0;
+  }
+  if (strcmp(key, "enabled") == 0) {
+    return config_bool(value, &config->enabled);
+  }
+  if (strcmp(key, "port") == 0) {
+    return config_int(value, &config->port);
+  }
+  if (strcmp(key, "destination") == 0) {
+    snprintf(config->destination, sizeof(config->destination), "%s", value);
+    return 0;
+  }
+  if (strcmp(key, "destination_port") == 0) {
+    return config_int(value, &config->destination_port);
+  }
+  if (strcmp(key, "destination_rate_hz") == 0) {
+    return config_double(value, &config->destination_rate_hz);
+  }
+  if (strcmp(key, "multicast_ttl") == 0) {
+    return config_int(value, &config->multicast_ttl);
+  }
+  return -1;
+}
+
+static int telemetry_resolve(const char *host, int port,
+                             struct sockaddr_in *addr) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+    fprintf(stderr, "Could not resolve %s\n", host);
+    return -1;
+  }
+  memcpy(addr, res->ai_addr, sizeof(struct sockaddr_in));
+  addr->sin_port = htons(port);
+  freeaddrinfo(res);
+  return 0;
+}
+
+static void telemetry_header(telemetry_header_t *header, telemetry_type_t type,
+                             uint32_t seq, uint64_t timestamp) {
+  header->magic = TELEMETRY_MAGIC;
+  header->version = TELEMETRY_VERSION;
+  header->type = type;
+  header->seq = seq;
+  header->timestamp = timestamp;
+}
+
+static int telemetry_header_valid(const void *buffer, int size) {
+  const telemetry_header_t *header = (const telemetry_header_t *)buffer;
+  return size >= (int)sizeof(telemetry_header_t) &&
+         header->magic == TELEMETRY_MAGIC &&
+         header->version == TELEMETRY_VERSION;
+}
+
+int telemetry_open(telemetry_t *telemetry, const telemetry_config_t *config) {
+  memset(telemetry, 0, sizeof(telemetry_t));
+  telemetry->fd = -1;
+  if (!config->enabled) {
+    return 0;
+  }
+  telemetry->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (telemetry->fd == -1) {
+    perror("Could not open telemetry socket");
+    return -1;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(config->port);
+  if (bind(telemetry->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    perror("Could not bind telemetry socket");
+    close(telemetry->fd);
+    telemetry->fd = -1;
+    return -1;
+  }
+
+  if (config->destination[0] != '\0') {
+    telemetry_subscriber_t *sub = &telemetry->subscribers[0];
+    if (telemetry_resolve(config->destination, config->destination_port,
+                          &sub->addr) == -1) {
+      close(telemetry->fd);
+      telemetry->fd = -1;
+      return -1;
+    }
+    if (IN_MULTICAST(ntohl(sub->addr.sin_addr.s_addr))) {
+      unsigned char ttl = config->multicast_ttl;
+      setsockopt(telemetry->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                 sizeof(ttl));
+    }
+    sub->active = 1;
+    sub->permanent = 1;
+    sub->interval_us = config->destination_rate_hz > 0.0
+                           ? 1e6 / config->destination_rate_hz
+                           : 0;
+  }
+  printf("Telemetry on port %d\n", config->port);
+  return 0;
+}
+
+static telemetry_subscriber_t *telemetry_find(telemetry_t *telemetry,
+                                              const struct sockaddr_in *addr) {
+  telemetry_subscriber_t *free_slot = NULL;
+  for (int i = 0; i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    telemetry_subscriber_t *sub = &telemetry->subscribers[i];
+    if (!sub->active) {
+      if (free_slot == NULL) {
+        free_slot = sub;
+      }
+      continue;
+    }
+    if (!sub->permanent && sub->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+        sub->addr.sin_port == addr->sin_port) {
+      return sub;
+    }
+  }
+  if (free_slot != NULL) {
+    memset(free_slot, 0, sizeof(telemetry_subscriber_t));
+    free_slot->addr = *addr;
+  }
+  return free_slot;
+}
+
+void telemetry_poll(telemetry_t *telemetry, uint64_t t) {
+  if (telemetry->fd == -1) {
+    return;
+  }
+
+  telemetry_subscribe_t request;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  ssize_t size;
+  while ((size = recvfrom(telemetry->fd, &request, sizeof(request),
+                          MSG_DONTWAIT, (struct sockaddr *)&addr,
+                          &addr_len)) > 0) {
+    addr_len = sizeof(addr);
+    if (size != sizeof(request) || !telemetry_header_valid(&request, size) ||
+        request.header.type != TELEMETRY_SUBSCRIBE) {
+      continue;
+    }
+    telemetry_subscriber_t *sub = telemetry_find(telemetry, &addr);
+    if (sub == NULL) {
+      continue;
+    }
+    if (!sub->active) {
+      printf("Telemetry subscriber %s:%d at %.1f Hz\n",
+             inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), request.rate_hz);
+    }
+    sub->active = 1;
+    sub->interval_us = request.rate_hz > 0.0f ? 1e6 / request.rate_hz : 0;
+    sub->last_seen_t = t;
+  }
+
+  for (int i = 0; i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    telemetry_subscriber_t *sub = &telemetry->subscribers[i];
+    if (sub->active && !sub->permanent &&
+        t - sub->last_seen_t > TELEMETRY_SUBSCRIBER_TIMEOUT_US) {
+      sub->active = 0;
+    }
+  }
+}
+
+static void telemetry_send(telemetry_t *telemetry, telemetry_subscriber_t *sub,
+                           telemetry_header_t *header, int size) {
+  header->seq = sub->seq++;
+  ssize_t res = sendto(telemetry->fd, header, size, MSG_DONTWAIT,
+                       (struct sockaddr *)&sub->addr, sizeof(sub->addr));
+  if (res == size) {
+    telemetry->sent++;
+  } else {
+    telemetry->dropped++;
+  }
+}
+
+void telemetry_send_position(telemetry_t *telemetry,
+                             const gps_parsed_data_t *gps_data,
+                             const full_session_t *session,
+                             const cone_session_t *cone_session, uint64_t t) {
+  if (telemetry->fd == -1) {
+    return;
+  }
+  telemetry_position_t position;
+  memset(&position, 0, sizeof(telemetry_position_t));
+  telemetry_header(&position.header, TELEMETRY_POSITION, 0,
+                   gps_data->hpposllh._timestamp);
+  position.lat = gps_data->hpposllh.lat;
+  position.lon = gps_data->hpposllh.lon;
+  position.alt = gps_data->hpposllh.height;
+  position.h_acc = gps_data->hpposllh.hAcc;
+  position.trajectory_active = session->active;
+  position.cone_session_active = cone_session->active;
+  if (session->active) {
+    strncpy(position.trajectory_name, session->session_name,
+            sizeof(position.trajectory_name) - 1);
+  }
+  if (cone_session->active) {
+    strncpy(position.cone_session_name, cone_session->session_name,
+            sizeof(position.cone_session_name) - 1);
+  }
+
+  for (int i = 0; i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    telemetry_subscriber_t *sub = &telemetry->subscribers[i];
+    if (!sub->active) {
+      continue;
+    }
+    if (sub->interval_us != 0 && t - sub->last_sent_t < sub->interval_us) {
+      telemetry->decimated++;
+      continue;
+    }
+    sub->last_sent_t = t;
+    telemetry_send(telemetry, sub, &position.header, sizeof(position));
+  }
+}
+
+void telemetry_send_cone(telemetry_t *telemetry, const cone_t *cone) {
+  if (telemetry->fd == -1) {
+    return;
+  }
+  telemetry_cone_t packet;
+  telemetry_header(&packet.header, TELEMETRY_CONE, 0, cone->timestamp);
+  packet.id = cone->id;
+  packet.lat = cone->lat;
+  packet.lon = cone->lon;
+  packet.alt = cone->alt;
+
+  // Cone events are never decimated
+  for (int i = 0; i < TELEMETRY_MAX_SUBSCRIBERS; i++) {
+    if (telemetry->subscribers[i].active) {
+      telemetry_send(telemetry, &telemetry->subscribers[i], &packet.header,
+                     sizeof(packet));
+    }
+  }
+}
+
+void telemetry_report(const telemetry_t *telemetry, FILE *file) {
+  fprintf(file,
+          "telemetry: sent %" PRIu64 " decimated %" PRIu64 " dropped %" PRIu64
+          "\n",
+          telemetry->sent, telemetry->decimated, telemetry->dropped);
+}
+
+void telemetry_close(telemetry_t *telemetry) {
+  if (telemetry->fd != -1) {
+    close(telemetry->fd);
+    telemetry->fd = -1;
+  }
+}
+
+static void telemetry_client_subscribe(telemetry_client_t *client,
+                                       uint64_t t) {
+  telemetry_subscribe_t request;
+  telemetry_header(&request.header, TELEMETRY_SUBSCRIBE, 0, t);
+  request.rate_hz = client->rate_hz;
+  sendto(client->fd, &request, sizeof(request), MSG_DONTWAIT,
+         (struct sockaddr *)&client->server, sizeof(client->server));
+  client->last_subscribe_t = t;
+}
+
+int telemetry_client_open(telemetry_client_t *client, const char *host,
+                          int port, float rate_hz) {
+  memset(client, 0, sizeof(telemetry_client_t));
+  if (telemetry_resolve(host, port, &client->server) == -1) {
+    return -1;
+  }
+  client->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (client->fd == -1) {
+    perror("Could not open telemetry socket");
+    return -1;
+  }
+  client->rate_hz = rate_hz;
+
+  // The fixed multicast destination of the server, joined instead of
+  // subscribing
+  if (IN_MULTICAST(ntohl(client->server.sin_addr.s_addr))) {
+    client->multicast = 1;
+    int reuse = 1;
+    setsockopt(client->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = client->server.sin_port;
+    struct ip_mreq group;
+    group.imr_multiaddr = client->server.sin_addr;
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(client->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        setsockopt(client->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group,
+                   sizeof(group)) == -1) {
+      perror("Could not join the telemetry group");
+      close(client->fd);
+      client->fd = -1;
+      return -1;
+    }
+    return 0;
+  }
+  telemetry_client_subscribe(client, get_t());
+  return 0;
+}
+
+int telemetry_client_receive(telemetry_client_t *client, void *buffer,
+                             int size, int timeout_ms) {
+  uint64_t t = get_t();
+  if (!client->multicast &&
+      t - client->last_subscribe_t > TELEMETRY_RESUBSCRIBE_US) {
+    telemetry_client_subscribe(client, t);
+  }
+
+  struct pollfd pfd = {.fd = client->fd, .events = POLLIN};
+  int res = poll(&pfd, 1, timeout_ms);
+  if (res <= 0) {
+    return res == 0 || errno == EINTR ? 0 : -1;
+  }
+  ssize_t received = recv(client->fd, buffer, size, 0);
+  if (received <= 0 || !telemetry_header_valid(buffer, received)) {
+    return 0;
+  }
+
+  const telemetry_header_t *header = (const telemetry_header_t *)buffer;
+  // A sequence going back means the server restarted
+  int32_t gap = (int32_t)(header->seq - client->next_seq);
+  if (client->has_seq && gap > 0) {
+    client->lost += gap;
+  }
+  client->has_seq = 1;
+  client->next_seq = header->seq + 1;
+  client->received++;
+  return received;
+}
+
+void telemetry_client_close(telemetry_client_t *client) {
+  if (client->fd != -1) {
+    close(client->fd);
+    client->fd = -1;
+  }
+}
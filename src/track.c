@@ -0,0 +1,207 @@
+#include "track.h"
+#include "defines.h"
+#include "utils.h"
+
+#include <math.h>
+#include <string.h>
+
+static int track_is_boundary(cone_id id) {
+  return id == CONE_ID_YELLOW || id == CONE_ID_BLUE;
+}
+
+static int track_cell(double v) { return (int)floor(v / TRACK_CELL_M); }
+
+static int track_bucket(int cx, int cy) {
+  uint32_t h = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+  return h % TRACK_GRID_BUCKETS;
+}
+
+static double track_distance(const track_t *track, int a, int b) {
+  return hypot(track->cones[a].x - track->cones[b].x,
+               track->cones[a].y - track->cones[b].y);
+}
+
+// Nearest cone of the given colour around (x, y) other than skip, looking
+// at most cells away
+static int track_nearest_xy(const track_t *track, double x, double y,
+                            cone_id id, double max_distance, int skip,
+                            int cells) {
+  int cx = track_cell(x);
+  int cy = track_cell(y);
+  int best = -1;
+  double best_distance = max_distance;
+  for (int dx = -cells; dx <= cells; dx++) {
+    for (int dy = -cells; dy <= cells; dy++) {
+      int j = track->buckets[track_bucket(cx + dx, cy + dy)];
+      // Buckets are shared by far cells, the distance filters them out
+      for (; j != -1; j = track->cones[j].bucket_next) {
+        if (j == skip || track->cones[j].cone.id != id) {
+          continue;
+        }
+        double d = hypot(track->cones[j].x - x, track->cones[j].y - y);
+        if (d < best_distance) {
+          best_distance = d;
+          best = j;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+// Nearest cone of the given colour around cone i, -1 if none in range
+static int track_nearest(const track_t *track, int i, cone_id id,
+                         double max_distance) {
+  int cells = (int)ceil(max_distance / TRACK_CELL_M);
+  return track_nearest_xy(track, track->cones[i].x, track->cones[i].y, id,
+                          max_distance, i, cells);
+}
+
+int track_find_nearest(const track_t *track, double x, double y, cone_id id,
+                       double max_distance) {
+  return track_nearest_xy(track, x, y, id, max_distance, -1,
+                          TRACK_SEARCH_CELLS);
+}
+
+void track_init(track_t *track) {
+  track->has_origin = 0;
+  track->revision++;
+  track->count = 0;
+  for (int i = 0; i < TRACK_GRID_BUCKETS; i++) {
+    track->buckets[i] = -1;
+  }
+}
+
+// Cheapest insertion of cone i in the chain of its nearest neighbour n
+static void track_link(track_t *track, int i, int n) {
+  track_cone_t *cones = track->cones;
+  double d = track_distance(track, i, n);
+
+  int after = -1;
+  double best = INFINITY;
+  if (cones[n].next == -1) {
+    after = n;
+    best = d;
+  } else {
+    int b = cones[n].next;
+    best = d + track_distance(track, i, b) - track_distance(track, n, b);
+    after = n;
+  }
+  if (cones[n].prev == -1) {
+    if (d < best) {
+      after = -1;
+      best = d;
+    }
+  } else {
+    int a = cones[n].prev;
+    double cost = track_distance(track, a, i) + d - track_distance(track, a, n);
+    if (cost < best) {
+      after = a;
+    }
+  }
+
+  if (after == -1) {
+    // New head of the chain
+    cones[i].next = n;
+    cones[n].prev = i;
+  } else {
+    int b = cones[after].next;
+    cones[i].prev = after;
+    cones[i].next = b;
+    cones[after].next = i;
+    if (b != -1) {
+      cones[b].prev = i;
+    }
+  }
+}
+
+int track_insert(track_t *track, const cone_t *cone) {
+  if (track->count >= TRACK_MAX_CONES) {
+    return -1;
+  }
+  if (!track->has_origin) {
+    track->has_origin = 1;
+    track->lat0 = cone->lat;
+    track->lon0 = cone->lon;
+  }
+
+  int i = track->count++;
+  track_cone_t *c = &track->cones[i];
+  c->cone = *cone;
+  latlon_to_local(track->lat0, track->lon0, cone->lat, cone->lon, &c->x,
+                  &c->y);
+  c->prev = -1;
+  c->next = -1;
+  c->partner = -1;
+
+  int bucket = track_bucket(track_cell(c->x), track_cell(c->y));
+  c->bucket_next = track->buckets[bucket];
+  track->buckets[bucket] = i;
+
+  if (track_is_boundary(cone->id)) {
+    // Well past TRACK_MAX_GAP_M, so a run of missing cones is a long edge
+    // of the chain instead of the start of a new one
+    int n = track_nearest(track, i, cone->id, TRACK_LINK_MAX_M);
+    if (n != -1) {
+      track_link(track, i, n);
+    }
+
+    cone_id other = cone->id == CONE_ID_YELLOW ? CONE_ID_BLUE : CONE_ID_YELLOW;
+    c->partner = track_nearest(track, i, other, TRACK_PARTNER_MAX_M);
+    // The new cone may be a better partner for the opposite cones around it
+    int cx = track_cell(c->x);
+    int cy = track_cell(c->y);
+    for (int dx = -TRACK_SEARCH_CELLS; dx <= TRACK_SEARCH_CELLS; dx++) {
+      for (int dy = -TRACK_SEARCH_CELLS; dy <= TRACK_SEARCH_CELLS; dy++) {
+        int j = track->buckets[track_bucket(cx + dx, cy + dy)];
+        for (; j != -1; j = track->cones[j].bucket_next) {
+          if (track->cones[j].cone.id != other) {
+            continue;
+          }
+          double d = track_distance(track, i, j);
+          int p = track->cones[j].partner;
+          if (d < TRACK_PARTNER_MAX_M &&
+              (p == -1 || d < track_distance(track, j, p))) {
+            track->cones[j].partner = i;
+          }
+        }
+      }
+    }
+  }
+
+  track->revision++;
+  return i;
+}
+
+int track_edge_missing(const track_t *track, int i) {
+  int next = track->cones[i].next;
+  if (next == -1) {
+    return 0;
+  }
+  double d = track_distance(track, i, next);
+  if (d <= TRACK_MAX_GAP_M) {
+    return 0;
+  }
+  // Rounded, positions are off by a few centimetres
+  int missing = (int)lround(d / TRACK_CONE_SPACING_M) - 1;
+  return missing > 1 ? missing : 1;
+}
+
+void track_missing_position(const track_t *track, int i, int k, double *lat,
+                            double *lon) {
+  const cone_t *a = &track->cones[i].cone;
+  const cone_t *b = &track->cones[track->cones[i].next].cone;
+  double f = (k + 1.0) / (track_edge_missing(track, i) + 1.0);
+  *lat = a->lat + (b->lat - a->lat) * f;
+  *lon = a->lon + (b->lon - a->lon) * f;
+}
+
+int track_center(const track_t *track, int i, double *lat, double *lon) {
+  int p = track->cones[i].partner;
+  if (p == -1) {
+    return -1;
+  }
+  *lat = (track->cones[i].cone.lat + track->cones[p].cone.lat) * 0.5;
+  *lon = (track->cones[i].cone.lon + track->cones[p].cone.lon) * 0.5;
+  return 0;
+}
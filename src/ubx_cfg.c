@@ -0,0 +1,293 @@
+#include "ubx_cfg.h"
+#include "defines.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define UBX_CLASS_ACK 0x05
+#define UBX_ACK_NAK 0x00
+#define UBX_ACK_ACK 0x01
+#define UBX_CLASS_CFG 0x06
+#define UBX_CFG_MSG 0x01
+#define UBX_CFG_RATE 0x08
+#define UBX_CFG_CFG 0x09
+
+void ubx_checksum(const unsigned char *data, int size, unsigned char *ck_a,
+                  unsigned char *ck_b) {
+  *ck_a = 0;
+  *ck_b = 0;
+  for (int i = 0; i < size; i++) {
+    *ck_a += data[i];
+    *ck_b += *ck_a;
+  }
+}
+
+int ubx_frame_build(unsigned char *out, uint8_t msg_class, uint8_t msg_id,
+                    const unsigned char *payload, uint16_t size) {
+  out[0] = 0xB5;
+  out[1] = 0x62;
+  out[2] = msg_class;
+  out[3] = msg_id;
+  out[4] = size & 0xFF;
+  out[5] = size >> 8;
+  memcpy(out + 6, payload, size);
+  ubx_checksum(out + 2, size + 4, &out[6 + size], &out[7 + size]);
+  return size + 8;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+}
+
+int ubx_hpposllh_build(unsigned char *out, uint32_t itow, double lat,
+                       double lon, double height) {
+  unsigned char payload[36];
+  memset(payload, 0, sizeof(payload));
+
+  int64_t lon_e9 = (int64_t)llround(lon * 1e9);
+  int64_t lat_e9 = (int64_t)llround(lat * 1e9);
+  int64_t height_e4 = (int64_t)llround(height * 1e4);
+  // Standard part in 1e-7 deg and mm, high precision part in 1e-9 deg, 0.1 mm
+  int32_t lon_std = (int32_t)(lon_e9 / 100);
+  int32_t lat_std = (int32_t)(lat_e9 / 100);
+  int32_t height_std = (int32_t)(height_e4 / 10);
+
+  put_u32(payload + 4, itow);
+  put_u32(payload + 8, (uint32_t)lon_std);
+  put_u32(payload + 12, (uint32_t)lat_std);
+  put_u32(payload + 16, (uint32_t)height_std);
+  put_u32(payload + 20, (uint32_t)height_std);
+  payload[24] = (int8_t)(lon_e9 - (int64_t)lon_std * 100);
+  payload[25] = (int8_t)(lat_e9 - (int64_t)lat_std * 100);
+  payload[26] = (int8_t)(height_e4 - (int64_t)height_std * 10);
+  payload[27] = payload[26];
+  put_u32(payload + 28, 140); // hAcc 14 mm
+  put_u32(payload + 32, 200); // vAcc 20 mm
+
+  return ubx_frame_build(out, 0x01, 0x14, payload, sizeof(payload));
+}
+
+int ubx_pvt_build(unsigned char *out, uint32_t itow) {
+  unsigned char payload[92];
+  memset(payload, 0, sizeof(payload));
+  put_u32(payload, itow);
+  return ubx_frame_build(out, 0x01, 0x07, payload, sizeof(payload));
+}
+
+int ubx_frame_find(const unsigned char *data, int size, int capacity,
+                   int *offset, int *length) {
+  for (int i = 0; i + 8 <= size; i++) {
+    if (data[i] != 0xB5 || data[i + 1] != 0x62) {
+      continue;
+    }
+    int len = 8 + (data[i + 4] | (data[i + 5] << 8));
+    if (len > capacity) {
+      // False sync, the frame could never fit in the buffer
+      continue;
+    }
+    if (i + len > size) {
+      // Incomplete, keep it for the next read
+      *offset = i;
+      return 0;
+    }
+    unsigned char ck_a, ck_b;
+    ubx_checksum(data + i + 2, len - 4, &ck_a, &ck_b);
+    if (ck_a != data[i + len - 2] || ck_b != data[i + len - 1]) {
+      continue;
+    }
+    *offset = i;
+    *length = len;
+    return 1;
+  }
+  *offset = size > 7 ? size - 7 : 0;
+  return 0;
+}
+
+void ubx_cfg_default(ubx_cfg_t *cfg) {
+  static const ubx_cfg_msg_t msgs[] = {
+      {0x01, 0x14, 1}, // NAV-HPPOSLLH
+      {0xF0, 0x00, 0}, // NMEA GGA
+      {0xF0, 0x01, 0}, // NMEA GLL
+      {0xF0, 0x02, 0}, // NMEA GSA
+      {0xF0, 0x03, 0}, // NMEA GSV
+      {0xF0, 0x04, 0}, // NMEA RMC
+      {0xF0, 0x05, 0}, // NMEA VTG
+  };
+  memset(cfg, 0, sizeof(ubx_cfg_t));
+  cfg->meas_rate_ms = UBX_MEAS_RATE_MS;
+  cfg->nav_rate = 1;
+  cfg->msg_count = sizeof(msgs) / sizeof(msgs[0]);
+  memcpy(cfg->msgs, msgs, sizeof(msgs));
+}
+
+uint32_t ubx_cfg_hash(const ubx_cfg_t *cfg, const char *port) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+#define UBX_HASH_BYTE(b) hash = (hash ^ (uint8_t)(b)) * 16777619u
+  for (const char *c = port; *c; c++) {
+    UBX_HASH_BYTE(*c);
+  }
+  UBX_HASH_BYTE(cfg->meas_rate_ms);
+  UBX_HASH_BYTE(cfg->meas_rate_ms >> 8);
+  UBX_HASH_BYTE(cfg->nav_rate);
+  UBX_HASH_BYTE(cfg->nav_rate >> 8);
+  for (int i = 0; i < cfg->msg_count; i++) {
+    UBX_HASH_BYTE(cfg->msgs[i].msg_class);
+    UBX_HASH_BYTE(cfg->msgs[i].msg_id);
+    UBX_HASH_BYTE(cfg->msgs[i].rate);
+  }
+#undef UBX_HASH_BYTE
+  return hash;
+}
+
+static int ubx_port_open(const char *port, speed_t baud) {
+  int fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd == -1) {
+    perror("Could not open receiver port");
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baud);
+    cfsetospeed(&tio, baud);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  tcflush(fd, TCIOFLUSH);
+  return fd;
+}
+
+// 1 on ACK, 0 on NAK, -1 on timeout
+static int ubx_wait_ack(int fd, uint8_t msg_class, uint8_t msg_id) {
+  static unsigned char buffer[4096];
+  int size = 0;
+  uint64_t start = get_t();
+  while (get_t() - start < UBX_ACK_TIMEOUT_US) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, 10) <= 0) {
+      continue;
+    }
+    ssize_t res = read(fd, buffer + size, sizeof(buffer) - size);
+    if (res <= 0) {
+      continue;
+    }
+    size += res;
+
+    int offset, length;
+    while (ubx_frame_find(buffer, size, sizeof(buffer), &offset, &length)) {
+      const unsigned char *f = buffer + offset;
+      if (f[2] == UBX_CLASS_ACK && length == 10 && f[6] == msg_class &&
+          f[7] == msg_id) {
+        return f[3] == UBX_ACK_ACK ? 1 : 0;
+      }
+      offset += length;
+      memmove(buffer, buffer + offset, size - offset);
+      size -= offset;
+    }
+    // Drop what cannot be an ACK anymore (NMEA and partial garbage)
+    memmove(buffer, buffer + offset, size - offset);
+    size -= offset;
+  }
+  return -1;
+}
+
+static int ubx_send(int fd, uint8_t msg_class, uint8_t msg_id,
+                    const unsigned char *payload, uint16_t size) {
+  unsigned char frame[64];
+  int length = ubx_frame_build(frame, msg_class, msg_id, payload, size);
+  for (int i = 0; i < UBX_ACK_RETRIES; i++) {
+    if (write(fd, frame, length) != length) {
+      if (errno != EAGAIN) {
+        perror("Could not write to receiver");
+        return -1;
+      }
+      usleep(1000);
+      continue;
+    }
+    int res = ubx_wait_ack(fd, msg_class, msg_id);
+    if (res == 1) {
+      return 0;
+    }
+    if (res == 0) {
+      fprintf(stderr, "Receiver rejected UBX 0x%02X 0x%02X\n", msg_class,
+              msg_id);
+      return -1;
+    }
+  }
+  fprintf(stderr, "No ACK for UBX 0x%02X 0x%02X\n", msg_class, msg_id);
+  return -1;
+}
+
+int ubx_cfg_apply(const ubx_cfg_t *cfg, const char *port, speed_t baud,
+                  const char *cache_path) {
+  uint32_t hash = ubx_cfg_hash(cfg, port);
+  uint32_t cached = 0;
+  FILE *cache = fopen(cache_path, "r");
+  if (cache != NULL) {
+    int res = fscanf(cache, "%x", &cached);
+    fclose(cache);
+    if (res == 1 && cached == hash) {
+      printf("Receiver configuration unchanged [%08x]\n", hash);
+      return 0;
+    }
+  }
+
+  int fd = ubx_port_open(port, baud);
+  if (fd == -1) {
+    return -1;
+  }
+
+  uint64_t start = get_t();
+  int res = 0;
+  unsigned char payload[12];
+
+  payload[0] = cfg->meas_rate_ms & 0xFF;
+  payload[1] = cfg->meas_rate_ms >> 8;
+  payload[2] = cfg->nav_rate & 0xFF;
+  payload[3] = cfg->nav_rate >> 8;
+  payload[4] = 1; // GPS time reference
+  payload[5] = 0;
+  res = ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_RATE, payload, 6);
+
+  for (int i = 0; i < cfg->msg_count && res == 0; i++) {
+    // Short form: rate on the port the message is received from
+    payload[0] = cfg->msgs[i].msg_class;
+    payload[1] = cfg->msgs[i].msg_id;
+    payload[2] = cfg->msgs[i].rate;
+    res = ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_MSG, payload, 3);
+  }
+
+  if (res == 0) {
+    // Save to BBR/flash so that the cache stays valid across power cycles
+    memset(payload, 0, sizeof(payload));
+    payload[4] = 0x1F;
+    payload[5] = 0x1F;
+    res = ubx_send(fd, UBX_CLASS_CFG, UBX_CFG_CFG, payload, 12);
+  }
+  close(fd);
+
+  if (res == -1) {
+    fprintf(stderr, "Receiver configuration failed\n");
+    return -1;
+  }
+
+  printf("Receiver configured in %.1f ms [%08x]\n", (get_t() - start) * 1e-3,
+         hash);
+  cache = fopen(cache_path, "w");
+  if (cache == NULL) {
+    perror("Could not write receiver configuration cache");
+    return 0;
+  }
+  fprintf(cache, "%08x\n", hash);
+  fclose(cache);
+  return 0;
+}
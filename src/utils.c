@@ -1,10 +1,27 @@
 #include "utils.h"
 
+#include <math.h>
 #include <time.h>
 
+#define EARTH_RADIUS_M (6378137.0)
+
 uint64_t get_t() {
 	struct timespec t;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &t);
 	uint64_t us = (t.tv_sec * 1e6) + (t.tv_nsec * 1e-3);
 	return us;
-}
\ No newline at end of file
+}
+
+void latlon_to_local(double lat0, double lon0, double lat, double lon,
+                     double *x, double *y) {
+	const double deg_to_rad = M_PI / 180.0;
+	*x = (lon - lon0) * deg_to_rad * EARTH_RADIUS_M * cos(lat0 * deg_to_rad);
+	*y = (lat - lat0) * deg_to_rad * EARTH_RADIUS_M;
+}
+
+void local_to_latlon(double lat0, double lon0, double x, double y,
+                     double *lat, double *lon) {
+	const double deg_to_rad = M_PI / 180.0;
+	*lat = lat0 + y / (deg_to_rad * EARTH_RADIUS_M);
+	*lon = lon0 + x / (deg_to_rad * EARTH_RADIUS_M * cos(lat0 * deg_to_rad));
+}
@@ -3,8 +3,12 @@
 
 #include <GLFW/glfw3.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <cstdlib>
 #include <filesystem>
 #include <mutex>
@@ -20,12 +24,25 @@
 
 extern "C" {
 #include "acr.h"
+#include "acr_config.h"
 #include "defines.h"
+#include "config.h"
+#include "dispatch.h"
+#include "geofence.h"
+#include "live.h"
+#include "telemetry.h"
 #include "main.h"
+#include "seglog.h"
+#include "track.h"
 #include "utils.h"
 }
 
+// Held by the UI for the whole frame, the readers only take it to insert
+// cones in the track
 std::mutex renderLock;
+// Current position, the state of main and the lap detector, held only to
+// copy or update them so a fix never waits for a frame
+std::mutex positionLock;
 std::atomic<bool> kill_thread;
 std::atomic<bool> save_cone;
 
@@ -37,21 +54,61 @@ full_session_t session;
 cone_session_t cone_session;
 
 ImVec2 lonlat;
-std::vector<ImVec2> trajectory;
-std::vector<cone_t> cones;
-
-ImVec2 povoBoundBL{11.1484815430000008, 46.0658863580000002};
-ImVec2 povoBoundTR{11.1515535430000003, 46.0689583580000033};
-ImVec2 vadenaBoundBL{11.3097566090000008, 46.4300119620000018};
-ImVec2 vadenaBoundTR{11.3169246090000009, 46.4382039620000029};
-ImVec2 fsgBoundBL{8.558931763076039, 49.32344089057215};
-ImVec2 fsgBoundTR{8.595726757113576, 49.335430701657735};
-ImVec2 alaBoundBL{11.010747212958533, 45.784567764275764};
-ImVec2 alaBoundTR{11.013506837511347, 45.78713363420464};
-ImVec2 varanoBoundBL{10.013347232876077, 44.67756187921092};
-ImVec2 varanoBoundTR{10.031744729894845, 44.684102509035036};
+// Appended by the reader, drawn in place by the UI without copies
+seglog_t trajectory;
+seglog_t cones;
+seglog_t laps;
+// First items shown, the logs themselves are never cleared
+size_t trajectoryStart = 0;
+size_t conesStart = 0;
+
+// Residual overlay from acr_align, loaded once at startup
+std::vector<ImPlotPoint> residualDrift;
+std::vector<ImPlotPoint> residualUnmatched;
+int residualMatched = 0;
+double residualRms = 0.0;
+double residualMax = 0.0;
+track_t track;
+dispatch_table_t dispatch;
+live_t live;
+acr_config_t acrConfig;
+bool liveSource = false;
+live_state_t liveState;
+telemetry_client_t net;
+bool netSource = false;
+
+// Map images are placed on the bounds of the tracks in acr.conf
+ImPlotPoint povoBoundBL, povoBoundTR;
+ImPlotPoint vadenaBoundBL, vadenaBoundTR;
+
+// Frames are drawn on input, on new data and at least every timeout
+#define VIEWER_IDLE_TIMEOUT_S (1.0)
+// The live feed is polled, not signalled
+#define VIEWER_LIVE_TIMEOUT_S (0.1)
+// Frames drawn after a wake, ImGui takes one to settle the input
+#define VIEWER_SETTLE_FRAMES 2
+// Heavy work that does not fit is moved to the next frames
+#define VIEWER_FRAME_BUDGET_US (8000)
+
+bool continuousRendering = false;
+int framesPending = VIEWER_SETTLE_FRAMES;
+uint64_t frameStart = 0;
+bool frameHeavyDone = false;
+// Last frame, from the wake to the swap excluded
+uint64_t frameTimeUs = 0;
+
+void requestFrame();
+bool frameBudget(uint64_t cost_us);
+void waitFrame(double timeout_s);
+void frameOverlay();
 
 void readGPSLoop();
+void readLive();
+void readNetLoop();
+void plotTrack();
+int loadResiduals(const char *path);
+void plotResiduals();
+void plotTrajectory();
 
 #define WIN_W 800
 #define WIN_H 800
@@ -62,9 +119,14 @@ void startFrame();
 void endFrame(GLFWwindow *window);
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
+  if (argc != 2 && argc != 3) {
     printf("Error wrong number of arguments:\n");
-    printf("  %s <gps port or log file>\n", argv[0]);
+    printf("  %s <gps port, log file, \"live\" or udp:host:port[:rate]> "
+           "[acr_align residuals]\n",
+           argv[0]);
+    return -1;
+  }
+  if (argc == 3 && loadResiduals(argv[2]) == -1) {
     return -1;
   }
   const char *port_or_file = argv[1];
@@ -75,6 +137,10 @@ int main(int argc, char **argv) {
     return -1;
   }
 
+  seglog_init(&trajectory, sizeof(ImVec2), 4096);
+  seglog_init(&cones, sizeof(cone_t), 256);
+  seglog_init(&laps, sizeof(lap_t), 256);
+
   memset(&session, 0, sizeof(full_session_t));
   memset(&cone_session, 0, sizeof(cone_session_t));
   memset(&user_data, 0, sizeof(user_data_t));
@@ -83,14 +149,72 @@ int main(int argc, char **argv) {
   user_data.session = &session;
   user_data.cone_session = &cone_session;
 
+  char lap_line_path[2048];
+  lap_line_t lap_line;
+  int lap_line_points = 0;
+  snprintf(lap_line_path, 2048, "%s/logs/acr/%s", basepath, LAP_LINE_FILE);
+  if (lap_line_load(&lap_line, lap_line_path) == 0) {
+    lap_detector_init(&session.laps, &lap_line);
+    lap_line_points = 2;
+  } else {
+    lap_detector_init(&session.laps, NULL);
+  }
+
+  track_init(&track);
+
+  char config_path[2048];
+  geofence_config_t geofence_config;
+  snprintf(config_path, 2048, "%s/logs/acr/%s", basepath, ACR_CONFIG_FILE);
+  geofence_config_default(&geofence_config);
+  config_parse(config_path, geofence_config_handler, &geofence_config);
+  acr_config_default(&acrConfig);
+  if (config_parse(config_path, acr_config_handler, &acrConfig) > 0 ||
+      acr_config_validate(&acrConfig) == -1) {
+    acr_config_default(&acrConfig);
+  }
+  const geofence_track_t *povo = geofence_find(&geofence_config, "povo");
+  const geofence_track_t *vadena = geofence_find(&geofence_config, "vadena");
+  if (povo != NULL) {
+    geofence_bounds(povo, &povoBoundBL.y, &povoBoundBL.x, &povoBoundTR.y,
+                    &povoBoundTR.x);
+  }
+  if (vadena != NULL) {
+    geofence_bounds(vadena, &vadenaBoundBL.y, &vadenaBoundBL.x,
+                    &vadenaBoundTR.y, &vadenaBoundTR.x);
+  }
+
+  char dispatch_path[2048];
+  snprintf(dispatch_path, 2048, "%s/logs/acr/%s", basepath, DISPATCH_FILE);
+  dispatch_init(&dispatch, DISPATCH_PARSE_LOG);
+  dispatch_load(&dispatch, dispatch_path);
+
   int res = 0;
   gps_interface_initialize(&gps);
-  if (std::filesystem::is_character_file(port_or_file)) {
-    char buff[255];
-    snprintf(buff, 255, "sudo chmod 777 %s", port_or_file);
-    printf("Changing permissions on serial port: %s with command: %s\n",
-           port_or_file, buff);
-    system(buff);
+  if (strcmp(port_or_file, "live") == 0) {
+    // Read the running main through shared memory, it owns the sessions
+    printf("Attaching to main\n");
+    res = live_attach(&live);
+    liveSource = true;
+  } else if (strncmp(port_or_file, "udp:", 4) == 0) {
+    char host[256];
+    int port = 0;
+    float rate = 0.0f;
+    if (sscanf(port_or_file + 4, "%255[^:]:%d:%f", host, &port, &rate) < 2) {
+      printf("Invalid network source %s\n", port_or_file);
+      return -1;
+    }
+    printf("Subscribing to %s:%d\n", host, port);
+    res = telemetry_client_open(&net, host, port, rate);
+    netSource = true;
+  } else if (std::filesystem::is_character_file(port_or_file)) {
+    // Pseudo terminals from gps_sim are already accessible
+    if (access(port_or_file, R_OK | W_OK) != 0) {
+      char buff[255];
+      snprintf(buff, 255, "sudo chmod 777 %s", port_or_file);
+      printf("Changing permissions on serial port: %s with command: %s\n",
+             port_or_file, buff);
+      system(buff);
+    }
     res = gps_interface_open(&gps, port_or_file, B230400);
   } else if (std::filesystem::is_regular_file(port_or_file)) {
     printf("Opening file\n");
@@ -104,14 +228,29 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  ImTextureID povoTex = loadImageJPG("assets/Povo.jpg");
-  ImTextureID vadenaTex = loadImageJPG("assets/Vadena.jpg");
-  std::thread gpsThread(readGPSLoop);
+  // Loaded when first shown, within the frame budget
+  const char *mapPaths[2] = {"assets/Povo.jpg", "assets/Vadena.jpg"};
+  ImTextureID mapTex[2] = {0, 0};
+  uint64_t mapLoadUs = 20000;
+  std::thread gpsThread;
+  if (netSource) {
+    gpsThread = std::thread(readNetLoop);
+  } else if (!liveSource) {
+    gpsThread = std::thread(readGPSLoop);
+  }
 
   int mapIndex = 0;
   float mapOpacity = 0.5f;
   while (!glfwWindowShouldClose(window)) {
+    waitFrame(liveSource ? VIEWER_LIVE_TIMEOUT_S : VIEWER_IDLE_TIMEOUT_S);
     startFrame();
+    frameOverlay();
+
+    if (mapTex[mapIndex] == 0 && frameBudget(mapLoadUs)) {
+      uint64_t t = get_t();
+      mapTex[mapIndex] = loadImageJPG(mapPaths[mapIndex]);
+      mapLoadUs = get_t() - t;
+    }
 
     ImGui::Begin("ACR");
 
@@ -122,6 +261,8 @@ int main(int argc, char **argv) {
       ImGui::Text("- Orange (O)");
       ImGui::Text("- Yellow (Y)");
       ImGui::Text("- Blue (B)");
+      ImGui::Text("Start/finish line point (L)");
+      ImGui::Text("Continuous rendering (V)");
       ImGui::TreePop();
     }
     if (ImGui::TreeNode("Settings")) {
@@ -134,7 +275,57 @@ int main(int argc, char **argv) {
     ImGui::Text("HDOP: %0.2f [m]", gps_data.hpposllh.hAcc);
 
     std::unique_lock<std::mutex> lck(renderLock);
-    if (ImGui::IsKeyPressed(ImGuiKey_T)) {
+    if (liveSource) {
+      readLive();
+    }
+    ImVec2 position;
+    live_state_t state;
+    {
+      std::lock_guard<std::mutex> positionLck(positionLock);
+      position = lonlat;
+      state = liveState;
+    }
+    if (netSource) {
+      ImGui::Text("Received: %lu lost: %lu", (unsigned long)net.received,
+                  (unsigned long)net.lost);
+    }
+    if (liveSource || netSource) {
+      ImGui::Text("Trajectory: %s",
+                  state.trajectory_active ? state.trajectory_name : "-");
+      ImGui::Text("Cones: %s",
+                  state.cone_session_active ? state.cone_session_name : "-");
+    }
+    if (!residualDrift.empty() || !residualUnmatched.empty()) {
+      ImGui::Text("Alignment: %d matched, %zu unmatched, rms %.3f max %.3f "
+                  "[m]",
+                  residualMatched, residualUnmatched.size(), residualRms,
+                  residualMax);
+    }
+    if (ImGui::TreeNode("Laps")) {
+      for (size_t i = seglog_length(&laps); i-- > 0;) {
+        const lap_t *lap = (const lap_t *)seglog_get(&laps, i);
+        ImGui::Text("Lap %d: %.3f [s]", lap->number,
+                    (lap->end_t - lap->start_t) * 1e-6);
+      }
+      ImGui::TreePop();
+    }
+    if (ImGui::IsKeyPressed(ImGuiKey_L)) {
+      // First press sets the first end of the line, second press the other
+      if (lap_line_points != 1) {
+        lap_line.lat0 = position.y;
+        lap_line.lon0 = position.x;
+        lap_line_points = 1;
+      } else {
+        lap_line.lat1 = position.y;
+        lap_line.lon1 = position.x;
+        lap_line_points = 2;
+        lap_line_save(&lap_line, lap_line_path);
+        std::lock_guard<std::mutex> positionLck(positionLock);
+        lap_detector_init(&session.laps, &lap_line);
+        printf("Start/finish line saved [%s]\n", lap_line_path);
+      }
+    }
+    if (!liveSource && !netSource && ImGui::IsKeyPressed(ImGuiKey_T)) {
       if (session.active) {
         csv_session_stop(&session);
         printf("Session %s ended\n", session.session_name);
@@ -149,7 +340,9 @@ int main(int argc, char **argv) {
                session.session_path);
       }
     }
-    if (ImGui::IsKeyPressed(ImGuiKey_O)) {
+    if (liveSource || netSource) {
+      // Cones are registered with the buttons of main
+    } else if (ImGui::IsKeyPressed(ImGuiKey_O)) {
       cone.id = CONE_ID_ORANGE;
       save_cone.store(true);
     } else if (ImGui::IsKeyPressed(ImGuiKey_Y)) {
@@ -159,12 +352,16 @@ int main(int argc, char **argv) {
       cone.id = CONE_ID_BLUE;
       save_cone.store(true);
     }
+    if (ImGui::IsKeyPressed(ImGuiKey_V)) {
+      continuousRendering = !continuousRendering;
+    }
     if (ImGui::IsKeyPressed(ImGuiKey_Q)) {
       glfwSetWindowShouldClose(window, true);
     }
     if (ImGui::IsKeyPressed(ImGuiKey_C)) {
-      trajectory.clear();
-      cones.clear();
+      trajectoryStart = seglog_length(&trajectory);
+      conesStart = seglog_length(&cones);
+      track_init(&track);
     }
     if (save_cone.load() && cone_session.active == 0) {
       if (cone_session_setup(&cone_session, basepath) == -1) {
@@ -180,25 +377,39 @@ int main(int argc, char **argv) {
     ImVec2 size = ImGui::GetContentRegionAvail();
     if (ImPlot::BeginPlot("GpsPositions", size, ImPlotFlags_Equal))
     {
-      if (mapIndex == 0)
+      if (mapTex[mapIndex] == 0)
       {
-        ImPlot::PlotImage("Povo", povoTex, povoBoundBL, povoBoundTR,
+        // Not loaded yet
+      }
+      else if (mapIndex == 0)
+      {
+        ImPlot::PlotImage("Povo", mapTex[0], povoBoundBL, povoBoundTR,
                           ImVec2(0, 0), ImVec2(1, 1),
                           ImVec4(1, 1, 1, mapOpacity));
       }
       else
       {
-        ImPlot::PlotImage("Vadena", vadenaTex, vadenaBoundBL, vadenaBoundTR,
+        ImPlot::PlotImage("Vadena", mapTex[1], vadenaBoundBL, vadenaBoundTR,
                           ImVec2(0, 0), ImVec2(1, 1),
                           ImVec4(1, 1, 1, mapOpacity));
       }
 
-      ImPlot::PlotScatter("Trajectory", &trajectory[0].x, &trajectory[0].y,
-                          trajectory.size(), 0, 0, sizeof(ImVec2));
+      plotTrajectory();
+
+      if (lap_line_points == 2) {
+        double line_x[2] = {lap_line.lon0, lap_line.lon1};
+        double line_y[2] = {lap_line.lat0, lap_line.lat1};
+        ImPlot::PlotLine("Start/finish", line_x, line_y, 2);
+      }
+
+      plotTrack();
+      plotResiduals();
 
-      for (size_t i = 0; i < cones.size(); ++i) {
+      size_t conesLength = seglog_length(&cones);
+      for (size_t i = conesStart; i < conesLength; ++i) {
+        const cone_t *item = (const cone_t *)seglog_get(&cones, i);
         ImVec4 c;
-        switch (cones[i].id) {
+        switch (item->id) {
         case CONE_ID_YELLOW:
           c = ImVec4(1.0f, 1.0f, 0.0f, 1.0f);
           break;
@@ -213,17 +424,28 @@ int main(int argc, char **argv) {
           break;
         }
         ImPlot::SetNextMarkerStyle(ImPlotMarker_Up, 8, c, 0.0);
-        ImPlot::PlotScatter("Cones", &cones[i].lon, &cones[i].lat, 1);
+        ImPlot::PlotScatter("Cones", &item->lon, &item->lat, 1);
       }
-      ImPlot::PlotScatter("Current", &lonlat.x, &lonlat.y, 1);
+      ImPlot::PlotScatter("Current", &position.x, &position.y, 1);
       ImPlot::EndPlot();
     }
     ImGui::End();
 
+    // Panning, dragging and typing need every frame
+    if (ImGui::IsAnyItemActive() || ImGui::IsMouseDown(ImGuiMouseButton_Left) ||
+        ImGui::IsMouseDown(ImGuiMouseButton_Right)) {
+      framesPending = VIEWER_SETTLE_FRAMES;
+    }
     endFrame(window);
   }
   kill_thread.store(true);
-  gpsThread.join();
+  if (gpsThread.joinable()) {
+    gpsThread.join();
+  }
+  live_close(&live);
+  if (netSource) {
+    telemetry_client_close(&net);
+  }
 
   return 0;
 }
@@ -233,6 +455,11 @@ void readGPSLoop() {
   int res = 0;
   unsigned char start_sequence[GPS_MAX_START_SEQUENCE_SIZE];
   char line[GPS_MAX_LINE_SIZE];
+  // Selected once like the pipelines of main, the last fix is a mean with no
+  // weight on the previous position
+  const double w = acrConfig.cones.filter == CONE_FILTER_MEAN
+                       ? acrConfig.cones.mean_weight
+                       : 0.0;
   while (!kill_thread) {
     int start_size, line_size;
     gps_protocol_type protocol;
@@ -255,57 +482,400 @@ void readGPSLoop() {
       continue;
     }
 
-    gps_parse_buffer(&gps_data, &match, line, get_t());
+    uint64_t t = get_t();
+    int actions =
+        dispatch_message(&dispatch, &match, 0, line_size, session.active, t);
+    if (actions & DISPATCH_RAW) {
+      csv_session_write_raw(&session, 0, start_sequence, start_size, line,
+                            line_size);
+    }
+    if (actions & DISPATCH_PARSE) {
+      gps_parse_buffer(&gps_data, &match, line, t);
+    }
 
-    if (match.protocol == GPS_PROTOCOL_TYPE_UBX) {
+    if (actions & DISPATCH_PARSE && match.protocol == GPS_PROTOCOL_TYPE_UBX) {
       if (match.message == GPS_UBX_TYPE_NAV_HPPOSLLH) {
-        std::unique_lock<std::mutex> lck(renderLock);
+        // Filter state belongs to this thread, only the result is shared
+        static ImVec2 filtered;
         static double height = 0.0;
 
-        if (CONE_ENABLE_MEAN && lonlat.x != 0.0 && lonlat.y != 0.0) {
-          lonlat.x = lonlat.x * CONE_MEAN_COMPLEMENTARY +
-                     gps_data.hpposllh.lon * (1.0 - CONE_MEAN_COMPLEMENTARY);
-          lonlat.y = lonlat.y * CONE_MEAN_COMPLEMENTARY +
-                     gps_data.hpposllh.lat * (1.0 - CONE_MEAN_COMPLEMENTARY);
-          height = height * CONE_MEAN_COMPLEMENTARY +
-                   gps_data.hpposllh.height * (1.0 - CONE_MEAN_COMPLEMENTARY);
+        if (filtered.x != 0.0 && filtered.y != 0.0) {
+          filtered.x = filtered.x * w + gps_data.hpposllh.lon * (1.0 - w);
+          filtered.y = filtered.y * w + gps_data.hpposllh.lat * (1.0 - w);
+          height = height * w + gps_data.hpposllh.height * (1.0 - w);
         } else {
-          lonlat.x = gps_data.hpposllh.lon;
-          lonlat.y = gps_data.hpposllh.lat;
+          filtered.x = gps_data.hpposllh.lon;
+          filtered.y = gps_data.hpposllh.lat;
           height = gps_data.hpposllh.height;
         }
 
+        // The cone is read by this thread when it is saved
         cone.timestamp = gps_data.hpposllh._timestamp;
-        cone.lon = lonlat.x;
-        cone.lat = lonlat.y;
+        cone.itow = gps_data.hpposllh.iTOW;
+        cone.lon = filtered.x;
+        cone.lat = filtered.y;
         cone.alt = height;
 
+        int lap_done;
+        {
+          std::lock_guard<std::mutex> positionLck(positionLock);
+          lonlat = filtered;
+          lap_done = actions & DISPATCH_LOG &&
+                     lap_detector_update(&session.laps, gps_data.hpposllh.lat,
+                                         gps_data.hpposllh.lon,
+                                         gps_data.hpposllh._timestamp);
+        }
+        // Single writer, the UI reads the logs without locks
+        if (lap_done) {
+          seglog_append(&laps, &session.laps.last);
+        }
+
+        requestFrame();
         static int count = 0;
         if (session.active && count % 10 == 0) {
-          trajectory.push_back(lonlat);
+          seglog_append(&trajectory, &filtered);
           count = 0;
         }
         count++;
       }
     }
 
-    if (session.active) {
-      gps_to_file(&session.files, &gps_data, &match);
+    if (actions & DISPATCH_LOG) {
+      gps_to_file(&session.sources[0].files, &gps_data, &match);
     }
 
     if (save_cone) {
       save_cone.store(false);
       cone_session_write(&cone_session, &cone);
-      // print to stdout
-      FILE *tmp = cone_session.file;
-      cone_session.file = stdout;
-      cone_session_write(&cone_session, &cone);
-      cone_session.file = tmp;
-      cones.push_back(cone);
+      cone_print(stdout, &cone);
+      seglog_append(&cones, &cone);
+
+      std::unique_lock<std::mutex> lck(renderLock);
+      track_insert(&track, &cone);
+      requestFrame();
     }
   }
 }
 
+// Called with renderLock held, only reads the shared memory
+void readLive() {
+  static uint64_t lastFix = 0;
+  static uint64_t nextCone = 0;
+  static uint32_t generation = 0;
+  uint64_t count = live_cone_count(&live);
+  // main restarted: its counters start again and it publishes the cones of
+  // the resumed session again
+  if (live_generation(&live) != generation || count < nextCone) {
+    generation = live_generation(&live);
+    lastFix = 0;
+    nextCone = 0;
+    conesStart = seglog_length(&cones);
+    track_init(&track);
+  }
+  live_state_t state;
+  if (live_read_state(&live, &state) == 0 && state.fix_count != lastFix) {
+    ImVec2 position(state.lon, state.lat);
+    {
+      std::lock_guard<std::mutex> positionLck(positionLock);
+      liveState = state;
+      lonlat = position;
+    }
+    gps_data.hpposllh.hAcc = state.h_acc;
+    if (state.trajectory_active && state.fix_count / 10 != lastFix / 10) {
+      seglog_append(&trajectory, &position);
+    }
+    lastFix = state.fix_count;
+  }
+
+  if (count - nextCone >= LIVE_CONE_RING) {
+    nextCone = count - LIVE_CONE_RING + 1;
+  }
+  for (; nextCone < count; ++nextCone) {
+    cone_t c;
+    if (live_read_cone(&live, nextCone, &c) == 0) {
+      seglog_append(&cones, &c);
+      track_insert(&track, &c);
+    }
+  }
+}
+
+void readNetLoop() {
+  unsigned char buffer[256];
+  uint64_t fixes = 0;
+  while (!kill_thread) {
+    int size = telemetry_client_receive(&net, buffer, sizeof(buffer), 100);
+    if (size <= 0) {
+      continue;
+    }
+    const telemetry_header_t *header = (const telemetry_header_t *)buffer;
+    if (header->type == TELEMETRY_POSITION &&
+        size == sizeof(telemetry_position_t)) {
+      const telemetry_position_t *p = (const telemetry_position_t *)buffer;
+      ImVec2 position(p->lon, p->lat);
+      {
+        std::lock_guard<std::mutex> positionLck(positionLock);
+        lonlat = position;
+        liveState.trajectory_active = p->trajectory_active;
+        liveState.cone_session_active = p->cone_session_active;
+        snprintf(liveState.trajectory_name, sizeof(liveState.trajectory_name),
+                 "%.*s", (int)sizeof(p->trajectory_name), p->trajectory_name);
+        snprintf(liveState.cone_session_name,
+                 sizeof(liveState.cone_session_name), "%.*s",
+                 (int)sizeof(p->cone_session_name), p->cone_session_name);
+      }
+      gps_data.hpposllh.hAcc = p->h_acc;
+      if (p->trajectory_active && fixes++ % 10 == 0) {
+        seglog_append(&trajectory, &position);
+      }
+    } else if (header->type == TELEMETRY_CONE &&
+               size == sizeof(telemetry_cone_t)) {
+      const telemetry_cone_t *p = (const telemetry_cone_t *)buffer;
+      cone_t c;
+      c.timestamp = p->header.timestamp;
+      c.id = (cone_id)p->id;
+      c.lat = p->lat;
+      c.lon = p->lon;
+      c.alt = p->alt;
+      seglog_append(&cones, &c);
+      std::unique_lock<std::mutex> lck(renderLock);
+      track_insert(&track, &c);
+    }
+    requestFrame();
+  }
+}
+
+// One scatter for each block, the points are passed where they are
+void plotTrajectory() {
+  size_t length = seglog_length(&trajectory);
+  size_t first = trajectoryStart / trajectory.block_items;
+  for (size_t b = first; b < seglog_block_count(&trajectory, length); ++b) {
+    size_t count;
+    ImVec2 *points = (ImVec2 *)seglog_block(&trajectory, b, length, &count);
+    size_t skip = b == first ? trajectoryStart % trajectory.block_items : 0;
+    if (count <= skip) {
+      continue;
+    }
+    ImPlot::PlotScatter("Trajectory", &points[skip].x, &points[skip].y,
+                        count - skip, 0, 0, sizeof(ImVec2));
+  }
+}
+
+// Segments from the reference cones to the cones of the other sessions
+int loadResiduals(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("Could not open residuals");
+    return -1;
+  }
+  const ImPlotPoint nan(NAN, NAN);
+  char line[2048];
+  double sum = 0.0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    int index, id, ref;
+    double lat, lon, alat, alon, rlat, rlon, drift, residual;
+    if (sscanf(line,
+               "%*[^,],%d,%d,%*[^,],%lf,%lf,%lf,%lf,%d,%lf,%lf,%lf,%lf",
+               &index, &id, &lat, &lon, &alat, &alon, &ref, &rlat, &rlon,
+               &drift, &residual) != 11) {
+      continue;
+    }
+    if (ref == -1) {
+      residualUnmatched.push_back(ImPlotPoint(lon, lat));
+      continue;
+    }
+    residualDrift.push_back(ImPlotPoint(rlon, rlat));
+    residualDrift.push_back(ImPlotPoint(lon, lat));
+    residualDrift.push_back(nan);
+    residualMatched++;
+    sum += residual * residual;
+    residualMax = std::fmax(residualMax, residual);
+  }
+  fclose(file);
+  if (residualMatched > 0) {
+    residualRms = std::sqrt(sum / residualMatched);
+  }
+  printf("Residuals loaded [%s]\n", path);
+  return 0;
+}
+
+void plotResiduals() {
+  // No residual file, the default
+  if (residualDrift.empty() && residualUnmatched.empty()) {
+    return;
+  }
+  if (!residualDrift.empty()) {
+    ImPlot::SetNextLineStyle(ImVec4(1.0f, 0.0f, 1.0f, 1.0f), 2.0f);
+    ImPlot::PlotLine("Drift", &residualDrift[0].x, &residualDrift[0].y,
+                     residualDrift.size(), 0, 0, sizeof(ImPlotPoint));
+  }
+  if (!residualUnmatched.empty()) {
+    ImPlot::SetNextMarkerStyle(ImPlotMarker_Square, 6,
+                               ImVec4(1.0f, 0.0f, 1.0f, 1.0f));
+    ImPlot::PlotScatter("Unmatched", &residualUnmatched[0].x,
+                        &residualUnmatched[0].y, residualUnmatched.size(), 0,
+                        0, sizeof(ImPlotPoint));
+  }
+}
+
+// Called with renderLock held
+void plotTrack() {
+  static uint32_t revision = 0;
+  static uint64_t rebuildUs = 0;
+  static std::vector<ImPlotPoint> yellow, blue, center, gaps, missing;
+  // The previous layers are drawn until the rebuild fits in a frame
+  if (revision != track.revision && frameBudget(rebuildUs)) {
+    uint64_t rebuildStart = get_t();
+    revision = track.revision;
+    yellow.clear();
+    blue.clear();
+    center.clear();
+    gaps.clear();
+    missing.clear();
+
+    const ImPlotPoint nan(NAN, NAN);
+    for (int i = 0; i < track.count; ++i) {
+      const track_cone_t &c = track.cones[i];
+      if (c.prev != -1 || c.next == -1) {
+        continue;
+      }
+      // Walk every chain from its head, NaN separates the chains
+      std::vector<ImPlotPoint> &line =
+          c.cone.id == CONE_ID_YELLOW ? yellow : blue;
+      for (int j = i; j != -1; j = track.cones[j].next) {
+        const cone_t &cj = track.cones[j].cone;
+        line.push_back(ImPlotPoint(cj.lon, cj.lat));
+
+        double lat, lon;
+        if (c.cone.id == CONE_ID_YELLOW &&
+            track_center(&track, j, &lat, &lon) == 0) {
+          center.push_back(ImPlotPoint(lon, lat));
+        }
+
+        int n = track_edge_missing(&track, j);
+        if (n > 0) {
+          const cone_t &next = track.cones[track.cones[j].next].cone;
+          gaps.push_back(ImPlotPoint(cj.lon, cj.lat));
+          gaps.push_back(ImPlotPoint(next.lon, next.lat));
+          gaps.push_back(nan);
+          for (int k = 0; k < n; ++k) {
+            track_missing_position(&track, j, k, &lat, &lon);
+            missing.push_back(ImPlotPoint(lon, lat));
+          }
+        }
+      }
+      line.push_back(nan);
+      if (c.cone.id == CONE_ID_YELLOW) {
+        center.push_back(nan);
+      }
+    }
+    rebuildUs = get_t() - rebuildStart;
+  }
+
+  // Layers are empty until there are cones
+  if (!yellow.empty()) {
+    ImPlot::SetNextLineStyle(ImVec4(1.0f, 1.0f, 0.0f, 1.0f));
+    ImPlot::PlotLine("Yellow boundary", &yellow[0].x, &yellow[0].y,
+                     yellow.size(), 0, 0, sizeof(ImPlotPoint));
+  }
+  if (!blue.empty()) {
+    ImPlot::SetNextLineStyle(ImVec4(0.0f, 0.0f, 1.0f, 1.0f));
+    ImPlot::PlotLine("Blue boundary", &blue[0].x, &blue[0].y, blue.size(), 0,
+                     0, sizeof(ImPlotPoint));
+  }
+  if (!center.empty()) {
+    ImPlot::SetNextLineStyle(ImVec4(1.0f, 1.0f, 1.0f, 0.5f));
+    ImPlot::PlotLine("Centerline", &center[0].x, &center[0].y, center.size(),
+                     0, 0, sizeof(ImPlotPoint));
+  }
+  if (!gaps.empty()) {
+    ImPlot::SetNextLineStyle(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), 3.0f);
+    ImPlot::PlotLine("Gaps", &gaps[0].x, &gaps[0].y, gaps.size(), 0, 0,
+                     sizeof(ImPlotPoint));
+  }
+  if (!missing.empty()) {
+    ImPlot::SetNextMarkerStyle(ImPlotMarker_Cross, 8,
+                               ImVec4(1.0f, 0.0f, 0.0f, 1.0f));
+    ImPlot::PlotScatter("Missing cones", &missing[0].x, &missing[0].y,
+                        missing.size(), 0, 0, sizeof(ImPlotPoint));
+  }
+}
+
+// Wakes the UI from the reader threads
+void requestFrame() { glfwPostEmptyEvent(); }
+
+// True if work taking about cost_us fits in the current frame. One piece
+// of work larger than the budget still runs in a frame otherwise empty.
+bool frameBudget(uint64_t cost_us) {
+  uint64_t elapsed = get_t() - frameStart;
+  if (elapsed + cost_us <= VIEWER_FRAME_BUDGET_US ||
+      (!frameHeavyDone && elapsed < VIEWER_FRAME_BUDGET_US / 4)) {
+    frameHeavyDone = true;
+    return true;
+  }
+  framesPending = std::max(framesPending, 1);
+  return false;
+}
+
+// Sleeps until input, new data or the timeout, unless frames are pending
+void waitFrame(double timeout_s) {
+  if (continuousRendering) {
+    glfwPollEvents();
+  } else if (framesPending > 0) {
+    framesPending--;
+    glfwPollEvents();
+  } else {
+    glfwWaitEventsTimeout(timeout_s);
+    framesPending = VIEWER_SETTLE_FRAMES - 1;
+  }
+  frameStart = get_t();
+  frameHeavyDone = false;
+}
+
+// Frame time, frame rate and CPU use of the process, in the top right corner
+void frameOverlay() {
+  static uint64_t windowStart = 0;
+  static uint64_t windowCpuUs = 0;
+  static int windowFrames = 0;
+  static uint64_t windowMaxUs = 0;
+  static float fps = 0.0f, cpu = 0.0f, maxMs = 0.0f;
+
+  windowFrames++;
+  windowMaxUs = std::max(windowMaxUs, frameTimeUs);
+  if (frameStart - windowStart >= 1000000) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t cpuUs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull +
+                     usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    double elapsed = (frameStart - windowStart) * 1e-6;
+    if (windowStart != 0) {
+      fps = windowFrames / elapsed;
+      cpu = (cpuUs - windowCpuUs) * 1e-4 / elapsed;
+      maxMs = windowMaxUs * 1e-3f;
+    }
+    windowStart = frameStart;
+    windowCpuUs = cpuUs;
+    windowFrames = 0;
+    windowMaxUs = 0;
+  }
+
+  const ImGuiViewport *viewport = ImGui::GetMainViewport();
+  ImGui::SetNextWindowPos(
+      ImVec2(viewport->WorkPos.x + viewport->WorkSize.x - 10.0f,
+             viewport->WorkPos.y + 10.0f),
+      ImGuiCond_Always, ImVec2(1.0f, 0.0f));
+  ImGui::SetNextWindowBgAlpha(0.35f);
+  ImGui::Begin("Frame", nullptr,
+               ImGuiWindowFlags_NoDecoration |
+                   ImGuiWindowFlags_AlwaysAutoResize |
+                   ImGuiWindowFlags_NoSavedSettings |
+                   ImGuiWindowFlags_NoFocusOnAppearing |
+                   ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoInputs);
+  ImGui::Text("Frame %.2f ms (max %.2f) %.1f fps CPU %.1f%% %s",
+              frameTimeUs * 1e-3f, maxMs, fps, cpu,
+              continuousRendering ? "continuous" : "on demand");
+  ImGui::End();
+}
+
 ImTextureID loadImageJPG(const char *path)
 {
   int width, height;
@@ -349,8 +919,6 @@ GLFWwindow *setupImGui() {
   return window;
 }
 void startFrame() {
-  glfwPollEvents();
-
   // Start the Dear ImGui frame
   ImGui_ImplOpenGL2_NewFrame();
   ImGui_ImplGlfw_NewFrame();
@@ -376,6 +944,7 @@ void endFrame(GLFWwindow *window) {
   ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
   // glUseProgram(last_program);
 
+  frameTimeUs = get_t() - frameStart;
   glfwMakeContextCurrent(window);
   glfwSwapBuffers(window);
 }